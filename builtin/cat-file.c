@@ -13,6 +13,7 @@
 #include "tree-walk.h"
 #include "sha1-array.h"
 #include "packfile.h"
+#include "oidset.h"
 
 struct batch_options {
 	int enabled;
@@ -20,6 +21,7 @@ struct batch_options {
 	int print_contents;
 	int buffer_output;
 	int all_objects;
+	int unordered;
 	int cmdmode; /* may be 'w' or 'c' for --filters or --textconv */
 	const char *format;
 };
@@ -209,6 +211,23 @@ struct expand_data {
 	 * optimized out.
 	 */
 	unsigned skip_object_info : 1;
+
+	/*
+	 * The contents of the object, if batch_prefetch() already read
+	 * them; print_object_or_die() then uses them instead of reading
+	 * the object again.
+	 */
+	void *contents;
+	unsigned long contents_size;
+	enum object_type contents_type;
+
+	/*
+	 * The pack the object was found in by an unordered walk, and its
+	 * offset there; print_object_or_die() then reads it from that
+	 * pack directly.
+	 */
+	struct packed_git *pack;
+	off_t offset;
 };
 
 static int is_atom(const char *atom, const char *s, int slen)
@@ -285,7 +304,30 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 
 	assert(data->info.typep);
 
-	if (data->type == OBJ_BLOB) {
+	if (data->pack &&
+	    (data->type != OBJ_BLOB || data->size < big_file_threshold)) {
+		enum object_type type;
+		unsigned long size;
+		void *contents;
+
+		contents = unpack_entry(data->pack, data->offset, &type, &size);
+		if (!contents)
+			die("unable to read %s from %s",
+			    oid_to_hex(oid), data->pack->pack_name);
+		if (type != data->type)
+			die("object %s changed type!?", oid_to_hex(oid));
+		if (size != data->size)
+			die("object %s changed size!?", oid_to_hex(oid));
+
+		batch_write(opt, contents, size);
+		free(contents);
+	} else if (data->contents) {
+		if (data->contents_type != data->type)
+			die("object %s changed type!?", oid_to_hex(oid));
+		if (data->info.sizep && data->contents_size != data->size)
+			die("object %s changed size!?", oid_to_hex(oid));
+		batch_write(opt, data->contents, data->contents_size);
+	} else if (data->type == OBJ_BLOB) {
 		if (opt->buffer_output)
 			fflush(stdout);
 		if (opt->cmdmode) {
@@ -407,6 +449,7 @@ static void batch_one_object(const char *obj_name, struct batch_options *opt,
 struct object_cb_data {
 	struct batch_options *opt;
 	struct expand_data *expand;
+	struct oidset *seen;
 };
 
 static int batch_object_cb(const struct object_id *oid, void *vdata)
@@ -417,6 +460,20 @@ static int batch_object_cb(const struct object_id *oid, void *vdata)
 	return 0;
 }
 
+/*
+ * Split at first whitespace, tying off the beginning of the string and
+ * returning the remainder (or NULL).
+ */
+static char *split_rest(char *buf)
+{
+	char *p = strpbrk(buf, " \t");
+	if (p) {
+		while (*p && strchr(" \t", *p))
+			*p++ = '\0';
+	}
+	return p;
+}
+
 static int batch_loose_object(const struct object_id *oid,
 			      const char *path,
 			      void *data)
@@ -434,6 +491,134 @@ static int batch_packed_object(const struct object_id *oid,
 	return 0;
 }
 
+static int batch_unordered_object(const struct object_id *oid, void *vdata)
+{
+	struct object_cb_data *data = vdata;
+
+	if (oidset_insert(data->seen, oid))
+		return 0;
+
+	return batch_object_cb(oid, data);
+}
+
+static int batch_unordered_loose(const struct object_id *oid,
+				 const char *path,
+				 void *data)
+{
+	return batch_unordered_object(oid, data);
+}
+
+/*
+ * The packs are walked in the order their objects are stored, so we
+ * can read the contents from the pack we are walking instead of
+ * looking them up again; delta bases then tend to be read just before
+ * the deltas that need them, while they are still in the delta base
+ * cache.
+ */
+static int batch_unordered_packed(const struct object_id *oid,
+				  struct packed_git *pack,
+				  uint32_t pos,
+				  void *vdata)
+{
+	struct object_cb_data *data = vdata;
+	struct expand_data *expand = data->expand;
+	int ret;
+
+	if (oidset_contains(data->seen, oid))
+		return 0;
+
+	if (data->opt->print_contents && !expand->skip_object_info &&
+	    lookup_replace_object(oid->hash) == oid->hash) {
+		expand->pack = pack;
+		expand->offset = nth_packed_object_offset(pack, pos);
+	}
+	ret = batch_unordered_object(oid, data);
+	expand->pack = NULL;
+	return ret;
+}
+
+/*
+ * With --batch --buffer, the caller does not expect an answer before it
+ * is done asking, so we read the names in chunks, read the objects of
+ * each chunk in the order they are stored in the packs, and only then
+ * print them in the order they were asked for.
+ */
+#define BATCH_PREFETCH_NR 1024
+#define BATCH_PREFETCH_BYTES (32 * 1024 * 1024)
+
+struct batch_line {
+	char *name;
+	const char *rest;
+	struct object_id oid;
+	void *contents;
+	unsigned long size;
+	enum object_type type;
+};
+
+struct batch_prefetch_cb {
+	struct batch_line **lines;
+	unsigned long total;
+};
+
+static int batch_prefetch_one(const struct object_id *oid, size_t pos,
+			      enum object_type type, unsigned long size,
+			      void *contents, void *vdata)
+{
+	struct batch_prefetch_cb *cb = vdata;
+	struct batch_line *line = cb->lines[pos];
+
+	if (!contents)
+		return 0;
+	line->contents = contents;
+	line->size = size;
+	line->type = type;
+	cb->total += size;
+	return cb->total >= BATCH_PREFETCH_BYTES;
+}
+
+static void batch_prefetch(struct batch_options *opt, struct expand_data *data,
+			   struct batch_line *lines, size_t nr)
+{
+	struct oid_array to_read = OID_ARRAY_INIT;
+	struct batch_prefetch_cb cb;
+	int flags = opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0;
+	size_t i;
+
+	/* batch_one_object() resolves the names again and reports errors */
+	flags |= GET_OID_QUIETLY;
+	cb.total = 0;
+	ALLOC_ARRAY(cb.lines, nr);
+	for (i = 0; i < nr; i++) {
+		struct object_context ctx;
+		struct object_id replaced;
+
+		if (get_oid_with_context(lines[i].name, flags,
+					 &lines[i].oid, &ctx) != FOUND ||
+		    !ctx.mode)
+			continue;
+		hashcpy(replaced.hash, lookup_replace_object(lines[i].oid.hash));
+		cb.lines[to_read.nr] = &lines[i];
+		oid_array_append(&to_read, &replaced);
+	}
+	for_each_object_in_pack_order(to_read.oid, to_read.nr,
+				      BATCH_PREFETCH_BYTES,
+				      batch_prefetch_one, &cb);
+
+	for (i = 0; i < nr; i++) {
+		data->rest = lines[i].rest;
+		data->contents = lines[i].contents;
+		data->contents_size = lines[i].size;
+		data->contents_type = lines[i].type;
+		batch_one_object(lines[i].name, opt, data);
+		free(lines[i].contents);
+		free(lines[i].name);
+	}
+	data->contents = NULL;
+
+	free(cb.lines);
+	oid_array_clear(&to_read);
+}
+
 static int batch_objects(struct batch_options *opt)
 {
 	struct strbuf buf = STRBUF_INIT;
@@ -466,8 +651,27 @@ static int batch_objects(struct batch_options *opt)
 	 * If we are printing out the object, then always fill in the type,
 	 * since we will want to decide whether or not to stream.
 	 */
-	if (opt->print_contents)
+	if (opt->print_contents) {
 		data.info.typep = &data.type;
+		if (opt->unordered)
+			data.info.sizep = &data.size;
+	}
+
+	if (opt->all_objects && opt->unordered) {
+		struct oidset seen = OIDSET_INIT;
+		struct object_cb_data cb;
+
+		cb.opt = opt;
+		cb.expand = &data;
+		cb.seen = &seen;
+
+		for_each_packed_object(batch_unordered_packed, &cb,
+				       FOR_EACH_OBJECT_PACK_ORDER);
+		for_each_loose_object(batch_unordered_loose, &cb, 0);
+
+		oidset_clear(&seen);
+		return 0;
+	}
 
 	if (opt->all_objects) {
 		struct oid_array sa = OID_ARRAY_INIT;
@@ -494,22 +698,32 @@ static int batch_objects(struct batch_options *opt)
 	save_warning = warn_on_object_refname_ambiguity;
 	warn_on_object_refname_ambiguity = 0;
 
-	while (strbuf_getline(&buf, stdin) != EOF) {
-		if (data.split_on_whitespace) {
-			/*
-			 * Split at first whitespace, tying off the beginning
-			 * of the string and saving the remainder (or NULL) in
-			 * data.rest.
-			 */
-			char *p = strpbrk(buf.buf, " \t");
-			if (p) {
-				while (*p && strchr(" \t", *p))
-					*p++ = '\0';
+	if (opt->buffer_output && opt->print_contents && !opt->cmdmode) {
+		struct batch_line *lines;
+		size_t nr = 0;
+
+		ALLOC_ARRAY(lines, BATCH_PREFETCH_NR);
+		while (strbuf_getline(&buf, stdin) != EOF) {
+			struct batch_line *line = &lines[nr++];
+
+			memset(line, 0, sizeof(*line));
+			line->name = strbuf_detach(&buf, NULL);
+			if (data.split_on_whitespace)
+				line->rest = split_rest(line->name);
+			if (nr == BATCH_PREFETCH_NR) {
+				batch_prefetch(opt, &data, lines, nr);
+				nr = 0;
 			}
-			data.rest = p;
 		}
-
-		batch_one_object(buf.buf, opt, &data);
+		batch_prefetch(opt, &data, lines, nr);
+		free(lines);
+	} else {
+		while (strbuf_getline(&buf, stdin) != EOF) {
+			if (data.split_on_whitespace)
+				data.rest = split_rest(buf.buf);
+
+			batch_one_object(buf.buf, opt, &data);
+		}
 	}
 
 	strbuf_release(&buf);
@@ -581,6 +795,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			 N_("follow in-tree symlinks (used with --batch or --batch-check)")),
 		OPT_BOOL(0, "batch-all-objects", &batch.all_objects,
 			 N_("show all objects with --batch or --batch-check")),
+		OPT_BOOL(0, "unordered", &batch.unordered,
+			 N_("do not order --batch-all-objects output")),
 		OPT_END()
 	};
 
@@ -616,6 +832,9 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		usage_with_options(cat_file_usage, options);
 	}
 
+	if (batch.unordered && !batch.all_objects)
+		usage_with_options(cat_file_usage, options);
+
 	if (force_path && opt != 'c' && opt != 'w') {
 		error("--path=<path> needs --textconv or --filters");
 		usage_with_options(cat_file_usage, options);
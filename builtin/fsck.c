@@ -16,6 +16,7 @@
 #include "streaming.h"
 #include "decorate.h"
 #include "packfile.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -41,6 +42,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int nr_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -97,6 +99,12 @@ static int fsck_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "pack.threads")) {
+		if (!nr_threads)
+			nr_threads = git_config_int(var, value);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
@@ -117,7 +125,10 @@ static int objerror(struct object *obj, const char *err)
 static int fsck_error_func(struct fsck_options *o,
 	struct object *obj, int type, const char *message)
 {
+	/* fsck_obj() calls fsck_object() without pack_read_lock() */
+	pack_read_lock();
 	objreport(obj, (type == FSCK_WARN) ? "warning" : "error", message);
+	pack_read_unlock();
 	return (type == FSCK_WARN) ? 0 : 1;
 }
 
@@ -320,7 +331,13 @@ static void check_connectivity(void)
 	}
 }
 
-static int fsck_obj(struct object *obj)
+/*
+ * Check "obj", whose contents are in "buffer" if it is not NULL. When
+ * called from the threads of verify_pack(), pack_read_lock() is held
+ * and also guards the object hash and the flags; we drop it while
+ * fsck_object() looks at this object and its buffer alone.
+ */
+static int fsck_obj(struct object *obj, void *buffer, unsigned long size)
 {
 	int err;
 
@@ -334,7 +351,9 @@ static int fsck_obj(struct object *obj)
 
 	if (fsck_walk(obj, NULL, &fsck_obj_options))
 		objerror(obj, "broken links");
-	err = fsck_object(obj, NULL, 0, &fsck_obj_options);
+	pack_read_unlock();
+	err = fsck_object(obj, buffer, size, &fsck_obj_options);
+	pack_read_lock();
 	if (err)
 		goto out;
 
@@ -379,7 +398,7 @@ static int fsck_obj_buffer(const struct object_id *oid, enum object_type type,
 	}
 	obj->flags &= ~(REACHABLE | SEEN);
 	obj->flags |= HAS_OBJ;
-	return fsck_obj(obj);
+	return fsck_obj(obj, buffer, size);
 }
 
 static int default_refs;
@@ -514,7 +533,7 @@ static int fsck_loose(const struct object_id *oid, const char *path, void *data)
 
 	obj->flags &= ~(REACHABLE | SEEN);
 	obj->flags |= HAS_OBJ;
-	if (fsck_obj(obj))
+	if (fsck_obj(obj, NULL, 0))
 		errors_found |= ERROR_OBJECT;
 	return 0;
 }
@@ -651,6 +670,7 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("number of threads to check packs with")),
 	OPT_END(),
 };
 
@@ -686,6 +706,17 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	git_config(fsck_config, NULL);
 
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+#ifdef NO_PTHREADS
+	if (nr_threads > 1)
+		warning(_("no threads support, ignoring --threads"));
+	nr_threads = 1;
+#else
+	if (!nr_threads)
+		nr_threads = online_cpus();
+#endif
+
 	fsck_head_link();
 	if (connectivity_only) {
 		for_each_loose_object(mark_loose_for_connectivity, NULL, 0);
@@ -704,6 +735,15 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 			prepare_packed_git();
 
+			/*
+			 * Set up what fsck_object() reads lazily, as it
+			 * runs unlocked in the threads of verify_pack().
+			 */
+			prepare_commit_graft();
+			if (fsck_obj_options.skiplist)
+				oid_array_lookup(fsck_obj_options.skiplist,
+						 &null_oid);
+
 			if (show_progress) {
 				for (p = packed_git; p; p = p->next) {
 					if (open_pack_index(p))
@@ -716,7 +756,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 			for (p = packed_git; p; p = p->next) {
 				/* verify gives error messages itself */
 				if (verify_pack(p, fsck_obj_buffer,
-						progress, count))
+						progress, count, nr_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -13,13 +13,16 @@
 #include "streaming.h"
 #include "thread-utils.h"
 #include "packfile.h"
+#include "dir.h"
+#include "tempfile.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--[no-]rev-index] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
 	unsigned long size;
+	unsigned long real_size; /* of the object, even for deltas */
 	unsigned char hdr_size;
 	signed char type;
 	signed char real_type;
@@ -82,6 +85,7 @@ static int verbose;
 static int show_resolving_progress;
 static int show_stat;
 static int check_self_contained_and_connected;
+static int low_memory;
 
 static struct progress *progress;
 
@@ -282,8 +286,7 @@ static void *fill(int min)
 			die_errno(_("read error on input"));
 		}
 		input_len += ret;
-		if (from_stdin)
-			display_throughput(progress, consumed_bytes + input_len);
+		display_throughput(progress, consumed_bytes + input_len);
 	} while (input_len < min);
 	return input_buffer;
 }
@@ -330,6 +333,68 @@ static const char *open_pack_file(const char *pack_name)
 	return pack_name;
 }
 
+/*
+ * The tables we keep for every object of the pack. With --low-memory,
+ * they live in temporary files next to the pack that are mapped into
+ * memory, so that the kernel can write them back and drop them from
+ * core instead of swapping when the pack has hundreds of millions of
+ * objects. Growing a table zeroes the new entries either way.
+ */
+struct spill_table {
+	void *buf;
+	size_t size;
+	struct tempfile *tempfile;
+};
+
+static struct spill_table objects_table, obj_stat_table;
+static struct spill_table ofs_deltas_table, ref_deltas_table;
+
+static void *grow_table(struct spill_table *t, size_t nr, size_t size)
+{
+	size_t new_size = st_mult(nr, size);
+
+	if (new_size <= t->size)
+		return t->buf;
+
+	if (!low_memory) {
+		t->buf = xrealloc(t->buf, new_size);
+		memset((char *)t->buf + t->size, 0, new_size - t->size);
+	} else {
+		int fd;
+
+		if (!t->tempfile) {
+			struct strbuf path = STRBUF_INIT;
+
+			strbuf_addf(&path, "%s_tables_XXXXXX", curr_pack);
+			t->tempfile = xmks_tempfile(path.buf);
+			strbuf_release(&path);
+		}
+		fd = get_tempfile_fd(t->tempfile);
+		if (t->buf)
+			munmap(t->buf, t->size);
+		if (ftruncate(fd, new_size))
+			die_errno(_("unable to grow '%s'"),
+				  get_tempfile_path(t->tempfile));
+		t->buf = xmmap(NULL, new_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, fd, 0);
+	}
+	t->size = new_size;
+	return t->buf;
+}
+
+static void release_table(struct spill_table *t)
+{
+	if (!t->tempfile)
+		free(t->buf);
+	else {
+		if (t->buf)
+			munmap(t->buf, t->size);
+		delete_tempfile(&t->tempfile);
+	}
+	t->buf = NULL;
+	t->size = 0;
+}
+
 static void parse_pack_header(void)
 {
 	struct pack_header *hdr = fill(sizeof(struct pack_header));
@@ -447,17 +512,24 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %lu", typename(type), size) + 1;
-		git_SHA1_Init(&c);
-		git_SHA1_Update(&c, hdr, hdrlen);
-	} else
-		sha1 = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	if (is_delta_type(type))
+		sha1 = NULL;
+#ifndef NO_PTHREADS
+	/* the first pass workers hash what we keep in core */
+	if (threads_active && buf != fixed_buf)
+		sha1 = NULL;
+#endif
+	if (sha1) {
+		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %lu", typename(type), size) + 1;
+		git_SHA1_Init(&c);
+		git_SHA1_Update(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -958,6 +1030,7 @@ static void resolve_delta(struct object_entry *delta_obj,
 	free(delta_data);
 	if (!result->data)
 		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
+	delta_obj->real_size = result->size;
 	hash_sha1_file(result->data, result->size,
 		       typename(delta_obj->real_type),
 		       delta_obj->idx.oid.hash);
@@ -1088,6 +1161,114 @@ static void resolve_base(struct object_entry *obj)
 }
 
 #ifndef NO_PTHREADS
+/*
+ * The first pass has to inflate every object to find where the next
+ * one starts, which the main thread does as it reads the pack. When
+ * threaded, it hands the non-delta objects it inflated to worker
+ * threads to be hashed and checked, through a queue bounded both in
+ * entries and in bytes. Offsets and CRCs are still computed by the
+ * main thread, in pack order.
+ */
+#define FIRST_PASS_QUEUE_BYTES (32 * 1024 * 1024)
+
+struct first_pass_item {
+	struct object_entry *obj;
+	void *data;
+};
+
+static struct first_pass_item *first_pass_queue;
+static int first_pass_alloc, first_pass_head, first_pass_nr;
+static unsigned long first_pass_bytes;
+static int first_pass_done;
+static pthread_cond_t first_pass_more;
+static pthread_cond_t first_pass_room;
+
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		struct first_pass_item item;
+		struct object_entry *obj;
+
+		work_lock();
+		while (!first_pass_nr && !first_pass_done)
+			pthread_cond_wait(&first_pass_more, &work_mutex);
+		if (!first_pass_nr) {
+			work_unlock();
+			break;
+		}
+		item = first_pass_queue[first_pass_head];
+		first_pass_head = (first_pass_head + 1) % first_pass_alloc;
+		first_pass_nr--;
+		work_unlock();
+
+		obj = item.obj;
+		hash_sha1_file(item.data, obj->size, typename(obj->type),
+			       obj->idx.oid.hash);
+		sha1_object(item.data, NULL, obj->size, obj->type,
+			    &obj->idx.oid);
+		free(item.data);
+
+		work_lock();
+		first_pass_bytes -= obj->size;
+		pthread_cond_signal(&first_pass_room);
+		work_unlock();
+	}
+	return NULL;
+}
+
+static void queue_first_pass(struct object_entry *obj, void *data)
+{
+	struct first_pass_item *item;
+
+	work_lock();
+	while (first_pass_nr == first_pass_alloc ||
+	       (first_pass_nr &&
+		first_pass_bytes + obj->size > FIRST_PASS_QUEUE_BYTES))
+		pthread_cond_wait(&first_pass_room, &work_mutex);
+	item = &first_pass_queue[(first_pass_head + first_pass_nr) %
+				 first_pass_alloc];
+	item->obj = obj;
+	item->data = data;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	pthread_cond_signal(&first_pass_more);
+	work_unlock();
+}
+
+static void start_threaded_first_pass(void)
+{
+	int i;
+
+	init_thread();
+	pthread_cond_init(&first_pass_more, NULL);
+	pthread_cond_init(&first_pass_room, NULL);
+	first_pass_alloc = nr_threads * 16;
+	ALLOC_ARRAY(first_pass_queue, first_pass_alloc);
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void finish_threaded_first_pass(void)
+{
+	int i;
+
+	work_lock();
+	first_pass_done = 1;
+	pthread_cond_broadcast(&first_pass_more);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	pthread_cond_destroy(&first_pass_more);
+	pthread_cond_destroy(&first_pass_room);
+	FREE_AND_NULL(first_pass_queue);
+	cleanup_thread();
+}
+
 static void *threaded_second_pass(void *data)
 {
 	set_thread_data(data);
@@ -1116,7 +1297,8 @@ static void *threaded_second_pass(void *data)
 /*
  * First pass:
  * - find locations of all objects;
- * - calculate SHA1 of all non-delta objects;
+ * - calculate SHA1 of all non-delta objects (in worker threads, if
+ *   we have them);
  * - remember base (SHA1 or offset) for all deltas.
  */
 static void parse_pack_objects(unsigned char *sha1)
@@ -1130,18 +1312,28 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))
+		start_threaded_first_pass();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
 					      ref_delta_sha1,
 					      obj->idx.oid.hash);
 		obj->real_type = obj->type;
+		obj->real_size = obj->size;
 		if (obj->type == OBJ_OFS_DELTA) {
 			nr_ofs_deltas++;
 			ofs_delta->obj_no = i;
 			ofs_delta++;
 		} else if (obj->type == OBJ_REF_DELTA) {
-			ALLOC_GROW(ref_deltas, nr_ref_deltas + 1, ref_deltas_alloc);
+			if (nr_ref_deltas >= ref_deltas_alloc) {
+				ref_deltas_alloc = alloc_nr(ref_deltas_alloc);
+				ref_deltas = grow_table(&ref_deltas_table,
+							ref_deltas_alloc,
+							sizeof(*ref_deltas));
+			}
 			hashcpy(ref_deltas[nr_ref_deltas].sha1, ref_delta_sha1);
 			ref_deltas[nr_ref_deltas].obj_no = i;
 			nr_ref_deltas++;
@@ -1149,13 +1341,24 @@ static void parse_pack_objects(unsigned char *sha1)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type,
-				    &obj->idx.oid);
+		} else {
+#ifndef NO_PTHREADS
+			if (threads_active) {
+				queue_first_pass(obj, data);
+				data = NULL;
+			} else
+#endif
+				sha1_object(data, NULL, obj->size, obj->type,
+					    &obj->idx.oid);
+		}
 		free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+#ifndef NO_PTHREADS
+	if (threads_active)
+		finish_threaded_first_pass();
+#endif
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1211,6 +1414,9 @@ static void resolve_deltas(void)
 #ifndef NO_PTHREADS
 	nr_dispatched = 0;
 	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		/* each thread keeps its own cache of bases */
+		if (low_memory)
+			delta_base_cache_limit /= nr_threads;
 		init_thread();
 		for (i = 0; i < nr_threads; i++) {
 			int ret = pthread_create(&thread_data[i].thread, NULL,
@@ -1259,9 +1465,9 @@ static void conclude_pack(int fix_thin_pack, const char *curr_pack, unsigned cha
 		int nr_objects_initial = nr_objects;
 		if (nr_unresolved <= 0)
 			die(_("confusion beyond insanity"));
-		REALLOC_ARRAY(objects, nr_objects + nr_unresolved + 1);
-		memset(objects + nr_objects + 1, 0,
-		       nr_unresolved * sizeof(*objects));
+		objects = grow_table(&objects_table,
+				     st_add3(nr_objects, nr_unresolved, 1),
+				     sizeof(*objects));
 		f = sha1fd(output_fd, curr_pack);
 		fix_unresolved_deltas(f);
 		strbuf_addf(&msg, Q_("completed with %d local object",
@@ -1332,6 +1538,7 @@ static struct object_entry *append_obj_to_pack(struct sha1file *f,
 	obj[0].hdr_size = n;
 	obj[0].type = type;
 	obj[0].real_type = type;
+	obj[0].real_size = size;
 	obj[1].idx.offset = obj[0].idx.offset + n;
 	obj[1].idx.offset += write_compressed(f, buf, size);
 	obj[0].idx.crc32 = crc32_end(f);
@@ -1391,12 +1598,14 @@ static void fix_unresolved_deltas(struct sha1file *f)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_index_name, const char *curr_rev_index_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
 	const char *report = "pack";
 	struct strbuf pack_name = STRBUF_INIT;
 	struct strbuf index_name = STRBUF_INIT;
+	struct strbuf rev_index_name = STRBUF_INIT;
 	struct strbuf keep_name_buf = STRBUF_INIT;
 	int err;
 
@@ -1440,6 +1649,17 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	/* put the ".rev" in place before the ".idx" makes the pack visible */
+	if (!curr_rev_index_name)
+		; /* not writing one */
+	else if (final_rev_index_name != curr_rev_index_name) {
+		if (!final_rev_index_name)
+			final_rev_index_name = odb_pack_name(&rev_index_name, sha1, "rev");
+		if (finalize_object_file(curr_rev_index_name, final_rev_index_name))
+			die(_("cannot store reverse index file"));
+	} else
+		chmod(final_rev_index_name, 0444);
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name)
 			final_index_name = odb_pack_name(&index_name, sha1, "idx");
@@ -1471,20 +1691,43 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	}
 
 	strbuf_release(&index_name);
+	strbuf_release(&rev_index_name);
 	strbuf_release(&pack_name);
 	strbuf_release(&keep_name_buf);
 }
 
+static void idx_object_info(const struct pack_idx_entry *idx,
+			    enum object_type *type, unsigned long *size,
+			    int *is_delta, void *data)
+{
+	const struct object_entry *obj = (const struct object_entry *)idx;
+
+	*type = obj->real_type;
+	*size = obj->real_size;
+	*is_delta = is_delta_type(obj->type);
+}
+
 static int git_index_pack_config(const char *k, const char *v, void *cb)
 {
 	struct pack_idx_option *opts = cb;
 
 	if (!strcmp(k, "pack.indexversion")) {
 		opts->version = git_config_int(k, v);
-		if (opts->version > 2)
+		if (opts->version > 3)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.indexlowmemory")) {
+		low_memory = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1557,7 +1800,7 @@ static void read_idx_option(struct pack_idx_option *opts, const char *pack_name)
 	/* Read the attributes from the existing idx file */
 	opts->version = p->index_version;
 
-	if (opts->version == 2)
+	if (opts->version >= 2)
 		read_v2_anomalous_offsets(p, opts);
 
 	/*
@@ -1615,13 +1858,13 @@ static void show_pack_info(int stat_only)
 	}
 }
 
-static const char *derive_filename(const char *pack_name, const char *suffix,
-				   struct strbuf *buf)
+static const char *derive_filename(const char *pack_name, const char *strip,
+				   const char *suffix, struct strbuf *buf)
 {
 	size_t len;
-	if (!strip_suffix(pack_name, ".pack", &len))
-		die(_("packfile name '%s' does not end with '.pack'"),
-		    pack_name);
+	if (!strip_suffix(pack_name, strip, &len))
+		die(_("packfile name '%s' does not end with '%s'"),
+		    pack_name, strip);
 	strbuf_add(buf, pack_name, len);
 	strbuf_addstr(buf, suffix);
 	return buf->buf;
@@ -1630,10 +1873,12 @@ static const char *derive_filename(const char *pack_name, const char *suffix,
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
+	const char *curr_index, *curr_rev_index;
 	const char *index_name = NULL, *pack_name = NULL;
+	const char *rev_index_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT,
+		      rev_index_name_buf = STRBUF_INIT,
 		      keep_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
@@ -1670,6 +1915,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			} else if (!strcmp(arg, "--check-self-contained-and-connected")) {
 				strict = 1;
 				check_self_contained_and_connected = 1;
+			} else if (!strcmp(arg, "--low-memory")) {
+				low_memory = 1;
 			} else if (!strcmp(arg, "--verify")) {
 				verify = 1;
 			} else if (!strcmp(arg, "--verify-stat")) {
@@ -1679,6 +1926,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				verify = 1;
 				show_stat = 1;
 				stat_only = 1;
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (!strcmp(arg, "--keep")) {
 				keep_msg = "";
 			} else if (starts_with(arg, "--keep=")) {
@@ -1720,7 +1971,7 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			} else if (starts_with(arg, "--index-version=")) {
 				char *c;
 				opts.version = strtoul(arg + 16, &c, 10);
-				if (opts.version > 2)
+				if (opts.version > 3)
 					die(_("bad %s"), arg);
 				if (*c == ',')
 					opts.off32_limit = strtoul(c+1, &c, 0);
@@ -1745,9 +1996,9 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (from_stdin && !startup_info->have_repository)
 		die(_("--stdin requires a git repository"));
 	if (!index_name && pack_name)
-		index_name = derive_filename(pack_name, ".idx", &index_name_buf);
+		index_name = derive_filename(pack_name, ".pack", ".idx", &index_name_buf);
 	if (keep_msg && !keep_name && pack_name)
-		keep_name = derive_filename(pack_name, ".keep", &keep_name_buf);
+		keep_name = derive_filename(pack_name, ".pack", ".keep", &keep_name_buf);
 
 	if (verify) {
 		if (!index_name)
@@ -1755,6 +2006,19 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
 	}
+	if (index_name) {
+		/* the ".rev" lives next to the ".idx", if it is named like one */
+		if (ends_with(index_name, ".idx"))
+			rev_index_name = derive_filename(index_name, ".idx", ".rev",
+							 &rev_index_name_buf);
+		else
+			opts.flags &= ~WRITE_REV;
+	}
+	/* --verify checks the reverse index too, when there is one */
+	if (verify)
+		opts.flags &= ~WRITE_REV;
+	if (verify && rev_index_name && file_exists(rev_index_name))
+		opts.flags |= WRITE_REV;
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
 
@@ -1769,17 +2033,20 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
-	objects = xcalloc(st_add(nr_objects, 1), sizeof(struct object_entry));
+	objects = grow_table(&objects_table, st_add(nr_objects, 1),
+			     sizeof(struct object_entry));
 	if (show_stat)
-		obj_stat = xcalloc(st_add(nr_objects, 1), sizeof(struct object_stat));
-	ofs_deltas = xcalloc(nr_objects, sizeof(struct ofs_delta_entry));
+		obj_stat = grow_table(&obj_stat_table, st_add(nr_objects, 1),
+				      sizeof(struct object_stat));
+	ofs_deltas = grow_table(&ofs_deltas_table, nr_objects,
+				sizeof(struct ofs_delta_entry));
 	parse_pack_objects(pack_sha1);
 	if (report_end_of_input)
 		write_in_full(2, "\0", 1);
 	resolve_deltas();
 	conclude_pack(fix_thin_pack, curr_pack, pack_sha1);
-	free(ofs_deltas);
-	free(ref_deltas);
+	release_table(&ofs_deltas_table);
+	release_table(&ref_deltas_table);
 	if (strict)
 		foreign_nr = check_objects();
 
@@ -1789,23 +2056,31 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	ALLOC_ARRAY(idx_objects, nr_objects);
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
+	opts.object_info = idx_object_info;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	curr_rev_index = write_rev_file(rev_index_name, idx_objects, nr_objects,
+					&opts, pack_sha1);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_index_name, curr_rev_index,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
 		close(input_fd);
-	free(objects);
+	release_table(&objects_table);
+	release_table(&obj_stat_table);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_index_name_buf);
 	strbuf_release(&keep_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_index_name == NULL)
+		free((void *) curr_rev_index);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -26,6 +26,8 @@
 #include "argv-array.h"
 #include "mru.h"
 #include "packfile.h"
+#include "delta-islands.h"
+#include "string-list.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [<options>...] [< <ref-list> | < <object-list>]"),
@@ -40,6 +42,19 @@ static const char *pack_usage[] = {
  */
 static struct packing_data to_pack;
 
+#define IN_PACK(obj) oe_in_pack(&to_pack, obj)
+#define SIZE(obj) oe_size(&to_pack, obj)
+#define DELTA_SIZE(obj) oe_delta_size(&to_pack, obj)
+#define DELTA(obj) oe_delta(&to_pack, obj)
+#define DELTA_CHILD(obj) oe_delta_child(&to_pack, obj)
+#define DELTA_SIBLING(obj) oe_delta_sibling(&to_pack, obj)
+#define SET_IN_PACK(obj, val) oe_set_in_pack(&to_pack, obj, val)
+#define SET_SIZE(obj, val) oe_set_size(&to_pack, obj, val)
+#define SET_DELTA_SIZE(obj, val) oe_set_delta_size(&to_pack, obj, val)
+#define SET_DELTA(obj, val) oe_set_delta(&to_pack, obj, val)
+#define SET_DELTA_CHILD(obj, val) oe_set_delta_child(&to_pack, obj, val)
+#define SET_DELTA_SIBLING(obj, val) oe_set_delta_sibling(&to_pack, obj, val)
+
 static struct pack_idx_entry **written_list;
 static uint32_t nr_result, nr_written;
 
@@ -66,12 +81,13 @@ static struct progress *progress_state;
 
 static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
+static int use_delta_islands;
 static int write_bitmap_index;
-static uint16_t write_bitmap_options;
+static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 256 * 1024 * 1024;
@@ -102,23 +118,88 @@ static void index_commit_for_bitmap(struct commit *commit)
 	indexed_commits[indexed_commits_nr++] = commit;
 }
 
+/*
+ * Locking for the phases that may run in several threads: check_object(),
+ * the delta search and the compression of objects while writing.
+ */
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t read_mutex;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t cache_mutex;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+static void try_to_free_from_threads(size_t size)
+{
+	read_lock();
+	release_pack_memory(size);
+	read_unlock();
+}
+
+static try_to_free_t old_try_to_free_routine;
+
+static pthread_cond_t progress_cond;
+
+/*
+ * Mutex and conditional variable can't be statically-initialized on Windows.
+ */
+static void init_threaded_search(void)
+{
+	init_recursive_mutex(&read_mutex);
+	pthread_mutex_init(&cache_mutex, NULL);
+	pthread_mutex_init(&progress_mutex, NULL);
+	pthread_cond_init(&progress_cond, NULL);
+	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+}
+
+static void cleanup_threaded_search(void)
+{
+	set_try_to_free_routine(old_try_to_free_routine);
+	pthread_cond_destroy(&progress_cond);
+	pthread_mutex_destroy(&read_mutex);
+	pthread_mutex_destroy(&cache_mutex);
+	pthread_mutex_destroy(&progress_mutex);
+}
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#endif
+
 static void *get_delta(struct object_entry *entry)
 {
 	unsigned long size, base_size, delta_size;
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
+	read_lock();
 	buf = read_sha1_file(entry->idx.oid.hash, &type, &size);
+	read_unlock();
 	if (!buf)
 		die("unable to read %s", oid_to_hex(&entry->idx.oid));
-	base_buf = read_sha1_file(entry->delta->idx.oid.hash, &type,
+	read_lock();
+	base_buf = read_sha1_file(DELTA(entry)->idx.oid.hash, &type,
 				  &base_size);
+	read_unlock();
 	if (!base_buf)
 		die("unable to read %s",
-		    oid_to_hex(&entry->delta->idx.oid));
+		    oid_to_hex(&DELTA(entry)->idx.oid));
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
-	if (!delta_buf || delta_size != entry->delta_size)
+	if (!delta_buf || delta_size != DELTA_SIZE(entry))
 		die("delta size changed");
 	free(buf);
 	free(base_buf);
@@ -150,6 +231,276 @@ static unsigned long do_compress(void **pptr, unsigned long size)
 	return stream.total_out;
 }
 
+/*
+ * Can the in-pack representation of "entry" be copied as is, given
+ * whether its delta base will be usable in the pack being written?
+ */
+static int want_reuse(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA || oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (DELTA(entry))
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Deflating the objects that are not reused is the slowest part of
+ * writing a pack once the deltas are known (think "repack -f" with a
+ * high pack.compression). With several threads, workers compress these
+ * objects ahead of the writer, walking the write order, and the writer
+ * picks the results up in write_no_reuse_object(). The compressed data
+ * is what the writer would have produced itself, so the pack is
+ * identical to one written by a single thread.
+ *
+ * Workers stay at most COMPRESS_AHEAD objects in front of the writer.
+ * An object the writer needs before any worker has started on it (e.g.
+ * a delta base coming later in the write order) is compressed by the
+ * writer itself.
+ */
+#define COMPRESS_AHEAD 1024
+
+enum compress_state {
+	COMPRESS_PENDING = 0,
+	COMPRESS_WORKING,	/* a worker is compressing it */
+	COMPRESS_DONE,		/* the result is waiting in its slot */
+	COMPRESS_CLAIMED	/* the writer owns it */
+};
+
+struct compressed_object {
+	void *buf;
+	unsigned long size;	/* uncompressed size */
+	unsigned long datalen;	/* compressed size */
+	enum object_type type;
+	int usable_delta;
+};
+
+static int compress_nr_threads;
+static pthread_t *compress_threads;
+static pthread_mutex_t compress_mutex;
+static pthread_cond_t compress_cond;
+static struct object_entry **compress_order;
+static uint32_t compress_next, compress_writer;
+static int compress_stop;
+/* enum compress_state and write order position, indexed like to_pack.objects */
+static unsigned char *compress_state;
+static uint32_t *compress_pos;
+static struct compressed_object compress_slot[COMPRESS_AHEAD];
+
+/*
+ * Would write_no_reuse_object() deflate this entry, and is it worth
+ * doing ahead of time? Only called when the pack is not split, so a
+ * delta base is always usable.
+ */
+static int want_compress_ahead(struct object_entry *entry)
+{
+	int usable_delta = !!DELTA(entry);
+
+	if (entry->preferred_base || want_reuse(entry, usable_delta))
+		return 0;
+	if (usable_delta)
+		return !entry->z_delta_size; /* unless already cached */
+	/* big blobs are streamed by the writer */
+	return oe_type(entry) != OBJ_BLOB || SIZE(entry) <= big_file_threshold;
+}
+
+static void compress_ahead(struct object_entry *entry,
+			   struct compressed_object *c)
+{
+	void *buf;
+
+	c->usable_delta = !!DELTA(entry);
+	if (c->usable_delta && entry->delta_data) {
+		buf = entry->delta_data;
+		entry->delta_data = NULL;
+		c->size = DELTA_SIZE(entry);
+	} else if (c->usable_delta) {
+		buf = get_delta(entry);
+		c->size = DELTA_SIZE(entry);
+	} else {
+		read_lock();
+		buf = read_sha1_file(entry->idx.oid.hash, &c->type, &c->size);
+		read_unlock();
+		if (!buf)
+			die(_("unable to read %s"), oid_to_hex(&entry->idx.oid));
+	}
+	c->datalen = do_compress(&buf, c->size);
+	c->buf = buf;
+}
+
+static void *threaded_compress(void *arg)
+{
+	pthread_mutex_lock(&compress_mutex);
+	for (;;) {
+		struct object_entry *entry;
+		uint32_t pos, ix;
+
+		while (!compress_stop && compress_next < to_pack.nr_objects &&
+		       compress_next >= compress_writer + COMPRESS_AHEAD)
+			pthread_cond_wait(&compress_cond, &compress_mutex);
+		if (compress_stop || compress_next >= to_pack.nr_objects)
+			break;
+
+		pos = compress_next++;
+		entry = compress_order[pos];
+		ix = entry - to_pack.objects;
+		if (compress_state[ix] != COMPRESS_PENDING ||
+		    !want_compress_ahead(entry))
+			continue;
+
+		compress_state[ix] = COMPRESS_WORKING;
+		pthread_mutex_unlock(&compress_mutex);
+		compress_ahead(entry, &compress_slot[pos % COMPRESS_AHEAD]);
+		pthread_mutex_lock(&compress_mutex);
+		compress_state[ix] = COMPRESS_DONE;
+		pthread_cond_broadcast(&compress_cond);
+	}
+	pthread_mutex_unlock(&compress_mutex);
+	return NULL;
+}
+
+/*
+ * Set up the locks used while writing objects and, when it pays off,
+ * start the compression threads working on "write_order".
+ */
+static void start_compress_threads(struct object_entry **write_order)
+{
+	uint32_t j;
+	int i, ret;
+
+	init_threaded_search();
+
+	/* with a split pack we cannot tell in advance which deltas are usable */
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+
+	compress_order = write_order;
+	compress_next = compress_writer = 0;
+	compress_stop = 0;
+	compress_state = xcalloc(to_pack.nr_objects, sizeof(*compress_state));
+	ALLOC_ARRAY(compress_pos, to_pack.nr_objects);
+	for (j = 0; j < to_pack.nr_objects; j++)
+		compress_pos[write_order[j] - to_pack.objects] = j;
+	pthread_mutex_init(&compress_mutex, NULL);
+	pthread_cond_init(&compress_cond, NULL);
+
+	ALLOC_ARRAY(compress_threads, delta_search_threads);
+	for (i = 0; i < delta_search_threads; i++) {
+		ret = pthread_create(&compress_threads[i], NULL,
+				     threaded_compress, NULL);
+		if (ret) {
+			warning("unable to create thread: %s", strerror(ret));
+			break;
+		}
+		compress_nr_threads++;
+	}
+}
+
+static void finish_compress_threads(void)
+{
+	int i;
+
+	if (compress_nr_threads) {
+		pthread_mutex_lock(&compress_mutex);
+		compress_stop = 1;
+		pthread_cond_broadcast(&compress_cond);
+		pthread_mutex_unlock(&compress_mutex);
+		for (i = 0; i < compress_nr_threads; i++)
+			pthread_join(compress_threads[i], NULL);
+		compress_nr_threads = 0;
+
+		for (i = 0; i < COMPRESS_AHEAD; i++)
+			FREE_AND_NULL(compress_slot[i].buf);
+		FREE_AND_NULL(compress_threads);
+		FREE_AND_NULL(compress_state);
+		FREE_AND_NULL(compress_pos);
+		pthread_cond_destroy(&compress_cond);
+		pthread_mutex_destroy(&compress_mutex);
+	}
+
+	cleanup_threaded_search();
+}
+
+/* The writer has moved on to position "pos" in the write order. */
+static void compress_writer_at(uint32_t pos)
+{
+	if (!compress_nr_threads)
+		return;
+	pthread_mutex_lock(&compress_mutex);
+	compress_writer = pos;
+	pthread_cond_broadcast(&compress_cond);
+	pthread_mutex_unlock(&compress_mutex);
+}
+
+/*
+ * The writer is about to write "entry": make sure no worker touches it
+ * from now on, waiting for the one compressing it if need be.
+ */
+static void claim_compressed(struct object_entry *entry)
+{
+	uint32_t ix = entry - to_pack.objects;
+
+	if (!compress_nr_threads)
+		return;
+	pthread_mutex_lock(&compress_mutex);
+	while (compress_state[ix] == COMPRESS_WORKING)
+		pthread_cond_wait(&compress_cond, &compress_mutex);
+	if (compress_state[ix] == COMPRESS_PENDING)
+		compress_state[ix] = COMPRESS_CLAIMED;
+	pthread_mutex_unlock(&compress_mutex);
+}
+
+/*
+ * Return the data a worker compressed for a claimed entry, if any and if
+ * it matches what the writer is going to write, and release its slot.
+ */
+static void *take_compressed(struct object_entry *entry, int usable_delta,
+			     enum object_type *type, unsigned long *size,
+			     unsigned long *datalen)
+{
+	uint32_t ix = entry - to_pack.objects;
+	struct compressed_object *c;
+	void *buf;
+
+	if (!compress_nr_threads || compress_state[ix] != COMPRESS_DONE)
+		return NULL;
+	compress_state[ix] = COMPRESS_CLAIMED;
+	c = &compress_slot[compress_pos[ix] % COMPRESS_AHEAD];
+	buf = c->buf;
+	c->buf = NULL;
+	if (c->usable_delta != usable_delta) {
+		free(buf);
+		return NULL;
+	}
+	*type = c->type;
+	*size = c->size;
+	*datalen = c->datalen;
+	return buf;
+}
+
+#else
+
+#define start_compress_threads(write_order)	(void)0
+#define finish_compress_threads()		(void)0
+#define compress_writer_at(pos)			(void)0
+#define claim_compressed(entry)			(void)0
+#define take_compressed(entry, usable_delta, type, size, datalen) NULL
+
+#endif
+
 static unsigned long write_large_blob_data(struct git_istream *st, struct sha1file *f,
 					   const struct object_id *oid)
 {
@@ -163,7 +514,9 @@ static unsigned long write_large_blob_data(struct git_istream *st, struct sha1fi
 	for (;;) {
 		ssize_t readlen;
 		int zret = Z_OK;
+		read_lock();
 		readlen = read_istream(st, ibuf, sizeof(ibuf));
+		read_unlock();
 		if (readlen == -1)
 			die(_("unable to read %s"), oid_to_hex(oid));
 
@@ -249,19 +602,31 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	enum object_type type;
 	void *buf;
 	struct git_istream *st = NULL;
-
-	if (!usable_delta) {
-		if (entry->type == OBJ_BLOB &&
-		    entry->size > big_file_threshold &&
+	int compressed = 0;
+
+	buf = take_compressed(entry, usable_delta, &type, &size, &datalen);
+	if (buf) {
+		compressed = 1;
+		if (usable_delta)
+			type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		else {
+			FREE_AND_NULL(entry->delta_data);
+			entry->z_delta_size = 0;
+		}
+	} else if (!usable_delta) {
+		read_lock();
+		if (oe_type(entry) == OBJ_BLOB &&
+		    SIZE(entry) > big_file_threshold &&
 		    (st = open_istream(entry->idx.oid.hash, &type, &size, NULL)) != NULL)
 			buf = NULL;
-		else {
+		else
 			buf = read_sha1_file(entry->idx.oid.hash, &type,
 					     &size);
-			if (!buf)
-				die(_("unable to read %s"),
-				    oid_to_hex(&entry->idx.oid));
-		}
+		read_unlock();
+		if (!st && !buf)
+			die(_("unable to read %s"),
+			    oid_to_hex(&entry->idx.oid));
 		/*
 		 * make sure no cached delta data remains from a
 		 * previous attempt before a pack split occurred.
@@ -269,20 +634,22 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		FREE_AND_NULL(entry->delta_data);
 		entry->z_delta_size = 0;
 	} else if (entry->delta_data) {
-		size = entry->delta_size;
+		size = DELTA_SIZE(entry);
 		buf = entry->delta_data;
 		entry->delta_data = NULL;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
 		buf = get_delta(entry);
-		size = entry->delta_size;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		size = DELTA_SIZE(entry);
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
 	if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
+	else if (compressed)
+		; /* deflated ahead of time by threaded_compress() */
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
 	else
@@ -301,7 +668,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		 * encoding of the relative offset for the delta
 		 * base from this object's position in the pack.
 		 */
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
@@ -327,7 +694,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.oid.hash, 20);
+		sha1write(f, DELTA(entry)->idx.oid.hash, 20);
 		hdrlen += 20;
 	} else {
 		if (limit && hdrlen + datalen + 20 >= limit) {
@@ -353,27 +720,30 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 				unsigned long limit, int usable_delta)
 {
-	struct packed_git *p = entry->in_pack;
+	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
-	enum object_type type = entry->type;
+	enum object_type type = oe_type(entry);
 	off_t datalen;
 	unsigned char header[MAX_PACK_OBJECT_HEADER],
 		      dheader[MAX_PACK_OBJECT_HEADER];
 	unsigned hdrlen;
 
-	if (entry->delta)
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+	if (DELTA(entry))
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	hdrlen = encode_in_pack_object_header(header, sizeof(header),
-					      type, entry->size);
+					      type, SIZE(entry));
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("no object starts at offset %"PRIuMAX" in %s"),
+		    (uintmax_t)offset, p->pack_name);
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error("bad packed object CRC for %s",
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -384,7 +754,7 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 	datalen -= entry->in_pack_header_size;
 
 	if (!pack_to_stdout && p->index_version == 1 &&
-	    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
+	    check_pack_inflate(p, &w_curs, offset, datalen, SIZE(entry))) {
 		error("corrupt packed object for %s",
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
@@ -392,7 +762,7 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 	}
 
 	if (type == OBJ_OFS_DELTA) {
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
@@ -411,7 +781,7 @@ static off_t write_reuse_object(struct sha1file *f, struct object_entry *entry,
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.oid.hash, 20);
+		sha1write(f, DELTA(entry)->idx.oid.hash, 20);
 		hdrlen += 20;
 		reused_delta++;
 	} else {
@@ -451,41 +821,29 @@ static off_t write_object(struct sha1file *f,
 	else
 		limit = pack_size_limit - write_offset;
 
-	if (!entry->delta)
+	if (!DELTA(entry))
 		usable_delta = 0;	/* no delta */
 	else if (!pack_size_limit)
 	       usable_delta = 1;	/* unlimited packfile */
-	else if (entry->delta->idx.offset == (off_t)-1)
+	else if (DELTA(entry)->idx.offset == (off_t)-1)
 		usable_delta = 0;	/* base was written to another pack */
-	else if (entry->delta->idx.offset)
+	else if (DELTA(entry)->idx.offset)
 		usable_delta = 1;	/* base already exists in this pack */
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
-
+	to_reuse = want_reuse(entry, usable_delta);
 	if (!to_reuse)
 		len = write_no_reuse_object(f, entry, limit, usable_delta);
-	else
+	else {
+		read_lock();
 		len = write_reuse_object(f, entry, limit, usable_delta);
+		read_unlock();
+	}
 	if (!len)
 		return 0;
 
+	entry->as_delta = usable_delta;
 	if (usable_delta)
 		written_delta++;
 	written++;
@@ -523,13 +881,15 @@ static enum write_one_status write_one(struct sha1file *f,
 		return WRITE_ONE_SKIP;
 	}
 
+	claim_compressed(e);
+
 	/* if we are deltified, write out base object first. */
-	if (e->delta) {
+	if (DELTA(e)) {
 		e->idx.offset = 1; /* now recurse */
-		switch (write_one(f, e->delta, offset)) {
+		switch (write_one(f, DELTA(e), offset)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
-			e->delta = NULL;
+			SET_DELTA(e, NULL);
 			break;
 		default:
 			break;
@@ -591,34 +951,34 @@ static void add_descendants_to_write_order(struct object_entry **wo,
 			/* add this node... */
 			add_to_write_order(wo, endp, e);
 			/* all its siblings... */
-			for (s = e->delta_sibling; s; s = s->delta_sibling) {
+			for (s = DELTA_SIBLING(e); s; s = DELTA_SIBLING(s)) {
 				add_to_write_order(wo, endp, s);
 			}
 		}
 		/* drop down a level to add left subtree nodes if possible */
-		if (e->delta_child) {
+		if (DELTA_CHILD(e)) {
 			add_to_order = 1;
-			e = e->delta_child;
+			e = DELTA_CHILD(e);
 		} else {
 			add_to_order = 0;
 			/* our sibling might have some children, it is next */
-			if (e->delta_sibling) {
-				e = e->delta_sibling;
+			if (DELTA_SIBLING(e)) {
+				e = DELTA_SIBLING(e);
 				continue;
 			}
 			/* go back to our parent node */
-			e = e->delta;
-			while (e && !e->delta_sibling) {
+			e = DELTA(e);
+			while (e && !DELTA_SIBLING(e)) {
 				/* we're on the right side of a subtree, keep
 				 * going up until we can go right again */
-				e = e->delta;
+				e = DELTA(e);
 			}
 			if (!e) {
 				/* done- we hit our original root node */
 				return;
 			}
 			/* pass it off to sibling at this level */
-			e = e->delta_sibling;
+			e = DELTA_SIBLING(e);
 		}
 	};
 }
@@ -629,7 +989,7 @@ static void add_family_to_write_order(struct object_entry **wo,
 {
 	struct object_entry *root;
 
-	for (root = e; root->delta; root = root->delta)
+	for (root = e; DELTA(root); root = DELTA(root))
 		; /* nothing */
 	add_descendants_to_write_order(wo, endp, root);
 }
@@ -644,8 +1004,8 @@ static struct object_entry **compute_write_order(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		objects[i].tagged = 0;
 		objects[i].filled = 0;
-		objects[i].delta_child = NULL;
-		objects[i].delta_sibling = NULL;
+		SET_DELTA_CHILD(&objects[i], NULL);
+		SET_DELTA_SIBLING(&objects[i], NULL);
 	}
 
 	/*
@@ -655,11 +1015,11 @@ static struct object_entry **compute_write_order(void)
 	 */
 	for (i = to_pack.nr_objects; i > 0;) {
 		struct object_entry *e = &objects[--i];
-		if (!e->delta)
+		if (!DELTA(e))
 			continue;
 		/* Mark me as the first child */
-		e->delta_sibling = e->delta->delta_child;
-		e->delta->delta_child = e;
+		SET_DELTA_SIBLING(e, DELTA_CHILD(DELTA(e)));
+		SET_DELTA_CHILD(DELTA(e), e);
 	}
 
 	/*
@@ -691,8 +1051,8 @@ static struct object_entry **compute_write_order(void)
 	 * And then all remaining commits and tags.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_COMMIT &&
-		    objects[i].type != OBJ_TAG)
+		if (oe_type(&objects[i]) != OBJ_COMMIT &&
+		    oe_type(&objects[i]) != OBJ_TAG)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -701,7 +1061,7 @@ static struct object_entry **compute_write_order(void)
 	 * And then all the trees.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_TREE)
+		if (oe_type(&objects[i]) != OBJ_TREE)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -720,57 +1080,194 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct sha1file *f)
+/*
+ * Objects reused verbatim from reuse_packfile are copied in runs. Each
+ * run shifts the objects it contains by a constant amount relative to
+ * their position in the original pack; an OFS_DELTA whose base was
+ * shifted by a different amount needs its offset rewritten.
+ */
+struct reused_chunk {
+	/* The offset of the first object of this chunk in the original packfile. */
+	off_t original;
+	/* The offset of the first object of this chunk in the generated packfile minus "original". */
+	off_t difference;
+};
+
+static struct reused_chunk *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
 {
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+	if (reused_chunks_nr && reused_chunks[reused_chunks_nr-1].difference == offset)
+		return;
 
-	if (!is_pack_valid(reuse_packfile))
-		die("packfile is invalid: %s", reuse_packfile->pack_name);
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1,
+		   reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = offset;
+	reused_chunks_nr++;
+}
 
-	fd = git_open(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno("unable to open packfile for reuse: %s",
-			  reuse_packfile->pack_name);
+/*
+ * Binary search to find the chunk that "where" is in. Note
+ * that we're not looking for an exact match, just the first
+ * chunk that contains it (which implicitly ends at the start
+ * of the next chunk.
+ */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+	while (lo < hi) {
+		int mi = lo + ((hi - lo) / 2);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno("unable to seek in reused packfile");
+	/*
+	 * The first chunk starts at zero, so we can't have gone below
+	 * there.
+	 */
+	assert(lo);
+	return reused_chunks[lo-1].difference;
+}
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - 20;
+static void write_reused_pack_one(uint32_t pos, struct sha1file *out,
+				  struct pack_window **w_curs)
+{
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	offset = pack_pos_to_offset(reuse_packfile, pos);
+	next = pack_pos_to_offset(reuse_packfile, pos + 1);
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+	record_reused_object(offset, offset - (out->total + out->offset));
 
-		if (read_pack <= 0)
-			die_errno("unable to read from reused packfile");
+	cur = offset;
+	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	assert(type >= 0);
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		off_t fixup;
+
+		base_offset = get_delta_base(reuse_packfile, w_curs, &cur, type, offset);
+		assert(base_offset != 0);
+
+		/* See if we need to rewrite the offset... */
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
+		if (fixup) {
+			unsigned char header[MAX_PACK_OBJECT_HEADER];
+			unsigned char ofs_header[10];
+			unsigned i, len, ofs_len;
+			off_t ofs = offset - base_offset - fixup;
+
+			len = encode_in_pack_object_header(header, sizeof(header),
+							   OBJ_OFS_DELTA, size);
+
+			i = sizeof(ofs_header) - 1;
+			ofs_header[i] = ofs & 127;
+			while (ofs >>= 7)
+				ofs_header[--i] = 128 | (--ofs & 127);
+
+			ofs_len = sizeof(ofs_header) - i;
+
+			sha1write(out, header, len);
+			sha1write(out, ofs_header + sizeof(ofs_header) - ofs_len, ofs_len);
+			copy_pack_data(out, reuse_packfile, w_curs, cur, next - cur);
+			return;
+		}
 
-		sha1write(f, buffer, read_pack);
-		to_write -= read_pack;
+		/* ...otherwise we have no fixup, and can write it verbatim */
+	}
+
+	copy_pack_data(out, reuse_packfile, w_curs, offset, next - offset);
+}
+
+static size_t write_reused_pack_verbatim(struct sha1file *out,
+					 struct pack_window **w_curs)
+{
+	size_t pos = 0;
+
+	while (pos < reuse_packfile_bitmap->word_alloc &&
+			reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+		pos++;
+
+	if (pos) {
+		off_t to_write;
+
+		written = (pos * BITS_IN_EWORD);
+		to_write = pack_pos_to_offset(reuse_packfile, written)
+			- sizeof(struct pack_header);
+
+		/* We're recording one chunk, not one object. */
+		record_reused_object(sizeof(struct pack_header), 0);
+		copy_pack_data(out, reuse_packfile, w_curs,
+			sizeof(struct pack_header), to_write);
 
-		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
-		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
 		display_progress(progress_state, written);
 	}
+	return pos;
+}
 
-	close(fd);
-	written = reuse_packfile_objects;
-	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+static void write_reused_pack(struct sha1file *f)
+{
+	size_t i = 0;
+	uint32_t offset;
+	struct pack_window *w_curs = NULL;
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile is invalid: %s", reuse_packfile->pack_name);
+
+	i = write_reused_pack_verbatim(f, &w_curs);
+
+	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
+		eword_t word = reuse_packfile_bitmap->words[i];
+		size_t pos = (i * BITS_IN_EWORD);
+
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			write_reused_pack_one(pos + offset, f, &w_curs);
+			display_progress(progress_state, ++written);
+		}
+	}
+
+	unuse_pack(&w_curs);
+}
+
+/*
+ * Tell write_idx_file() the type and size of an object we wrote, for
+ * version 3 of the index.
+ */
+static void idx_object_info(const struct pack_idx_entry *idx,
+			    enum object_type *type, unsigned long *size,
+			    int *is_delta, void *data)
+{
+	struct object_entry *entry = (struct object_entry *)idx;
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	*is_delta = entry->as_delta;
+	*type = oe_type(entry);
+	if (*type != OBJ_OFS_DELTA && *type != OBJ_REF_DELTA) {
+		*size = SIZE(entry);
+		return;
+	}
+
+	/* a reused delta; we never needed to know what it expands to */
+	oi.typep = type;
+	oi.sizep = size;
+	if (sha1_object_info_extended(entry->idx.oid.hash, &oi, 0) < 0)
+		die(_("unable to get type and size of %s"),
+		    oid_to_hex(&entry->idx.oid));
 }
 
 static const char no_split_warning[] = N_(
@@ -803,20 +1300,21 @@ static void write_pack_file(void)
 		offset = write_pack_header(f, nr_remaining);
 
 		if (reuse_packfile) {
-			off_t packfile_size;
 			assert(pack_to_stdout);
-
-			packfile_size = write_reused_pack(f);
-			offset += packfile_size;
+			write_reused_pack(f);
+			offset = f->total + f->offset;
 		}
 
 		nr_written = 0;
+		start_compress_threads(write_order);
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			compress_writer_at(i);
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
 		}
+		finish_compress_threads();
 
 		/*
 		 * Did we write the wrong # entries in the header?
@@ -864,7 +1362,8 @@ static void write_pack_file(void)
 
 			if (write_bitmap_index) {
 				bitmap_writer_set_checksum(oid.hash);
-				bitmap_writer_build_type_index(written_list, nr_written);
+				bitmap_writer_build_type_index(
+					&to_pack, written_list, nr_written);
 			}
 
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
@@ -1052,14 +1551,13 @@ static void create_object_entry(const struct object_id *oid,
 
 	entry = packlist_alloc(&to_pack, oid->hash, index_pos);
 	entry->hash = hash;
-	if (type)
-		entry->type = type;
+	oe_set_type(entry, type);
 	if (exclude)
 		entry->preferred_base = 1;
 	else
 		nr_result++;
 	if (found_pack) {
-		entry->in_pack = found_pack;
+		SET_IN_PACK(entry, found_pack);
 		entry->in_pack_offset = found_offset;
 	}
 
@@ -1382,10 +1880,19 @@ static void cleanup_preferred_base(void)
 	done_pbase_paths_num = done_pbase_paths_alloc = 0;
 }
 
+/*
+ * check_object() may run in several threads at once (see
+ * ll_check_objects()). Everything touching shared state -- the pack
+ * windows, the reverse indexes, the object database and the delta_child
+ * lists -- happens under read_lock(); parsing the object headers in a
+ * window we hold a reference to does not need it.
+ */
 static void check_object(struct object_entry *entry)
 {
-	if (entry->in_pack) {
-		struct packed_git *p = entry->in_pack;
+	unsigned long canonical_size;
+
+	if (IN_PACK(entry)) {
+		struct packed_git *p = IN_PACK(entry);
 		struct pack_window *w_curs = NULL;
 		const unsigned char *base_ref = NULL;
 		struct object_entry *base_entry;
@@ -1393,19 +1900,27 @@ static void check_object(struct object_entry *entry)
 		unsigned long avail;
 		off_t ofs;
 		unsigned char *buf, c;
+		enum object_type type;
+		unsigned long in_pack_size;
 
+		read_lock();
 		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		read_unlock();
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
 		 * since non-delta representations could still be reused.
 		 */
 		used = unpack_object_header_buffer(buf, avail,
-						   &entry->in_pack_type,
-						   &entry->size);
+						   &type,
+						   &in_pack_size);
 		if (used == 0)
 			goto give_up;
 
+		if (type < 0)
+			die("BUG: invalid type %d", type);
+		entry->in_pack_type = type;
+
 		/*
 		 * Determine if this is a delta and if so whether we can
 		 * reuse it or not.  Otherwise let's find out as cheaply as
@@ -1414,21 +1929,29 @@ static void check_object(struct object_entry *entry)
 		switch (entry->in_pack_type) {
 		default:
 			/* Not a delta hence we've already got all we need. */
-			entry->type = entry->in_pack_type;
+			oe_set_type(entry, entry->in_pack_type);
+			SET_SIZE(entry, in_pack_size);
 			entry->in_pack_header_size = used;
-			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
+			if (oe_type(entry) < OBJ_COMMIT || oe_type(entry) > OBJ_BLOB)
 				goto give_up;
+			read_lock();
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		case OBJ_REF_DELTA:
-			if (reuse_delta && !entry->preferred_base)
+			if (reuse_delta && !entry->preferred_base) {
+				read_lock();
 				base_ref = use_pack(p, &w_curs,
 						entry->in_pack_offset + used, NULL);
+				read_unlock();
+			}
 			entry->in_pack_header_size = used + 20;
 			break;
 		case OBJ_OFS_DELTA:
+			read_lock();
 			buf = use_pack(p, &w_curs,
 				       entry->in_pack_offset + used, NULL);
+			read_unlock();
 			used_0 = 0;
 			c = buf[used_0++];
 			ofs = c & 127;
@@ -1449,17 +1972,24 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				int ret;
+
+				read_lock();
+				ret = offset_to_pack_pos(p, ofs, &pos);
+				read_unlock();
+				if (ret < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref &&
+		    (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(&entry->idx.oid, &base_entry->idx.oid)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1470,26 +2000,36 @@ static void check_object(struct object_entry *entry)
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
 			 */
-			entry->type = entry->in_pack_type;
-			entry->delta = base_entry;
-			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			oe_set_type(entry, entry->in_pack_type);
+			SET_SIZE(entry, in_pack_size); /* delta size */
+			SET_DELTA(entry, base_entry);
+			SET_DELTA_SIZE(entry, in_pack_size);
+			read_lock();
+			SET_DELTA_SIBLING(entry, DELTA_CHILD(base_entry));
+			SET_DELTA_CHILD(base_entry, entry);
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		}
 
-		if (entry->type) {
+		if (oe_type(entry)) {
 			/*
 			 * This must be a delta and we already know what the
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
-			entry->size = get_size_from_delta(p, &w_curs,
+			unsigned long size;
+
+			read_lock();
+			size = get_size_from_delta(p, &w_curs,
 					entry->in_pack_offset + entry->in_pack_header_size);
-			if (entry->size == 0)
+			read_unlock();
+			if (size == 0)
 				goto give_up;
+			SET_SIZE(entry, size);
+			read_lock();
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		}
 
@@ -1499,10 +2039,16 @@ static void check_object(struct object_entry *entry)
 		 * at this point...
 		 */
 		give_up:
+		read_lock();
 		unuse_pack(&w_curs);
+		read_unlock();
 	}
 
-	entry->type = sha1_object_info(entry->idx.oid.hash, &entry->size);
+	read_lock();
+	oe_set_type(entry, sha1_object_info(entry->idx.oid.hash, &canonical_size));
+	read_unlock();
+	if (oe_type(entry) > 0)
+		SET_SIZE(entry, canonical_size);
 	/*
 	 * The error condition is checked in prepare_pack().  This is
 	 * to permit a missing preferred base object to be ignored
@@ -1517,12 +2063,12 @@ static int pack_offset_sort(const void *_a, const void *_b)
 	const struct object_entry *b = *(struct object_entry **)_b;
 
 	/* avoid filesystem trashing with loose objects */
-	if (!a->in_pack && !b->in_pack)
+	if (!IN_PACK(a) && !IN_PACK(b))
 		return oidcmp(&a->idx.oid, &b->idx.oid);
 
-	if (a->in_pack < b->in_pack)
+	if (IN_PACK(a) < IN_PACK(b))
 		return -1;
-	if (a->in_pack > b->in_pack)
+	if (IN_PACK(a) > IN_PACK(b))
 		return 1;
 	return a->in_pack_offset < b->in_pack_offset ? -1 :
 			(a->in_pack_offset > b->in_pack_offset);
@@ -1543,30 +2089,36 @@ static int pack_offset_sort(const void *_a, const void *_b)
  */
 static void drop_reused_delta(struct object_entry *entry)
 {
-	struct object_entry **p = &entry->delta->delta_child;
+	uint32_t *idx = &DELTA(entry)->delta_child_idx;
 	struct object_info oi = OBJECT_INFO_INIT;
+	enum object_type type;
+	unsigned long size;
+
+	while (*idx) {
+		struct object_entry *oe = &to_pack.objects[*idx - 1];
 
-	while (*p) {
-		if (*p == entry)
-			*p = (*p)->delta_sibling;
+		if (oe == entry)
+			*idx = oe->delta_sibling_idx;
 		else
-			p = &(*p)->delta_sibling;
+			idx = &oe->delta_sibling_idx;
 	}
-	entry->delta = NULL;
+	SET_DELTA(entry, NULL);
 	entry->depth = 0;
 
-	oi.sizep = &entry->size;
-	oi.typep = &entry->type;
-	if (packed_object_info(entry->in_pack, entry->in_pack_offset, &oi) < 0) {
+	oi.sizep = &size;
+	oi.typep = &type;
+	if (packed_object_info(IN_PACK(entry), entry->in_pack_offset, &oi) < 0) {
 		/*
 		 * We failed to get the info from this pack for some reason;
 		 * fall back to sha1_object_info, which may find another copy.
-		 * And if that fails, the error will be recorded in entry->type
-		 * and dealt with in prepare_pack().
+		 * And if that fails, the error will be recorded in the type
+		 * of the entry and dealt with in prepare_pack().
 		 */
-		entry->type = sha1_object_info(entry->idx.oid.hash,
-					       &entry->size);
+		type = sha1_object_info(entry->idx.oid.hash, &size);
 	}
+	oe_set_type(entry, type);
+	if (type > 0)
+		SET_SIZE(entry, size);
 }
 
 /*
@@ -1580,8 +2132,8 @@ static void drop_reused_delta(struct object_entry *entry)
 static void break_delta_chains(struct object_entry *entry)
 {
 	/*
-	 * The actual depth of each object we will write is stored as an int,
-	 * as it cannot exceed our int "depth" limit. But before we break
+	 * The actual depth of each object we will write is stored in
+	 * OE_DEPTH_BITS bits, as it cannot exceed our "depth" limit. But before we break
 	 * changes based no that limit, we may potentially go as deep as the
 	 * number of objects, which is elsewhere bounded to a uint32_t.
 	 */
@@ -1590,7 +2142,7 @@ static void break_delta_chains(struct object_entry *entry)
 
 	for (cur = entry, total_depth = 0;
 	     cur;
-	     cur = cur->delta, total_depth++) {
+	     cur = DELTA(cur), total_depth++) {
 		if (cur->dfs_state == DFS_DONE) {
 			/*
 			 * We've already seen this object and know it isn't
@@ -1615,7 +2167,7 @@ static void break_delta_chains(struct object_entry *entry)
 		 * it's not a delta, we're done traversing, but we'll mark it
 		 * done to save time on future traversals.
 		 */
-		if (!cur->delta) {
+		if (!DELTA(cur)) {
 			cur->dfs_state = DFS_DONE;
 			break;
 		}
@@ -1638,7 +2190,7 @@ static void break_delta_chains(struct object_entry *entry)
 		 * We keep all commits in the chain that we examined.
 		 */
 		cur->dfs_state = DFS_ACTIVE;
-		if (cur->delta->dfs_state == DFS_ACTIVE) {
+		if (DELTA(cur)->dfs_state == DFS_ACTIVE) {
 			drop_reused_delta(cur);
 			cur->dfs_state = DFS_DONE;
 			break;
@@ -1653,7 +2205,7 @@ static void break_delta_chains(struct object_entry *entry)
 	 * an extra "next" pointer to keep going after we reset cur->delta.
 	 */
 	for (cur = entry; cur; cur = next) {
-		next = cur->delta;
+		next = DELTA(cur);
 
 		/*
 		 * We should have a chain of zero or more ACTIVE states down to
@@ -1680,44 +2232,17 @@ static void break_delta_chains(struct object_entry *entry)
 		 * decrement total_depth as we go, and we need to write to the
 		 * entry what its final depth will be after all of the
 		 * snipping. Since we're snipping into chains of length (depth
-		 * + 1) entries, the final depth of an entry will be its
-		 * original depth modulo (depth + 1). Any time we encounter an
-		 * entry whose final depth is supposed to be zero, we snip it
-		 * from its delta base, thereby making it so.
-		 */
-		cur->depth = (total_depth--) % (depth + 1);
-		if (!cur->depth)
-			drop_reused_delta(cur);
-
-		cur->dfs_state = DFS_DONE;
-	}
-}
-
-static void get_object_details(void)
-{
-	uint32_t i;
-	struct object_entry **sorted_by_offset;
-
-	sorted_by_offset = xcalloc(to_pack.nr_objects, sizeof(struct object_entry *));
-	for (i = 0; i < to_pack.nr_objects; i++)
-		sorted_by_offset[i] = to_pack.objects + i;
-	QSORT(sorted_by_offset, to_pack.nr_objects, pack_offset_sort);
+		 * + 1) entries, the final depth of an entry will be its
+		 * original depth modulo (depth + 1). Any time we encounter an
+		 * entry whose final depth is supposed to be zero, we snip it
+		 * from its delta base, thereby making it so.
+		 */
+		cur->depth = (total_depth--) % (depth + 1);
+		if (!cur->depth)
+			drop_reused_delta(cur);
 
-	for (i = 0; i < to_pack.nr_objects; i++) {
-		struct object_entry *entry = sorted_by_offset[i];
-		check_object(entry);
-		if (big_file_threshold < entry->size)
-			entry->no_try_delta = 1;
+		cur->dfs_state = DFS_DONE;
 	}
-
-	/*
-	 * This must happen in a second pass, since we rely on the delta
-	 * information for the whole list being completed.
-	 */
-	for (i = 0; i < to_pack.nr_objects; i++)
-		break_delta_chains(&to_pack.objects[i]);
-
-	free(sorted_by_offset);
 }
 
 /*
@@ -1734,9 +2259,9 @@ static int type_size_sort(const void *_a, const void *_b)
 	const struct object_entry *a = *(struct object_entry **)_a;
 	const struct object_entry *b = *(struct object_entry **)_b;
 
-	if (a->type > b->type)
+	if (oe_type(a) > oe_type(b))
 		return -1;
-	if (a->type < b->type)
+	if (oe_type(a) < oe_type(b))
 		return 1;
 	if (a->hash > b->hash)
 		return -1;
@@ -1746,9 +2271,14 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
-	if (a->size > b->size)
+	if (use_delta_islands) {
+		int island_cmp = island_delta_cmp(&a->idx.oid, &b->idx.oid);
+		if (island_cmp)
+			return island_cmp;
+	}
+	if (SIZE(a) > SIZE(b))
 		return -1;
-	if (a->size < b->size)
+	if (SIZE(a) < SIZE(b))
 		return 1;
 	return a < b ? -1 : (a > b);  /* newest first */
 }
@@ -1776,31 +2306,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifndef NO_PTHREADS
-
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1812,7 +2317,15 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	void *delta_buf;
 
 	/* Don't bother doing diffs between different types */
-	if (trg_entry->type != src_entry->type)
+	if (oe_type(trg_entry) != oe_type(src_entry))
+		return -1;
+
+	/*
+	 * Don't base a delta on an object missing from some island of
+	 * the target: fetches of that island could not reuse it.
+	 */
+	if (use_delta_islands &&
+	    !in_same_island(&trg_entry->idx.oid, &src_entry->idx.oid))
 		return -1;
 
 	/*
@@ -1823,8 +2336,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	 * it, we will still save the transfer cost, as we already know
 	 * the other side has it and we won't send src_entry at all.
 	 */
-	if (reuse_delta && trg_entry->in_pack &&
-	    trg_entry->in_pack == src_entry->in_pack &&
+	if (reuse_delta && IN_PACK(trg_entry) &&
+	    IN_PACK(trg_entry) == IN_PACK(src_entry) &&
 	    !src_entry->preferred_base &&
 	    trg_entry->in_pack_type != OBJ_REF_DELTA &&
 	    trg_entry->in_pack_type != OBJ_OFS_DELTA)
@@ -1835,19 +2348,19 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		return 0;
 
 	/* Now some size filtering heuristics. */
-	trg_size = trg_entry->size;
-	if (!trg_entry->delta) {
+	trg_size = SIZE(trg_entry);
+	if (!DELTA(trg_entry)) {
 		max_size = trg_size/2 - 20;
 		ref_depth = 1;
 	} else {
-		max_size = trg_entry->delta_size;
+		max_size = DELTA_SIZE(trg_entry);
 		ref_depth = trg->depth;
 	}
 	max_size = (uint64_t)max_size * (max_depth - src->depth) /
 						(max_depth - ref_depth + 1);
 	if (max_size == 0)
 		return 0;
-	src_size = src_entry->size;
+	src_size = SIZE(src_entry);
 	sizediff = src_size < trg_size ? trg_size - src_size : 0;
 	if (sizediff >= max_size)
 		return 0;
@@ -1912,9 +2425,9 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (!delta_buf)
 		return 0;
 
-	if (trg_entry->delta) {
+	if (DELTA(trg_entry)) {
 		/* Prefer only shallower same-sized deltas. */
-		if (delta_size == trg_entry->delta_size &&
+		if (delta_size == DELTA_SIZE(trg_entry) &&
 		    src->depth + 1 >= trg->depth) {
 			free(delta_buf);
 			return 0;
@@ -1929,7 +2442,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	free(trg_entry->delta_data);
 	cache_lock();
 	if (trg_entry->delta_data) {
-		delta_cache_size -= trg_entry->delta_size;
+		delta_cache_size -= DELTA_SIZE(trg_entry);
 		trg_entry->delta_data = NULL;
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
@@ -1941,8 +2454,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		free(delta_buf);
 	}
 
-	trg_entry->delta = src_entry;
-	trg_entry->delta_size = delta_size;
+	SET_DELTA(trg_entry, src_entry);
+	SET_DELTA_SIZE(trg_entry, delta_size);
 	trg->depth = src->depth + 1;
 
 	return 1;
@@ -1950,13 +2463,13 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 static unsigned int check_delta_limit(struct object_entry *me, unsigned int n)
 {
-	struct object_entry *child = me->delta_child;
+	struct object_entry *child = DELTA_CHILD(me);
 	unsigned int m = n;
 	while (child) {
 		unsigned int c = check_delta_limit(child, n + 1);
 		if (m < c)
 			m = c;
-		child = child->delta_sibling;
+		child = DELTA_SIBLING(child);
 	}
 	return m;
 }
@@ -1967,7 +2480,7 @@ static unsigned long free_unpacked(struct unpacked *n)
 	free_delta_index(n->index);
 	n->index = NULL;
 	if (n->data) {
-		freed_mem += n->entry->size;
+		freed_mem += SIZE(n->entry);
 		FREE_AND_NULL(n->data);
 	}
 	n->entry = NULL;
@@ -2025,7 +2538,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * otherwise they would become too deep.
 		 */
 		max_depth = depth;
-		if (entry->delta_child) {
+		if (DELTA_CHILD(entry)) {
 			max_depth -= check_delta_limit(entry, 0);
 			if (max_depth <= 0)
 				goto next;
@@ -2063,11 +2576,19 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * between writes at that moment.
 		 */
 		if (entry->delta_data && !pack_to_stdout) {
-			entry->z_delta_size = do_compress(&entry->delta_data,
-							  entry->delta_size);
+			unsigned long size;
+
+			size = do_compress(&entry->delta_data, DELTA_SIZE(entry));
 			cache_lock();
-			delta_cache_size -= entry->delta_size;
-			delta_cache_size += entry->z_delta_size;
+			delta_cache_size -= DELTA_SIZE(entry);
+			if (size < (1UL << OE_Z_DELTA_BITS)) {
+				entry->z_delta_size = size;
+				delta_cache_size += entry->z_delta_size;
+			} else {
+				/* too big to be remembered; recompute it when writing */
+				FREE_AND_NULL(entry->delta_data);
+				entry->z_delta_size = 0;
+			}
 			cache_unlock();
 		}
 
@@ -2075,7 +2596,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * depth, leaving it in the window is pointless.  we
 		 * should evict it first.
 		 */
-		if (entry->delta && max_depth <= n->depth)
+		if (DELTA(entry) && max_depth <= n->depth)
 			continue;
 
 		/*
@@ -2083,7 +2604,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * currently deltified object, to keep it longer.  It will
 		 * be the first base object to be attempted next.
 		 */
-		if (entry->delta) {
+		if (DELTA(entry)) {
 			struct unpacked swap = array[best_base];
 			int dist = (window + idx - best_base) % window;
 			int dst = best_base;
@@ -2110,16 +2631,19 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 	free(array);
 }
 
-#ifndef NO_PTHREADS
-
-static void try_to_free_from_threads(size_t size)
+static void check_objects(struct object_entry **list, unsigned list_size)
 {
-	read_lock();
-	release_pack_memory(size);
-	read_unlock();
+	unsigned i;
+
+	for (i = 0; i < list_size; i++) {
+		struct object_entry *entry = list[i];
+		check_object(entry);
+		if (big_file_threshold < SIZE(entry))
+			entry->no_try_delta = 1;
+	}
 }
 
-static try_to_free_t old_try_to_free_routine;
+#ifndef NO_PTHREADS
 
 /*
  * The main thread waits on the condition that (at least) one of the workers
@@ -2144,29 +2668,6 @@ struct thread_params {
 	unsigned *processed;
 };
 
-static pthread_cond_t progress_cond;
-
-/*
- * Mutex and conditional variable can't be statically-initialized on Windows.
- */
-static void init_threaded_search(void)
-{
-	init_recursive_mutex(&read_mutex);
-	pthread_mutex_init(&cache_mutex, NULL);
-	pthread_mutex_init(&progress_mutex, NULL);
-	pthread_cond_init(&progress_cond, NULL);
-	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
-}
-
-static void cleanup_threaded_search(void)
-{
-	set_try_to_free_routine(old_try_to_free_routine);
-	pthread_cond_destroy(&progress_cond);
-	pthread_mutex_destroy(&read_mutex);
-	pthread_mutex_destroy(&cache_mutex);
-	pthread_mutex_destroy(&progress_mutex);
-}
-
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
@@ -2333,8 +2834,72 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	free(p);
 }
 
+/*
+ * Below this many objects per thread, starting threads for
+ * check_objects() costs more than it saves.
+ */
+#define CHECK_OBJECTS_PER_THREAD 1024
+
+struct check_object_params {
+	pthread_t thread;
+	struct object_entry **list;
+	unsigned list_size;
+};
+
+static void *threaded_check_objects(void *arg)
+{
+	struct check_object_params *me = arg;
+
+	check_objects(me->list, me->list_size);
+	return NULL;
+}
+
+/*
+ * Run check_objects() on "list", which is sorted by pack offset, in up
+ * to delta_search_threads threads. Each thread gets a contiguous slice
+ * so that it walks its part of the packs in order.
+ */
+static void ll_check_objects(struct object_entry **list, unsigned list_size)
+{
+	struct check_object_params *p;
+	int i, ret, nr_threads = delta_search_threads;
+
+	if (nr_threads > list_size / CHECK_OBJECTS_PER_THREAD)
+		nr_threads = list_size / CHECK_OBJECTS_PER_THREAD;
+
+	init_threaded_search();
+
+	if (nr_threads <= 1) {
+		check_objects(list, list_size);
+		cleanup_threaded_search();
+		return;
+	}
+
+	p = xcalloc(nr_threads, sizeof(*p));
+	for (i = 0; i < nr_threads; i++) {
+		unsigned sub_size = list_size / (nr_threads - i);
+
+		p[i].list = list;
+		p[i].list_size = sub_size;
+		list += sub_size;
+		list_size -= sub_size;
+
+		ret = pthread_create(&p[i].thread, NULL,
+				     threaded_check_objects, &p[i]);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(p[i].thread, NULL);
+
+	cleanup_threaded_search();
+	free(p);
+}
+
 #else
 #define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
+#define ll_check_objects(l, s)	check_objects(l, s)
 #endif
 
 static void add_tag_chain(const struct object_id *oid)
@@ -2377,6 +2942,28 @@ static int add_ref_tag(const char *path, const struct object_id *oid, int flag,
 	return 0;
 }
 
+static void get_object_details(void)
+{
+	uint32_t i;
+	struct object_entry **sorted_by_offset;
+
+	sorted_by_offset = xcalloc(to_pack.nr_objects, sizeof(struct object_entry *));
+	for (i = 0; i < to_pack.nr_objects; i++)
+		sorted_by_offset[i] = to_pack.objects + i;
+	QSORT(sorted_by_offset, to_pack.nr_objects, pack_offset_sort);
+
+	ll_check_objects(sorted_by_offset, to_pack.nr_objects);
+
+	/*
+	 * This must happen in a second pass, since we rely on the delta
+	 * information for the whole list being completed.
+	 */
+	for (i = 0; i < to_pack.nr_objects; i++)
+		break_delta_chains(&to_pack.objects[i]);
+
+	free(sorted_by_offset);
+}
+
 static void prepare_pack(int window, int depth)
 {
 	struct object_entry **delta_list;
@@ -2404,13 +2991,13 @@ static void prepare_pack(int window, int depth)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = to_pack.objects + i;
 
-		if (entry->delta)
+		if (DELTA(entry))
 			/* This happens if we decided to reuse existing
 			 * delta from a pack.  "reuse_delta &&" is implied.
 			 */
 			continue;
 
-		if (entry->size < 50)
+		if (SIZE(entry) < 50)
 			continue;
 
 		if (entry->no_try_delta)
@@ -2418,11 +3005,11 @@ static void prepare_pack(int window, int depth)
 
 		if (!entry->preferred_base) {
 			nr_deltas++;
-			if (entry->type < 0)
+			if (oe_type(entry) < 0)
 				die("unable to get type of object %s",
 				    oid_to_hex(&entry->idx.oid));
 		} else {
-			if (entry->type < 0) {
+			if (oe_type(entry) < 0) {
 				/*
 				 * This object is not found, but we
 				 * don't have to include it anyway.
@@ -2475,6 +3062,14 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			write_bitmap_options |= BITMAP_OPT_HASH_CACHE;
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
+		return 0;
+	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+		return 0;
 	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
@@ -2495,11 +3090,18 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
-		if (pack_idx_opts.version > 2)
+		if (pack_idx_opts.version > 3)
 			die("bad pack.indexversion=%"PRIu32,
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2535,6 +3137,161 @@ static void read_object_list_from_stdin(void)
 	}
 }
 
+static struct packed_git *find_stdin_pack(const char *name)
+{
+	struct packed_git *p;
+
+	for (p = packed_git; p; p = p->next) {
+		const char *base = strrchr(p->pack_name, '/');
+
+		base = base ? base + 1 : p->pack_name;
+		if (!strcmp(base, name))
+			return p;
+	}
+	return NULL;
+}
+
+static int in_excluded_pack(const struct object_id *oid,
+			    struct string_list *exclude)
+{
+	struct string_list_item *item;
+
+	for_each_string_list_item(item, exclude) {
+		struct packed_git *p = item->util;
+		if (find_pack_entry_one(oid->hash, p))
+			return 1;
+	}
+	return 0;
+}
+
+#define STDIN_PACKS_NAMED (1u<<21)
+
+/*
+ * Give the entries of "tree" that we are packing the name hash a
+ * rev-list walk would have given them, so that the delta search pairs
+ * up blobs by path. Only trees we are packing are descended into, so
+ * this walks the new trees, not the whole history.
+ */
+static void name_tree_entries(struct tree *tree, struct strbuf *path)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	size_t baselen = path->len;
+
+	if (tree->object.flags & STDIN_PACKS_NAMED)
+		return;
+	tree->object.flags |= STDIN_PACKS_NAMED;
+	if (parse_tree_gently(tree, 1))
+		return;
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		struct object_entry *oe;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		oe = packlist_find(&to_pack, entry.oid->hash, NULL);
+		if (!oe)
+			continue;
+
+		strbuf_setlen(path, baselen);
+		strbuf_add(path, entry.path, tree_entry_len(&entry));
+		if (!oe->hash) {
+			oe->hash = pack_name_hash(path->buf);
+			if (no_try_delta(path->buf))
+				oe->no_try_delta = 1;
+		}
+		if (S_ISDIR(entry.mode)) {
+			strbuf_addch(path, '/');
+			name_tree_entries(lookup_tree(entry.oid), path);
+		}
+	}
+	strbuf_setlen(path, baselen);
+	free_tree_buffer(tree);
+}
+
+static void name_stdin_packs_objects(struct oid_array *commits)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *commit = lookup_commit(&commits->oid[i]);
+
+		if (!commit || parse_commit(commit))
+			continue;
+		if (!packlist_find(&to_pack, commit->tree->object.oid.hash,
+				   NULL))
+			continue;
+		name_tree_entries(commit->tree, &path);
+	}
+	strbuf_release(&path);
+}
+
+/*
+ * Read the basenames of packs from stdin, one per line. Pack the
+ * objects of every listed pack, except for those that also appear in
+ * one of the packs listed with a leading '^'. Only the indexes of the
+ * named packs are looked at, so the work is proportional to the size
+ * of the included packs, not to that of the whole repository.
+ *
+ * The commits we add are collected in "commits", to name the objects
+ * later with name_stdin_packs_objects().
+ */
+static void read_packs_list_from_stdin(struct oid_array *commits)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct string_list include = STRING_LIST_INIT_NODUP;
+	struct string_list exclude = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item;
+
+	while (strbuf_getline(&buf, stdin) != EOF) {
+		const char *name = buf.buf;
+		struct string_list *list = &include;
+		struct packed_git *p;
+
+		if (!buf.len)
+			continue;
+		if (*name == '^') {
+			name++;
+			list = &exclude;
+		}
+		p = find_stdin_pack(name);
+		if (!p)
+			die(_("could not find pack '%s'"), name);
+		if (open_pack_index(p))
+			die(_("cannot open pack index for '%s'"), name);
+		string_list_append(list, p->pack_name)->util = p;
+	}
+	strbuf_release(&buf);
+
+	for_each_string_list_item(item, &include) {
+		struct packed_git *p = item->util;
+		struct object_id oid;
+		uint32_t i;
+
+		for (i = 0; i < p->num_objects; i++) {
+			struct object_info oi = OBJECT_INFO_INIT;
+			enum object_type type;
+
+			nth_packed_object_oid(&oid, p, i);
+			if (in_excluded_pack(&oid, &exclude))
+				continue;
+			oi.typep = &type;
+			if (packed_object_info(p, nth_packed_object_offset(p, i),
+					       &oi) < 0)
+				die(_("could not get type of object %s in pack %s"),
+				    oid_to_hex(&oid), p->pack_name);
+			if (add_object_entry(&oid, type, "", 0) &&
+			    type == OBJ_COMMIT)
+				oid_array_append(commits, &oid);
+		}
+	}
+
+	string_list_clear(&include, 0);
+	string_list_clear(&exclude, 0);
+}
+
 #define OBJECT_ADDED (1u<<20)
 
 static void show_commit(struct commit *commit, void *data)
@@ -2544,6 +3301,9 @@ static void show_commit(struct commit *commit, void *data)
 
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj, const char *name, void *data)
@@ -2551,6 +3311,21 @@ static void show_object(struct object *obj, const char *name, void *data)
 	add_preferred_base_object(name);
 	add_object_entry(&obj->oid, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
+
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		const char *p;
+		unsigned depth;
+		struct object_entry *ent;
+
+		/* the empty string is a root tree, which is depth 0 */
+		depth = *name ? 1 : 0;
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+
+		ent = packlist_find(&to_pack, obj->oid.hash, NULL);
+		if (ent && depth > oe_tree_depth(&to_pack, ent))
+			oe_set_tree_depth(&to_pack, ent, depth);
+	}
 }
 
 static void show_edge(struct commit *commit)
@@ -2659,6 +3434,36 @@ static void add_unreachable_loose_objects(void)
 				      NULL, NULL, NULL);
 }
 
+static int add_unpacked_loose_object(const struct object_id *oid,
+				     const char *path, void *data)
+{
+	enum object_type type;
+
+	if (has_sha1_pack(oid->hash))
+		return 0;
+	type = sha1_object_info(oid->hash, NULL);
+	if (type < 0) {
+		warning("loose object at %s could not be examined", path);
+		return 0;
+	}
+	if (add_object_entry(oid, type, "", 0) && type == OBJ_COMMIT)
+		oid_array_append(data, oid);
+	return 0;
+}
+
+/*
+ * With --stdin-packs, "--unpacked" adds every loose object that is
+ * not in a pack yet; the rev-list machinery is not involved. Loose
+ * commits are added to "commits", like read_packs_list_from_stdin()
+ * does.
+ */
+static void add_unpacked_loose_objects(struct oid_array *commits)
+{
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      add_unpacked_loose_object,
+				      NULL, NULL, commits);
+}
+
 static int has_sha1_pack_kept_or_nonlocal(const struct object_id *oid)
 {
 	static struct packed_git *last_found = (void *)1;
@@ -2750,7 +3555,7 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	    !reuse_partial_packfile_from_bitmap(
 			&reuse_packfile,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
@@ -2814,11 +3619,17 @@ static void get_object_list(int ac, const char **av)
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
+	if (use_delta_islands)
+		load_delta_islands(progress);
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
 		if (add_unseen_recent_objects_to_traversal(&revs,
@@ -2846,7 +3657,7 @@ static int option_parse_index_version(const struct option *opt,
 	char *c;
 	const char *val = arg;
 	pack_idx_opts.version = strtoul(val, &c, 10);
-	if (pack_idx_opts.version > 2)
+	if (pack_idx_opts.version > 3)
 		die(_("unsupported index version %s"), val);
 	if (*c == ',' && c[1])
 		pack_idx_opts.off32_limit = strtoul(c+1, &c, 0);
@@ -2873,12 +3684,14 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
 	int use_internal_rev_list = 0;
+	int stdin_packs = 0;
 	int thin = 0;
 	int shallow = 0;
 	int all_progress_implied = 0;
 	struct argv_array rp = ARGV_ARRAY_INIT;
 	int rev_list_unpacked = 0, rev_list_all = 0, rev_list_reflog = 0;
 	int rev_list_index = 0;
+	uint64_t start_ns = getnanotime();
 	struct option pack_objects_options[] = {
 		OPT_SET_INT('q', "quiet", &progress,
 			    N_("do not show progress meter"), 0),
@@ -2916,6 +3729,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("do not create an empty pack output")),
 		OPT_BOOL(0, "revs", &use_internal_rev_list,
 			 N_("read revision arguments from standard input")),
+		OPT_BOOL(0, "stdin-packs", &stdin_packs,
+			 N_("read packs from stdin")),
 		{ OPTION_SET_INT, 0, "unpacked", &rev_list_unpacked, NULL,
 		  N_("limit the objects to those that are not yet packed"),
 		  PARSE_OPT_NOARG | PARSE_OPT_NONEG, NULL, 1 },
@@ -2953,12 +3768,15 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_END(),
 	};
 
 	check_replace_refs = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	pack_idx_opts.object_info = idx_object_info;
 	git_config(git_pack_config, NULL);
 
 	progress = isatty(2);
@@ -2993,11 +3811,15 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--indexed-objects");
 	}
-	if (rev_list_unpacked) {
+	if (rev_list_unpacked && !stdin_packs) {
 		use_internal_rev_list = 1;
 		argv_array_push(&rp, "--unpacked");
 	}
 
+	/* islands propagate from children to parents */
+	if (use_delta_islands)
+		argv_array_push(&rp, "--topo-order");
+
 	if (!reuse_object)
 		reuse_delta = 0;
 	if (pack_compression_level == -1)
@@ -3005,6 +3827,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	else if (pack_compression_level < 0 || pack_compression_level > Z_BEST_COMPRESSION)
 		die("bad pack compression level %d", pack_compression_level);
 
+	if (depth >= (1 << OE_DEPTH_BITS)) {
+		warning(_("delta chain depth %d is too deep, forcing %d"),
+			depth, (1 << OE_DEPTH_BITS) - 1);
+		depth = (1 << OE_DEPTH_BITS) - 1;
+	}
+
 	if (!delta_search_threads)	/* --threads=0 means autodetect */
 		delta_search_threads = online_cpus();
 
@@ -3024,6 +3852,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!pack_to_stdout && thin)
 		die("--thin cannot be used to build an indexable pack.");
 
+	if (stdin_packs && use_internal_rev_list)
+		die(_("--stdin-packs is incompatible with --revs"));
+
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
@@ -3055,6 +3886,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		progress = 2;
 
 	prepare_packed_git();
+	prepare_packing_data(&to_pack);
 	if (ignore_packed_keep) {
 		struct packed_git *p;
 		for (p = packed_git; p; p = p->next)
@@ -3080,7 +3912,15 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Counting objects"), 0);
-	if (!use_internal_rev_list)
+	if (stdin_packs) {
+		struct oid_array commits = OID_ARRAY_INIT;
+
+		read_packs_list_from_stdin(&commits);
+		if (rev_list_unpacked)
+			add_unpacked_loose_objects(&commits);
+		name_stdin_packs_objects(&commits);
+		oid_array_clear(&commits);
+	} else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		get_object_list(rp.argc, rp.argv);
@@ -3096,6 +3936,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (nr_result)
 		prepare_pack(window, depth);
 	write_pack_file();
+	trace_performance_since(start_ns,
+				"pack-objects: %"PRIu32" objects of %"PRIuMAX
+				" bytes each, %"PRIuMAX" bytes in object entries",
+				to_pack.nr_objects,
+				(uintmax_t)sizeof(struct object_entry),
+				(uintmax_t)packing_data_footprint(&to_pack));
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
 			" reused %"PRIu32" (delta %"PRIu32")\n",
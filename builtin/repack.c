@@ -8,10 +8,13 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
+#include "packfile.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps;
+static int use_delta_islands;
 static char *packdir, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -111,7 +114,7 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap"};
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".rev"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -127,6 +130,94 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	strbuf_release(&buf);
 }
 
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	const struct packed_git *a = *(const struct packed_git **)va;
+	const struct packed_git *b = *(const struct packed_git **)vb;
+
+	if (a->num_objects < b->num_objects)
+		return -1;
+	if (a->num_objects > b->num_objects)
+		return 1;
+	return 0;
+}
+
+static void init_pack_geometry(struct pack_geometry *geometry)
+{
+	struct packed_git *p;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local || p->pack_keep)
+			continue;
+		if (open_pack_index(p))
+			die(_("cannot open pack index for '%s'"), p->pack_name);
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the packs that have to be rolled up so that, once they are
+ * combined into a single new pack, every pack holds at least "factor"
+ * times as many objects as the next smaller one. On return, the packs
+ * below geometry->split are the ones to combine.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, split;
+	uint64_t total = 0;
+
+	if (!geometry->pack_nr) {
+		geometry->split = 0;
+		return;
+	}
+
+	/*
+	 * Walk down from the largest pack until two neighbours break
+	 * the progression; the larger one of that pair cannot stay.
+	 */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		struct packed_git *ours = geometry->pack[i];
+		struct packed_git *prev = geometry->pack[i - 1];
+
+		if (ours->num_objects < (uint64_t)factor * prev->num_objects)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	/*
+	 * The new pack will be about as large as the packs it replaces,
+	 * so it may in turn break the progression with the packs above
+	 * it. Keep rolling those up until it does not.
+	 */
+	for (i = 0; i < split; i++)
+		total += geometry->pack[i]->num_objects;
+	for (i = split; i < geometry->pack_nr; i++) {
+		struct packed_git *ours = geometry->pack[i];
+
+		if (ours->num_objects >= (uint64_t)factor * total)
+			break;
+		total += ours->num_objects;
+		split++;
+	}
+	geometry->split = split;
+}
+
+static const char *pack_basename(struct packed_git *p)
+{
+	const char *base = strrchr(p->pack_name, '/');
+	return base ? base + 1 : p->pack_name;
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -139,6 +230,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		{".pack"},
 		{".idx"},
 		{".bitmap", 1},
+		{".rev", 1},
 	};
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	struct string_list_item *item;
@@ -146,7 +238,9 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	struct string_list rollback = STRING_LIST_INIT_NODUP;
 	struct string_list existing_packs = STRING_LIST_INIT_DUP;
 	struct strbuf line = STRBUF_INIT;
+	struct pack_geometry geometry = { NULL };
 	int ext, ret, failed;
+	uint32_t i;
 	FILE *out;
 
 	/* variables to be filled by option parsing */
@@ -160,6 +254,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	const char *max_pack_size = NULL;
 	int no_reuse_delta = 0, no_reuse_object = 0;
 	int no_update_server_info = 0;
+	int write_midx = 0;
+	int geometric_factor = 0;
 	int quiet = 0;
 	int local = 0;
 
@@ -182,6 +278,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_BOOL('k', "keep-unreachable", &keep_unreachable,
@@ -198,6 +296,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("maximum size of each packfile")),
 		OPT_BOOL(0, "pack-kept-objects", &pack_kept_objects,
 				N_("repack objects in packs marked with .keep")),
+		OPT_BOOL(0, "write-midx", &write_midx,
+				N_("write a multi-pack-index of the resulting packs")),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("find a geometric progression with factor <n>")),
 		OPT_END()
 	};
 
@@ -213,6 +315,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (geometric_factor) {
+		if (pack_everything)
+			die(_("--geometric is incompatible with -A, -a"));
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+	}
+
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
@@ -229,9 +338,11 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	if (!pack_kept_objects)
 		argv_array_push(&cmd.args, "--honor-pack-keep");
 	argv_array_push(&cmd.args, "--non-empty");
-	argv_array_push(&cmd.args, "--all");
-	argv_array_push(&cmd.args, "--reflog");
-	argv_array_push(&cmd.args, "--indexed-objects");
+	if (!geometric_factor) {
+		argv_array_push(&cmd.args, "--all");
+		argv_array_push(&cmd.args, "--reflog");
+		argv_array_push(&cmd.args, "--indexed-objects");
+	}
 	if (window)
 		argv_array_pushf(&cmd.args, "--window=%s", window);
 	if (window_memory)
@@ -248,6 +359,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--no-reuse-object");
 	if (write_bitmaps)
 		argv_array_push(&cmd.args, "--write-bitmap-index");
+	if (use_delta_islands)
+		argv_array_push(&cmd.args, "--delta-islands");
 
 	if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs);
@@ -268,6 +381,20 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
 			}
 		}
+	} else if (geometric_factor) {
+		init_pack_geometry(&geometry);
+		split_pack_geometry(&geometry, geometric_factor);
+
+		for (i = 0; i < geometry.split; i++) {
+			const char *base = pack_basename(geometry.pack[i]);
+			size_t len;
+
+			if (strip_suffix(base, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(base, len));
+		}
+		argv_array_push(&cmd.args, "--stdin-packs");
+		argv_array_push(&cmd.args, "--unpacked");
 	} else {
 		argv_array_push(&cmd.args, "--unpacked");
 		argv_array_push(&cmd.args, "--incremental");
@@ -284,12 +411,33 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 
 	cmd.git_cmd = 1;
 	cmd.out = -1;
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
 
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+		struct packed_git *p;
+
+		/*
+		 * Roll up the packs below the split; objects that are
+		 * also in one of the packs we keep are left out.
+		 */
+		for (i = 0; i < geometry.split; i++)
+			fprintf(in, "%s\n", pack_basename(geometry.pack[i]));
+		for (; i < geometry.pack_nr; i++)
+			fprintf(in, "^%s\n", pack_basename(geometry.pack[i]));
+		for (p = packed_git; p; p = p->next)
+			if (p->pack_local && p->pack_keep)
+				fprintf(in, "^%s\n", pack_basename(p));
+		fclose(in);
+	}
+
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline_lf(&line, out) != EOF) {
 		if (line.len != 40)
@@ -424,15 +572,29 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		}
 		if (!quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
+		/* the geometry was computed before the new pack existed */
+		if (geometric_factor)
+			reprepare_packed_git();
 		prune_packed_objects(opts);
 	}
 
+	/*
+	 * An existing multi-pack-index would name the packs we just
+	 * deleted; either replace it or drop it.
+	 */
+	if (write_midx) {
+		if (write_midx_file(get_object_directory()))
+			die(_("failed to write multi-pack-index"));
+	} else if (delete_redundant)
+		clear_midx_file(get_object_directory());
+
 	if (!no_update_server_info)
 		update_server_info(0);
 	remove_temporary_files();
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free(geometry.pack);
 	strbuf_release(&line);
 
 	return 0;
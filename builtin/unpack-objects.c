@@ -310,10 +310,105 @@ static void added_object(unsigned nr, enum object_type type,
 	}
 }
 
+struct input_zstream_data {
+	git_zstream *zstream;
+	unsigned char buf[8192];
+	int status;
+};
+
+static const void *feed_input_zstream(struct input_stream *in_stream,
+				      unsigned long *readlen)
+{
+	struct input_zstream_data *data = in_stream->data;
+	git_zstream *zstream = data->zstream;
+	void *in = fill(1);
+
+	zstream->next_out = data->buf;
+	zstream->avail_out = sizeof(data->buf);
+	zstream->next_in = in;
+	zstream->avail_in = len;
+
+	data->status = git_inflate(zstream, 0);
+	in_stream->is_finished = data->status != Z_OK;
+	use(len - zstream->avail_in);
+	*readlen = sizeof(data->buf) - zstream->avail_out;
+
+	return data->buf;
+}
+
+static int has_pending_deltas(unsigned nr)
+{
+	struct delta_info *info;
+
+	for (info = delta_list; info; info = info->next)
+		if (!oidcmp(&info->base_oid, &obj_list[nr].oid) ||
+		    info->base_offset == obj_list[nr].offset)
+			return 1;
+	return 0;
+}
+
+/*
+ * Write a large blob straight from the pack to a loose object, so
+ * that we never hold all of it in core.
+ */
+static void stream_blob(unsigned long size, unsigned nr)
+{
+	git_zstream zstream;
+	struct input_zstream_data data;
+	struct input_stream in_stream;
+	struct obj_info *info = &obj_list[nr];
+
+	memset(&zstream, 0, sizeof(zstream));
+	memset(&data, 0, sizeof(data));
+	data.zstream = &zstream;
+	git_inflate_init(&zstream);
+
+	in_stream.read = feed_input_zstream;
+	in_stream.data = &data;
+	in_stream.is_finished = 0;
+
+	if (stream_loose_object(&in_stream, size, &info->oid))
+		die("failed to write object in stream");
+	if (data.status != Z_STREAM_END)
+		die("inflate returned %d", data.status);
+	git_inflate_end(&zstream);
+
+	if (strict) {
+		struct blob *blob = lookup_blob(&info->oid);
+		if (blob)
+			blob->object.flags |= FLAG_WRITTEN;
+		else
+			die("invalid blob object from stream");
+	}
+	info->obj = NULL;
+
+	/*
+	 * Deltas that came before their base need its contents after
+	 * all; this is rare enough to just read it back.
+	 */
+	if (has_pending_deltas(nr)) {
+		enum object_type type;
+		unsigned long buf_size;
+		void *buf = read_sha1_file(info->oid.hash, &type, &buf_size);
+
+		if (!buf)
+			die("unable to read back %s", oid_to_hex(&info->oid));
+		added_object(nr, type, buf, buf_size);
+		free(buf);
+	}
+}
+
 static void unpack_non_delta_entry(enum object_type type, unsigned long size,
 				   unsigned nr)
 {
-	void *buf = get_data(size);
+	void *buf;
+
+	if (!dry_run && type == OBJ_BLOB && size > big_file_threshold) {
+		stream_blob(size, nr);
+		return;
+	}
+
+	buf = get_data(size);
 
 	if (!dry_run && buf)
 		write_object(nr, type, buf, size);
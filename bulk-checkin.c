@@ -7,6 +7,7 @@
 #include "pack.h"
 #include "strbuf.h"
 #include "packfile.h"
+#include "oidset.h"
 
 static struct bulk_checkin_state {
 	unsigned plugged:1;
@@ -19,12 +20,14 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	struct oidset written_oids;
 } state;
 
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
 	struct strbuf packname = STRBUF_INIT;
+	unsigned plugged = state->plugged;
 	int i;
 
 	if (!state->f)
@@ -53,28 +56,45 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 clear_exit:
 	free(state->written);
+	oidset_clear(&state->written_oids);
 	memset(state, 0, sizeof(*state));
+	/* a pack split by pack.packSizeLimit keeps us plugged */
+	state->plugged = plugged;
 
 	strbuf_release(&packname);
 	/* Make objects we just wrote available to ourselves */
 	reprepare_packed_git();
 }
 
-static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+static int in_bulk_pack(struct bulk_checkin_state *state,
+			const unsigned char *sha1)
 {
-	int i;
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	return oidset_contains(&state->written_oids, &oid);
+}
 
+static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+{
 	/* The object may already exist in the repository */
 	if (has_sha1_file(sha1))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (!hashcmp(state->written[i]->oid.hash, sha1))
-			return 1;
+	/* ... or we may have written it to the pack ourselves */
+	return in_bulk_pack(state, sha1);
+}
 
-	/* This is a new object we need to keep */
-	return 0;
+static void record_written(struct bulk_checkin_state *state,
+			   struct pack_idx_entry *idx,
+			   const unsigned char *sha1)
+{
+	hashcpy(idx->oid.hash, sha1);
+	oidset_insert(&state->written_oids, &idx->oid);
+	ALLOC_GROW(state->written,
+		   state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = idx;
 }
 
 /*
@@ -246,15 +266,61 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 		state->offset = checkpoint.offset;
 		free(idx);
 	} else {
-		hashcpy(idx->oid.hash, result_sha1);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		record_written(state, idx, result_sha1);
 	}
 	return 0;
 }
 
+/*
+ * Deflate an object we already have in core (and whose name the
+ * caller has already computed) into the pack in state.
+ */
+static void write_to_pack(struct bulk_checkin_state *state,
+			  const unsigned char *sha1,
+			  const void *buf, size_t size,
+			  enum object_type type)
+{
+	git_zstream s;
+	unsigned char hdr[32];
+	unsigned hdrlen;
+	unsigned char *out;
+	unsigned long maxsize, datalen;
+	struct pack_idx_entry *idx;
+
+	git_deflate_init(&s, pack_compression_level);
+	maxsize = git_deflate_bound(&s, size);
+	out = xmalloc(maxsize);
+	s.next_in = (void *)buf;
+	s.avail_in = size;
+	s.next_out = out;
+	s.avail_out = maxsize;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	datalen = s.total_out;
+
+	hdrlen = encode_in_pack_object_header(hdr, sizeof(hdr), type, size);
+
+	prepare_to_stream(state, HASH_WRITE_OBJECT);
+	if (state->nr_written &&
+	    pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + hdrlen + datalen) {
+		finish_bulk_checkin(state);
+		prepare_to_stream(state, HASH_WRITE_OBJECT);
+	}
+
+	idx = xcalloc(1, sizeof(*idx));
+	idx->offset = state->offset;
+	crc32_begin(state->f);
+	sha1write(state->f, hdr, hdrlen);
+	sha1write(state->f, out, datalen);
+	idx->crc32 = crc32_end(state->f);
+	state->offset += hdrlen + datalen;
+	free(out);
+
+	record_written(state, idx, sha1);
+}
+
 int index_bulk_checkin(unsigned char *sha1,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
@@ -266,6 +332,21 @@ int index_bulk_checkin(unsigned char *sha1,
 	return status;
 }
 
+int bulk_checkin_wants(enum object_type type)
+{
+	return state.plugged && bulk_checkin_all_blobs && type == OBJ_BLOB;
+}
+
+int write_bulk_checkin(const unsigned char *sha1,
+		       const void *buf, size_t size, enum object_type type)
+{
+	if (!in_bulk_pack(&state, sha1))
+		write_to_pack(&state, sha1, buf, size, type);
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+	return 0;
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
@@ -8,6 +8,21 @@ extern int index_bulk_checkin(unsigned char sha1[],
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/*
+ * Should a new object of this type go to the bulk-checkin pack rather
+ * than to a loose object? True for blobs while bulk checkin is plugged
+ * and "core.bulkCheckin" is set.
+ */
+extern int bulk_checkin_wants(enum object_type type);
+
+/*
+ * Append an object whose name the caller has already computed to the
+ * bulk-checkin pack.
+ */
+extern int write_bulk_checkin(const unsigned char sha1[],
+			      const void *buf, size_t size,
+			      enum object_type type);
+
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
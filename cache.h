@@ -55,6 +55,10 @@ void git_inflate_init(git_zstream *);
 void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
+#ifdef USE_LIBDEFLATE
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen);
+#endif
 
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
@@ -777,6 +781,7 @@ extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
 extern unsigned long big_file_threshold;
+extern int bulk_checkin_all_blobs;
 extern unsigned long pack_size_limit_cfg;
 
 /*
@@ -803,6 +808,8 @@ extern char *git_replace_ref_base;
 extern int fsync_object_files;
 extern int core_preload_index;
 extern int core_apply_sparse_checkout;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -1213,6 +1220,12 @@ static inline const unsigned char *lookup_replace_object(const unsigned char *sh
 	return do_lookup_replace_object(sha1);
 }
 
+/*
+ * Return 1 if object replacement is active and at least one replace
+ * ref exists, 0 otherwise.
+ */
+extern int replace_objects_exist(void);
+
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
@@ -1220,6 +1233,25 @@ extern int write_sha1_file(const void *buf, unsigned long len, const char *type,
 extern int hash_sha1_file_literally(const void *buf, unsigned long len, const char *type, struct object_id *oid, unsigned flags);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
 extern int force_object_loose(const unsigned char *sha1, time_t mtime);
+
+/*
+ * A source of object data for stream_loose_object(). "read" returns
+ * the next chunk and its length in "*len", and sets "is_finished"
+ * once it has returned the last one.
+ */
+struct input_stream {
+	const void *(*read)(struct input_stream *, unsigned long *len);
+	void *data;
+	int is_finished;
+};
+
+/*
+ * Write a blob of "len" bytes read from "in_stream" as a loose object,
+ * without holding it in core, and store its name in "oid". Nothing is
+ * written if the object already exists.
+ */
+extern int stream_loose_object(struct input_stream *in_stream, size_t len,
+			       struct object_id *oid);
 extern int git_open_cloexec(const char *name, int flags);
 #define git_open(name) git_open_cloexec(name, O_RDONLY)
 extern void *map_sha1_file(const unsigned char *sha1, unsigned long *size);
@@ -1557,14 +1589,15 @@ extern struct alternate_object_database {
 	size_t base_len;
 
 	/*
-	 * Used to store the results of readdir(3) calls when searching
-	 * for unique abbreviated hashes.  This cache is never
-	 * invalidated, thus it's racy and not necessarily accurate.
-	 * That's fine for its purpose; don't use it for tasks requiring
-	 * greater accuracy!
+	 * The results of readdir(3) on each of the objects/xx fan-out
+	 * directories, filled on demand by odb_loose_cache(). Objects
+	 * written by this process are added, and the cache is dropped by
+	 * reprepare_packed_git(), but objects written or removed by other
+	 * processes in the meantime are missed: only use it where that
+	 * is acceptable, e.g. for OBJECT_INFO_QUICK lookups.
 	 */
 	char loose_objects_subdir_seen[256];
-	struct oid_array loose_objects_cache;
+	struct oid_array loose_objects_cache[256];
 
 	char path[FLEX_ARRAY];
 } *alt_odb_list;
@@ -1600,6 +1633,23 @@ extern void add_to_alternates_memory(const char *dir);
  */
 extern struct strbuf *alt_scratch_buf(struct alternate_object_database *alt);
 
+/*
+ * Return a "struct alternate_object_database" standing for our own
+ * object directory, followed by the alternates in its "next" chain,
+ * to walk all object directories alike.
+ */
+extern struct alternate_object_database *local_and_alt_odbs(void);
+
+/*
+ * Return the cached list of loose objects of "odb" whose names start
+ * with the byte "subdir_nr", reading the directory if needed.
+ */
+extern struct oid_array *odb_loose_cache(struct alternate_object_database *odb,
+					 int subdir_nr);
+
+/* Forget the loose objects cached for every object directory. */
+extern void clear_loose_object_caches(void);
+
 struct pack_window {
 	struct pack_window *next;
 	unsigned char *base;
@@ -1624,9 +1674,14 @@ extern struct packed_git {
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
+	unsigned int index;	/* in pack-objects' packing_data */
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
+	const uint32_t *revindex_data;
+	const void *revindex_map;
+	size_t revindex_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 } *packed_git;
@@ -1712,6 +1767,13 @@ int for_each_loose_file_in_objdir_buf(struct strbuf *path,
  * LOCAL_ONLY flag is set).
  */
 #define FOR_EACH_OBJECT_LOCAL_ONLY 0x1
+
+/*
+ * Visit the objects of each pack in the order they are stored in the
+ * pack, rather than in the order of its index (only meaningful for
+ * for_each_packed_object()).
+ */
+#define FOR_EACH_OBJECT_PACK_ORDER 0x2
 extern int for_each_loose_object(each_loose_object_fn, void *, unsigned flags);
 
 struct object_info {
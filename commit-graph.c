@@ -0,0 +1,914 @@
+#include "cache.h"
+#include "config.h"
+#include "csum-file.h"
+#include "packfile.h"
+#include "commit.h"
+#include "object.h"
+#include "refs.h"
+#include "revision.h"
+#include "sha1-lookup.h"
+#include "commit-slab.h"
+#include "commit-graph.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+
+#define GRAPH_DATA_WIDTH 36
+
+#define GRAPH_VERSION_1 0x1
+#define GRAPH_VERSION GRAPH_VERSION_1
+
+#define GRAPH_OID_VERSION_SHA1 1
+#define GRAPH_OID_LEN_SHA1 GIT_SHA1_RAWSZ
+#define GRAPH_OID_VERSION GRAPH_OID_VERSION_SHA1
+#define GRAPH_OID_LEN GRAPH_OID_LEN_SHA1
+
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_PARENT_NONE 0x70000000
+
+#define GRAPH_LAST_EDGE 0x80000000
+
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_MIN_SIZE (5 * GRAPH_CHUNKLOOKUP_WIDTH + GRAPH_FANOUT_SIZE + \
+			GRAPH_OID_LEN + 8)
+
+char *get_commit_graph_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graph", obj_dir);
+}
+
+static struct commit_graph *alloc_commit_graph(void)
+{
+	struct commit_graph *g = xcalloc(1, sizeof(*g));
+	g->graph_fd = -1;
+
+	return g;
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	void *graph_map;
+	const unsigned char *data, *chunk_lookup;
+	size_t graph_size;
+	struct stat st;
+	uint32_t i;
+	struct commit_graph *graph;
+	int fd = git_open(graph_file);
+	uint32_t graph_signature;
+	unsigned char graph_version, hash_version;
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	graph_size = xsize_t(st.st_size);
+
+	if (graph_size < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("graph file %s is too small", graph_file);
+		return NULL;
+	}
+	graph_map = xmmap(NULL, graph_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	data = (const unsigned char *)graph_map;
+
+	graph = alloc_commit_graph();
+	graph->graph_fd = fd;
+	graph->data = graph_map;
+	graph->data_len = graph_size;
+
+	graph_signature = get_be32(data);
+	if (graph_signature != GRAPH_SIGNATURE) {
+		error("graph signature %X does not match signature %X",
+		      graph_signature, GRAPH_SIGNATURE);
+		goto cleanup_fail;
+	}
+
+	graph_version = *(unsigned char *)(data + 4);
+	if (graph_version != GRAPH_VERSION) {
+		error("graph version %X does not match version %X",
+		      graph_version, GRAPH_VERSION);
+		goto cleanup_fail;
+	}
+
+	hash_version = *(unsigned char *)(data + 5);
+	if (hash_version != GRAPH_OID_VERSION) {
+		error("hash version %X does not match version %X",
+		      hash_version, GRAPH_OID_VERSION);
+		goto cleanup_fail;
+	}
+
+	graph->hash_len = GRAPH_OID_LEN;
+	graph->num_chunks = *(unsigned char *)(data + 6);
+
+	if (8 + (graph->num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH > graph_size) {
+		error("graph file %s is too small for %d chunks",
+		      graph_file, graph->num_chunks);
+		goto cleanup_fail;
+	}
+
+	chunk_lookup = data + 8;
+	for (i = 0; i < graph->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup + 0);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		int chunk_repeated = 0;
+
+		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset > graph_size - GIT_MAX_RAWSZ) {
+			error("improper chunk offset %08x%08x",
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_fail;
+		}
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (graph->chunk_oid_fanout)
+				chunk_repeated = 1;
+			else
+				graph->chunk_oid_fanout = (const uint32_t *)(data + chunk_offset);
+			break;
+
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			if (graph->chunk_oid_lookup)
+				chunk_repeated = 1;
+			else
+				graph->chunk_oid_lookup = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_DATA:
+			if (graph->chunk_commit_data)
+				chunk_repeated = 1;
+			else
+				graph->chunk_commit_data = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_LARGEEDGES:
+			if (graph->chunk_large_edges)
+				chunk_repeated = 1;
+			else
+				graph->chunk_large_edges = data + chunk_offset;
+			break;
+		}
+
+		if (chunk_repeated) {
+			error("chunk id %08x appears multiple times", chunk_id);
+			goto cleanup_fail;
+		}
+	}
+
+	if (!graph->chunk_oid_fanout || !graph->chunk_oid_lookup ||
+	    !graph->chunk_commit_data) {
+		error("graph file %s is missing a required chunk", graph_file);
+		goto cleanup_fail;
+	}
+
+	graph->num_commits = ntohl(graph->chunk_oid_fanout[255]);
+	if (graph->chunk_oid_lookup + (size_t)graph->num_commits * graph->hash_len > data + graph_size ||
+	    graph->chunk_commit_data + (size_t)graph->num_commits * GRAPH_DATA_WIDTH > data + graph_size) {
+		error("graph file %s is truncated", graph_file);
+		goto cleanup_fail;
+	}
+
+	return graph;
+
+cleanup_fail:
+	free_commit_graph(graph);
+	return NULL;
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	if (g->data) {
+		munmap((void *)g->data, g->data_len);
+		g->data = NULL;
+	}
+	if (g->graph_fd >= 0)
+		close(g->graph_fd);
+	free(g);
+}
+
+/* global storage */
+static struct commit_graph *commit_graph;
+static int prepare_commit_graph_run_once;
+
+/*
+ * Generation numbers of the commits seen so far; 0 means that it has
+ * not been looked up or computed yet.
+ */
+define_commit_slab(generation_slab, uint32_t);
+static struct generation_slab generation_slab = COMMIT_SLAB_INIT(1, generation_slab);
+
+static void prepare_commit_graph_one(const char *obj_dir)
+{
+	char *graph_name;
+
+	if (commit_graph)
+		return;
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+}
+
+static void prepare_commit_graph(void)
+{
+	struct alternate_object_database *alt;
+
+	if (prepare_commit_graph_run_once)
+		return;
+	prepare_commit_graph_run_once = 1;
+
+	prepare_commit_graph_one(get_object_directory());
+	prepare_alt_odb();
+	for (alt = alt_odb_list; !commit_graph && alt; alt = alt->next)
+		prepare_commit_graph_one(alt->path);
+}
+
+void close_commit_graph(void)
+{
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+	prepare_commit_graph_run_once = 0;
+}
+
+static int bsearch_graph(struct commit_graph *g, const struct object_id *oid,
+			 uint32_t *pos)
+{
+	return bsearch_hash(oid->hash, g->chunk_oid_fanout,
+			    g->chunk_oid_lookup, g->hash_len, pos);
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint64_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+	struct object_id oid;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIuMAX, (uintmax_t)pos);
+
+	hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * pos);
+	c = lookup_commit(&oid);
+	if (!c)
+		die("could not find commit %s", oid_to_hex(&oid));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static int fill_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t pos)
+{
+	struct object_id oid;
+	uint32_t edge_value, generation;
+	const unsigned char *parent_data_ptr;
+	uint64_t date_low, date_high;
+	struct commit_list **pptr;
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+
+	item->object.parsed = 1;
+	item->graph_pos = pos;
+
+	hashcpy(oid.hash, commit_data);
+	item->tree = lookup_tree(&oid);
+
+	/*
+	 * Files written before generation numbers were computed have
+	 * zero there; treat those as unknown.
+	 */
+	generation = get_be32(commit_data + g->hash_len + 8) >> 2;
+	if (generation == GENERATION_NUMBER_ZERO)
+		generation = GENERATION_NUMBER_INFINITY;
+	*generation_slab_at(&generation_slab, item) = generation;
+
+	date_high = get_be32(commit_data + g->hash_len + 8) & 0x3;
+	date_low = get_be32(commit_data + g->hash_len + 12);
+	item->date = (timestamp_t)((date_high << 32) | date_low);
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + g->hash_len);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + g->hash_len + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		pptr = insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	if (!g->chunk_large_edges)
+		die("commit-graph has octopus edges but no large edge chunk");
+
+	parent_data_ptr = g->chunk_large_edges +
+			  4 * (uint64_t)(edge_value & GRAPH_EDGE_LAST_MASK);
+	do {
+		edge_value = get_be32(parent_data_ptr);
+		pptr = insert_parent_or_die(g,
+					    edge_value & GRAPH_EDGE_LAST_MASK,
+					    pptr);
+		parent_data_ptr += 4;
+	} while (!(edge_value & GRAPH_LAST_EDGE));
+
+	return 1;
+}
+
+/*
+ * Grafts (including shallow boundaries) and replace refs change what
+ * parse_commit() sees for a commit; the graph only knows about the
+ * objects as they are stored, so leave such commits to the regular
+ * parser.
+ */
+static int commit_graph_compatible(const struct commit *item)
+{
+	const struct object_id *oid = &item->object.oid;
+
+	if (lookup_replace_object(oid->hash) != oid->hash)
+		return 0;
+	if (lookup_commit_graft(oid))
+		return 0;
+	return 1;
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!core_commit_graph)
+		return 0;
+	if (item->object.parsed)
+		return 1;
+
+	prepare_commit_graph();
+	if (!commit_graph || !commit_graph_compatible(item))
+		return 0;
+
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH)
+		return fill_commit_in_graph(item, commit_graph, item->graph_pos);
+	if (bsearch_graph(commit_graph, &item->object.oid, &pos))
+		return fill_commit_in_graph(item, commit_graph, pos);
+
+	return 0;
+}
+
+static int graft_found(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * Generation numbers are only trustworthy when every commit is parsed
+ * the way the graph was written, i.e. without grafts or replacements.
+ */
+static int generation_numbers_enabled(void)
+{
+	static int enabled = -1;
+
+	if (!core_commit_graph)
+		return 0;
+	prepare_commit_graph();
+	if (!commit_graph)
+		return 0;
+
+	if (enabled < 0) {
+		prepare_commit_graft();
+		enabled = !for_each_commit_graft(graft_found, NULL) &&
+			  !replace_objects_exist();
+	}
+	return enabled;
+}
+
+static int generation_known(uint32_t generation, int recompute_infinite)
+{
+	if (generation == GENERATION_NUMBER_ZERO)
+		return 0;
+	return !recompute_infinite || generation != GENERATION_NUMBER_INFINITY;
+}
+
+/*
+ * Compute the generation of "c" without recursion, walking down until
+ * reaching commits whose generation is already known. A commit only
+ * gets a finite generation when all of its parents have one, so a
+ * finite number always implies finite numbers for all ancestors.
+ *
+ * With "recompute_infinite", unknown numbers read from an older graph
+ * are computed too; this is used when writing a new file.
+ */
+static uint32_t compute_generation(struct commit *c, int recompute_infinite)
+{
+	struct commit_list *stack = NULL;
+
+	commit_list_insert(c, &stack);
+	while (stack) {
+		struct commit *current = stack->item;
+		uint32_t *generation = generation_slab_at(&generation_slab, current);
+		struct commit_list *parent;
+		uint32_t max_generation = 0;
+		int all_parents_known = 1;
+
+		if (!generation_known(*generation, recompute_infinite)) {
+			if (parse_commit(current)) {
+				if (recompute_infinite)
+					die("unable to parse commit %s",
+					    oid_to_hex(&current->object.oid));
+				*generation = GENERATION_NUMBER_INFINITY;
+				pop_commit(&stack);
+				continue;
+			}
+			/* parsing from the graph may have filled it in */
+			generation = generation_slab_at(&generation_slab, current);
+		}
+		if (generation_known(*generation, recompute_infinite)) {
+			pop_commit(&stack);
+			continue;
+		}
+
+		for (parent = current->parents; parent; parent = parent->next) {
+			uint32_t parent_generation =
+				*generation_slab_at(&generation_slab, parent->item);
+
+			if (!generation_known(parent_generation, recompute_infinite)) {
+				all_parents_known = 0;
+				commit_list_insert(parent->item, &stack);
+			} else if (parent_generation > max_generation)
+				max_generation = parent_generation;
+		}
+
+		if (!all_parents_known)
+			continue;
+
+		pop_commit(&stack);
+		generation = generation_slab_at(&generation_slab, current);
+		if (max_generation == GENERATION_NUMBER_INFINITY)
+			*generation = GENERATION_NUMBER_INFINITY;
+		else if (max_generation >= GENERATION_NUMBER_MAX)
+			*generation = GENERATION_NUMBER_MAX;
+		else
+			*generation = max_generation + 1;
+	}
+
+	return *generation_slab_at(&generation_slab, c);
+}
+
+uint32_t commit_generation(struct commit *c)
+{
+	uint32_t generation;
+
+	if (!generation_numbers_enabled())
+		return GENERATION_NUMBER_INFINITY;
+
+	generation = *generation_slab_at(&generation_slab, c);
+	if (generation)
+		return generation;
+	return compute_generation(c, 0);
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct commit **commits,
+				     int nr_commits)
+{
+	int i, count = 0;
+	struct commit **list = commits;
+
+	/*
+	 * Write the first-level table (the list is sorted,
+	 * but we use a 256-entry lookup to be able to avoid
+	 * having to do eight extra binary search iterations).
+	 */
+	for (i = 0; i < 256; i++) {
+		while (count < nr_commits) {
+			if ((*list)->object.oid.hash[0] != i)
+				break;
+			count++;
+			list++;
+		}
+
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f, int hash_len,
+				   struct commit **commits, int nr_commits)
+{
+	struct commit **list = commits;
+	int count;
+	for (count = 0; count < nr_commits; count++, list++)
+		sha1write(f, (*list)->object.oid.hash, (int)hash_len);
+}
+
+static const unsigned char *commit_to_sha1(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.oid.hash;
+}
+
+static uint32_t commit_graph_pos(struct commit *parent, struct commit *child,
+				 struct commit **commits, int nr_commits)
+{
+	int pos = sha1_pos(parent->object.oid.hash, commits, nr_commits,
+			   commit_to_sha1);
+	if (pos < 0)
+		die("parent %s of commit %s is missing from the commit-graph",
+		    oid_to_hex(&parent->object.oid),
+		    oid_to_hex(&child->object.oid));
+	return pos;
+}
+
+static void write_graph_chunk_data(struct sha1file *f, int hash_len,
+				   struct commit **commits, int nr_commits)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+	uint32_t num_extra_edges = 0;
+
+	while (list < last) {
+		struct commit_list *parent;
+		uint32_t packedDate[2];
+
+		sha1write(f, (*list)->tree->object.oid.hash, hash_len);
+		parent = (*list)->parents;
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else
+			sha1write_be32(f, commit_graph_pos(parent->item, *list,
+							   commits, nr_commits));
+
+		if (parent)
+			parent = parent->next;
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else if (parent->next) {
+			sha1write_be32(f, GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges);
+			for (; parent; parent = parent->next)
+				num_extra_edges++;
+		} else
+			sha1write_be32(f, commit_graph_pos(parent->item, *list,
+							   commits, nr_commits));
+
+		if (sizeof((*list)->date) > 4)
+			packedDate[0] = htonl(((*list)->date >> 32) & 0x3);
+		else
+			packedDate[0] = 0;
+
+		packedDate[0] |= htonl(compute_generation(*list, 1) << 2);
+
+		packedDate[1] = htonl((*list)->date);
+		sha1write(f, packedDate, 8);
+
+		list++;
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct commit **commits,
+					  int nr_commits)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+	struct commit_list *parent;
+
+	while (list < last) {
+		int num_parents = 0;
+		for (parent = (*list)->parents; num_parents < 3 && parent;
+		     parent = parent->next)
+			num_parents++;
+
+		if (num_parents <= 2) {
+			list++;
+			continue;
+		}
+
+		/* Since num_parents > 2, this initializer is safe. */
+		for (parent = (*list)->parents->next; parent; parent = parent->next) {
+			uint32_t edge_value = commit_graph_pos(parent->item, *list,
+							       commits, nr_commits);
+			if (!parent->next)
+				edge_value |= GRAPH_LAST_EDGE;
+
+			sha1write_be32(f, edge_value);
+		}
+
+		list++;
+	}
+}
+
+static int commit_compare(const void *_a, const void *_b)
+{
+	const struct object_id *a = (const struct object_id *)_a;
+	const struct object_id *b = (const struct object_id *)_b;
+	return oidcmp(a, b);
+}
+
+struct packed_commit_list {
+	struct commit **list;
+	int nr;
+	int alloc;
+};
+
+struct packed_oid_list {
+	struct object_id *list;
+	int nr;
+	int alloc;
+};
+
+static void add_oid_to_list(struct packed_oid_list *list,
+			    const struct object_id *oid)
+{
+	ALLOC_GROW(list->list, list->nr + 1, list->alloc);
+	oidcpy(&list->list[list->nr], oid);
+	list->nr++;
+}
+
+static int add_packed_commits(const struct object_id *oid,
+			      struct packed_git *pack,
+			      uint32_t pos,
+			      void *data)
+{
+	struct packed_oid_list *list = (struct packed_oid_list *)data;
+	enum object_type type;
+	off_t offset = nth_packed_object_offset(pack, pos);
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	oi.typep = &type;
+	if (packed_object_info(pack, offset, &oi) < 0)
+		die("unable to get type of object %s", oid_to_hex(oid));
+
+	if (type != OBJ_COMMIT)
+		return 0;
+
+	add_oid_to_list(list, oid);
+	return 0;
+}
+
+static void add_missing_parents(struct packed_oid_list *oids, struct commit *commit)
+{
+	struct commit_list *parent;
+	for (parent = commit->parents; parent; parent = parent->next) {
+		if (!(parent->item->object.flags & UNINTERESTING)) {
+			add_oid_to_list(oids, &parent->item->object.oid);
+			parent->item->object.flags |= UNINTERESTING;
+		}
+	}
+}
+
+static void close_reachable(struct packed_oid_list *oids)
+{
+	int i;
+	struct commit *commit;
+
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(&oids->list[i]);
+		if (commit)
+			commit->object.flags |= UNINTERESTING;
+	}
+
+	/*
+	 * As this loop runs, oids->nr may grow, but not more
+	 * than the number of missing commits in the reachable
+	 * closure.
+	 */
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(&oids->list[i]);
+
+		if (commit && !parse_commit(commit))
+			add_missing_parents(oids, commit);
+	}
+
+	for (i = 0; i < oids->nr; i++) {
+		commit = lookup_commit(&oids->list[i]);
+
+		if (commit)
+			commit->object.flags &= ~UNINTERESTING;
+	}
+}
+
+static void write_graph_file(const char *obj_dir, struct packed_oid_list *oids)
+{
+	struct packed_commit_list commits = { NULL, 0, 0 };
+	struct strbuf tmp_file = STRBUF_INIT;
+	char *graph_name;
+	struct sha1file *f;
+	int i, fd, count_distinct = 0;
+	uint32_t chunk_ids[5];
+	uint64_t chunk_offsets[5];
+	int num_chunks;
+	int num_extra_edges;
+	struct commit_list *parent;
+
+	/*
+	 * Grafted and shallow commits would be recorded with their
+	 * rewritten parents, which is wrong once the grafts go away.
+	 */
+	prepare_commit_graft();
+	if (for_each_commit_graft(graft_found, NULL)) {
+		warning("not writing a commit-graph in a repository with grafts or shallow commits");
+		return;
+	}
+
+	close_reachable(oids);
+
+	QSORT(oids->list, oids->nr, commit_compare);
+
+	for (i = 0; i < oids->nr; i++) {
+		if (i && !oidcmp(&oids->list[i - 1], &oids->list[i]))
+			continue;
+		count_distinct++;
+	}
+
+	if (count_distinct >= GRAPH_PARENT_NONE)
+		die("the commit graph format cannot write %d commits",
+		    count_distinct);
+
+	ALLOC_ARRAY(commits.list, count_distinct);
+	commits.alloc = count_distinct;
+	num_extra_edges = 0;
+	for (i = 0; i < oids->nr; i++) {
+		struct commit *commit;
+		int num_parents = 0;
+
+		if (i && !oidcmp(&oids->list[i - 1], &oids->list[i]))
+			continue;
+
+		commit = lookup_commit(&oids->list[i]);
+		if (!commit || parse_commit(commit))
+			continue;
+
+		for (parent = commit->parents; parent; parent = parent->next)
+			num_parents++;
+		if (num_parents > 2)
+			num_extra_edges += num_parents - 1;
+
+		commits.list[commits.nr++] = commit;
+	}
+	num_chunks = num_extra_edges ? 4 : 3;
+
+	graph_name = get_commit_graph_filename(obj_dir);
+	strbuf_addf(&tmp_file, "%s/info/tmp_graph_XXXXXX", obj_dir);
+	if (safe_create_leading_directories(tmp_file.buf))
+		die_errno("unable to create leading directories of %s",
+			  tmp_file.buf);
+	fd = xmkstemp_mode(tmp_file.buf, 0444);
+	f = sha1fd(fd, tmp_file.buf);
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+
+	sha1write_u8(f, GRAPH_VERSION);
+	sha1write_u8(f, GRAPH_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* unused padding byte */
+
+	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	if (num_extra_edges)
+		chunk_ids[3] = GRAPH_CHUNKID_LARGEEDGES;
+	else
+		chunk_ids[3] = 0;
+	chunk_ids[4] = 0;
+
+	chunk_offsets[0] = 8 + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
+	chunk_offsets[2] = chunk_offsets[1] + GRAPH_OID_LEN * commits.nr;
+	chunk_offsets[3] = chunk_offsets[2] + (GRAPH_OID_LEN + 16) * commits.nr;
+	chunk_offsets[4] = chunk_offsets[3] + 4 * num_extra_edges;
+
+	for (i = 0; i <= num_chunks; i++) {
+		uint32_t chunk_write[3];
+
+		chunk_write[0] = htonl(chunk_ids[i]);
+		chunk_write[1] = htonl(chunk_offsets[i] >> 32);
+		chunk_write[2] = htonl(chunk_offsets[i] & 0xffffffff);
+		sha1write(f, chunk_write, 12);
+	}
+
+	write_graph_chunk_fanout(f, commits.list, commits.nr);
+	write_graph_chunk_oids(f, GRAPH_OID_LEN, commits.list, commits.nr);
+	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr);
+	write_graph_chunk_large_edges(f, commits.list, commits.nr);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno("unable to make temporary commit-graph file readable");
+
+	/* Make sure we do not keep the old file mapped while replacing it. */
+	close_commit_graph();
+	if (rename(tmp_file.buf, graph_name))
+		die_errno("unable to rename temporary commit-graph file to '%s'",
+			  graph_name);
+
+	free(graph_name);
+	strbuf_release(&tmp_file);
+	free(commits.list);
+}
+
+void write_commit_graph(const char *obj_dir,
+			const char **pack_indexes,
+			int nr_packs,
+			const char **commit_hex,
+			int nr_commits)
+{
+	struct packed_oid_list oids = { NULL, 0, 0 };
+	int save_check_replace_refs = check_replace_refs;
+
+	/* Record the parents as stored in the objects themselves. */
+	check_replace_refs = 0;
+
+	oids.alloc = approximate_object_count() / 4;
+	if (oids.alloc < 1024)
+		oids.alloc = 1024;
+	ALLOC_ARRAY(oids.list, oids.alloc);
+
+	if (pack_indexes) {
+		struct strbuf packname = STRBUF_INIT;
+		int dirlen, i;
+		strbuf_addf(&packname, "%s/pack/", obj_dir);
+		dirlen = packname.len;
+		for (i = 0; i < nr_packs; i++) {
+			struct packed_git *p;
+			uint32_t j;
+
+			strbuf_setlen(&packname, dirlen);
+			strbuf_addstr(&packname, pack_indexes[i]);
+			p = add_packed_git(packname.buf, packname.len, 1);
+			if (!p)
+				die("error adding pack %s", packname.buf);
+			if (open_pack_index(p))
+				die("error opening index for %s", packname.buf);
+			for (j = 0; j < p->num_objects; j++) {
+				struct object_id oid;
+				nth_packed_object_oid(&oid, p, j);
+				add_packed_commits(&oid, p, j, &oids);
+			}
+			close_pack(p);
+			free(p);
+		}
+		strbuf_release(&packname);
+	}
+
+	if (commit_hex) {
+		int i;
+		for (i = 0; i < nr_commits; i++) {
+			const char *end;
+			struct object_id oid;
+			struct commit *result;
+
+			if (!commit_hex[i] || parse_oid_hex(commit_hex[i], &oid, &end))
+				continue;
+
+			result = lookup_commit_reference_gently(&oid, 1);
+			if (result)
+				add_oid_to_list(&oids, &result->object.oid);
+		}
+	}
+
+	if (!pack_indexes && !commit_hex)
+		for_each_packed_object(add_packed_commits, &oids, 0);
+
+	write_graph_file(obj_dir, &oids);
+
+	free(oids.list);
+	check_replace_refs = save_check_replace_refs;
+}
+
+static int add_ref_to_list(const char *refname,
+			   const struct object_id *oid,
+			   int flags, void *cb_data)
+{
+	struct packed_oid_list *list = cb_data;
+	struct commit *commit = lookup_commit_reference_gently(oid, 1);
+
+	if (commit)
+		add_oid_to_list(list, &commit->object.oid);
+	return 0;
+}
+
+void write_commit_graph_reachable(const char *obj_dir)
+{
+	struct packed_oid_list oids = { NULL, 0, 0 };
+	int save_check_replace_refs = check_replace_refs;
+
+	check_replace_refs = 0;
+
+	for_each_ref(add_ref_to_list, &oids);
+	head_ref(add_ref_to_list, &oids);
+	write_graph_file(obj_dir, &oids);
+
+	free(oids.list);
+	check_replace_refs = save_check_replace_refs;
+}
@@ -0,0 +1,99 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include "git-compat-util.h"
+
+struct commit;
+
+/*
+ * The commit-graph file lives at "<obj_dir>/info/commit-graph" and
+ * stores, for every commit it covers, the root tree, the parents and
+ * the commit date in fixed-width columns. See
+ * Documentation/technical/commit-graph-format.txt for the layout.
+ */
+extern char *get_commit_graph_filename(const char *obj_dir);
+
+/*
+ * Given a commit struct, try to fill the commit struct info, including
+ * parents, root tree and commit date, from the commit-graph file.
+ *
+ * Returns 1 if and only if the commit was found in the commit-graph
+ * and the struct was filled in; otherwise the caller must parse the
+ * commit object itself.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Generation numbers: a commit without parents has generation 1, any
+ * other commit has one more than the largest generation among its
+ * parents. If A can reach B then gen(A) >= gen(B), so a walk looking
+ * for B can stop at commits whose generation is below gen(B).
+ *
+ * GENERATION_NUMBER_INFINITY means "unknown"; it is used for every
+ * commit when there is no usable commit-graph. A commit only gets a
+ * finite number when all of its ancestors have one, so a commit with a
+ * finite number can never reach one with an infinite number, and such
+ * comparisons stay correct. Numbers are capped at
+ * GENERATION_NUMBER_MAX, which keeps the ordering weak but correct.
+ */
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_ZERO 0
+
+/*
+ * Return the generation number of "c". Commits found in the
+ * commit-graph get theirs from the file; for others it is computed on
+ * demand by walking down to commits that are in the graph, and cached
+ * for the rest of the process.
+ */
+extern uint32_t commit_generation(struct commit *c);
+
+struct commit_graph {
+	int graph_fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_commits;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+};
+
+/*
+ * Open and validate the commit-graph file at "graph_file". Returns NULL
+ * (after printing an error for a corrupt file) if no usable graph is
+ * found there.
+ */
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+/*
+ * Drop the commit-graph of the current repository, if one was loaded,
+ * so that it is re-read on the next lookup.
+ */
+extern void close_commit_graph(void);
+
+/*
+ * Write a commit-graph file into "obj_dir" covering the commits found
+ * in the given pack indexes (or in every pack of "obj_dir" when
+ * "pack_indexes" is NULL) plus the commits named in "commit_hex", and
+ * everything reachable from them.
+ */
+extern void write_commit_graph(const char *obj_dir,
+			       const char **pack_indexes,
+			       int nr_packs,
+			       const char **commit_hex,
+			       int nr_commits);
+
+/*
+ * Write a commit-graph file into "obj_dir" covering every commit
+ * reachable from the refs of the current repository.
+ */
+extern void write_commit_graph_reachable(const char *obj_dir);
+
+#endif
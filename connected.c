@@ -1,9 +1,234 @@
 #include "cache.h"
+#include "config.h"
 #include "run-command.h"
 #include "sigchain.h"
 #include "connected.h"
 #include "transport.h"
 #include "packfile.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "blob.h"
+#include "tree-walk.h"
+#include "oidset.h"
+#include "progress.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+
+/*
+ * State of an in-process connectivity check. We walk from the new tips
+ * and stop at objects known to be connected: those in the closure of a
+ * bitmapped commit, and those in a new pack that index-pack found to be
+ * self-contained.
+ *
+ * When the bitmap is stale, that walk covers everything written since
+ * it was made, not just what we received. We give up after visiting
+ * "limit" objects that are not known to be connected and let rev-list,
+ * which can stop at our ref tips, do the check instead; "err" is then
+ * positive.
+ */
+#define CONNECTIVITY_WALK_LIMIT 1000
+
+struct connectivity {
+	struct check_connected_options *opt;
+	struct packed_git *new_pack;
+	struct bitmap *reachable;
+	struct oidset seen;
+	struct commit_list *commits;
+	struct oid_array trees;
+	struct progress *progress;
+	uint32_t nr;
+	unsigned long walked, limit;
+	int err;
+};
+
+static void connectivity_error(struct connectivity *c, const char *type,
+			       const struct object_id *oid)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	c->err = -1;
+	if (c->opt->quiet)
+		return;
+	strbuf_addf(&sb, _("missing %s %s"), type, oid_to_hex(oid));
+	if (c->opt->err_fd) {
+		strbuf_insert(&sb, 0, "error: ", 7);
+		strbuf_addch(&sb, '\n');
+		write_in_full(c->opt->err_fd, sb.buf, sb.len);
+	} else
+		error("%s", sb.buf);
+	strbuf_release(&sb);
+}
+
+/*
+ * Returns 1 if "oid" was seen before or is known to be connected, in
+ * which case the caller does not have to look at it.
+ */
+static int known_connected(struct connectivity *c, const struct object_id *oid)
+{
+	if (oidset_insert(&c->seen, oid))
+		return 1;
+	display_progress(c->progress, ++c->nr);
+	if (c->new_pack && find_pack_entry_one(oid->hash, c->new_pack))
+		return 1;
+	if (bitmap_is_reachable(c->reachable, oid))
+		return 1;
+	if (++c->walked > c->limit) {
+		/* stop the walk; the caller falls back to rev-list */
+		c->err = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static void add_commit(struct connectivity *c, const struct object_id *oid)
+{
+	struct commit *commit;
+
+	if (known_connected(c, oid) || bitmap_add_reachable(c->reachable, oid))
+		return;
+	commit = lookup_commit(oid);
+	if (!commit || parse_commit_gently(commit, 1) || !commit->tree) {
+		connectivity_error(c, commit_type, oid);
+		return;
+	}
+	commit_list_insert_by_date(commit, &c->commits);
+}
+
+static void add_tip(struct connectivity *c, const struct object_id *oid)
+{
+	struct object *obj;
+
+	switch (sha1_object_info(oid->hash, NULL)) {
+	case OBJ_COMMIT:
+		add_commit(c, oid);
+		break;
+	case OBJ_TREE:
+		if (!known_connected(c, oid))
+			oid_array_append(&c->trees, oid);
+		break;
+	case OBJ_BLOB:
+		break;
+	case OBJ_TAG:
+		if (known_connected(c, oid))
+			break;
+		obj = parse_object(oid);
+		if (!obj || obj->type != OBJ_TAG || !((struct tag *)obj)->tagged) {
+			connectivity_error(c, tag_type, oid);
+			break;
+		}
+		add_tip(c, &((struct tag *)obj)->tagged->oid);
+		break;
+	default:
+		connectivity_error(c, "object", oid);
+	}
+}
+
+static void walk_commits(struct connectivity *c)
+{
+	while (c->commits && !c->err) {
+		struct commit *commit = pop_commit(&c->commits);
+		struct commit_list *p;
+
+		/* a bitmap added since we queued it may cover it */
+		if (bitmap_is_reachable(c->reachable, &commit->object.oid))
+			continue;
+		if (!known_connected(c, &commit->tree->object.oid))
+			oid_array_append(&c->trees, &commit->tree->object.oid);
+		for (p = commit->parents; p; p = p->next)
+			add_commit(c, &p->item->object.oid);
+	}
+	free_commit_list(c->commits);
+	c->commits = NULL;
+}
+
+static void walk_trees(struct connectivity *c)
+{
+	while (c->trees.nr && !c->err) {
+		struct object_id oid = c->trees.oid[--c->trees.nr];
+		enum object_type type;
+		unsigned long size;
+		struct tree_desc desc;
+		struct name_entry entry;
+		void *buf;
+
+		buf = read_sha1_file(oid.hash, &type, &size);
+		if (!buf || type != OBJ_TREE ||
+		    init_tree_desc_gently(&desc, buf, size)) {
+			free(buf);
+			connectivity_error(c, tree_type, &oid);
+			break;
+		}
+		while (tree_entry_gently(&desc, &entry)) {
+			if (S_ISGITLINK(entry.mode) ||
+			    known_connected(c, entry.oid))
+				continue;
+			if (S_ISDIR(entry.mode))
+				oid_array_append(&c->trees, entry.oid);
+			else if (sha1_object_info(entry.oid->hash, NULL) != OBJ_BLOB) {
+				connectivity_error(c, blob_type, entry.oid);
+				break;
+			}
+		}
+		free(buf);
+	}
+}
+
+/*
+ * Check the tips in-process, using the bitmap index to avoid walking
+ * anything that our existing history already covers. Unlike the
+ * rev-list check below, this does not need to look at our refs at all.
+ *
+ * Returns 0 if everything is connected, negative on error, and positive
+ * if the walk got too long; the tips are then left in "tips".
+ */
+static int check_connected_in_process(struct oid_array *tips,
+				      struct check_connected_options *opt,
+				      struct packed_git *new_pack)
+{
+	struct connectivity c;
+	int i;
+
+	memset(&c, 0, sizeof(c));
+	c.opt = opt;
+	c.new_pack = new_pack;
+	c.reachable = bitmap_new();
+	c.limit = git_env_ulong("GIT_TEST_CONNECTIVITY_WALK_LIMIT",
+				CONNECTIVITY_WALK_LIMIT);
+	if (opt->progress && !opt->err_fd)
+		c.progress = start_delayed_progress(_("Checking connectivity"), 0);
+
+	for (i = 0; i < tips->nr && !c.err; i++)
+		add_tip(&c, &tips->oid[i]);
+	if (!c.err)
+		walk_commits(&c);
+	if (!c.err)
+		walk_trees(&c);
+
+	stop_progress(&c.progress);
+	free_commit_list(c.commits);
+	oid_array_clear(&c.trees);
+	oidset_clear(&c.seen);
+	bitmap_free(c.reachable);
+	if (c.err <= 0 && opt->err_fd)
+		close(opt->err_fd);
+	return c.err;
+}
+
+struct tips_iter {
+	struct oid_array *tips;
+	int next;
+};
+
+static int iterate_tips(void *cb_data, struct object_id *oid)
+{
+	struct tips_iter *it = cb_data;
+
+	if (it->next >= it->tips->nr)
+		return -1;
+	oidcpy(oid, &it->tips->oid[it->next++]);
+	return 0;
+}
 
 /*
  * If we feed all the commits we want to verify to this command
@@ -26,6 +251,8 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	int err = 0;
 	struct packed_git *new_pack = NULL;
 	struct transport *transport;
+	struct oid_array tips = OID_ARRAY_INIT;
+	struct tips_iter it;
 	size_t base_len;
 
 	if (!opt)
@@ -49,6 +276,26 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		strbuf_release(&idx_file);
 	}
 
+	if (!opt->shallow_file && !is_repository_shallow() &&
+	    !prepare_bitmap_git()) {
+		do {
+			oid_array_append(&tips, &oid);
+		} while (!fn(cb_data, &oid));
+		err = check_connected_in_process(&tips, opt, new_pack);
+		if (err <= 0) {
+			oid_array_clear(&tips);
+			return err;
+		}
+
+		/* feed rev-list the tips we already read */
+		err = 0;
+		it.tips = &tips;
+		it.next = 0;
+		fn = iterate_tips;
+		cb_data = &it;
+		iterate_tips(cb_data, &oid);
+	}
+
 	if (opt->shallow_file) {
 		argv_array_push(&rev_list.args, "--shallow-file");
 		argv_array_push(&rev_list.args, opt->shallow_file);
@@ -72,8 +319,10 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 	else
 		rev_list.no_stderr = opt->quiet;
 
-	if (start_command(&rev_list))
+	if (start_command(&rev_list)) {
+		oid_array_clear(&tips);
 		return error(_("Could not run 'git rev-list'"));
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
@@ -103,5 +352,6 @@ int check_connected(oid_iterate_fn fn, void *cb_data,
 		err = error_errno(_("failed to close rev-list's stdin"));
 
 	sigchain_pop(SIGPIPE);
+	oid_array_clear(&tips);
 	return finish_command(&rev_list) || err;
 }
@@ -36,6 +36,9 @@ struct check_connected_options {
 
 	/*
 	 * Insert these variables into the environment of the child process.
+	 * The in-process check uses the caller's object store as it is, so
+	 * a quarantine directory passed here must also have been added as
+	 * an alternate.
 	 */
 	const char **env;
 };
@@ -49,6 +52,10 @@ struct check_connected_options {
  *
  * Return 0 if Ok, non zero otherwise (i.e. some missing objects)
  *
+ * When we have a bitmap index (and are not shallow), this is done
+ * in-process, walking only the objects that the bitmapped history does
+ * not already cover. Otherwise it runs "git rev-list".
+ *
  * If "opt" is NULL, behaves as if CHECK_CONNECTED_INIT was passed.
  */
 int check_connected(oid_iterate_fn fn, void *cb_data,
@@ -50,4 +50,10 @@ static inline void sha1write_be32(struct sha1file *f, uint32_t data)
 	sha1write(f, &data, sizeof(data));
 }
 
+static inline void sha1write_be64(struct sha1file *f, uint64_t data)
+{
+	sha1write_be32(f, data >> 32);
+	sha1write_be32(f, data & 0xffffffff);
+}
+
 #endif
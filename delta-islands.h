@@ -0,0 +1,50 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+struct commit;
+struct object_id;
+struct packing_data;
+
+/*
+ * Delta islands partition the objects of a repository by the refs
+ * that reach them. Each "pack.island" regex in the configuration maps
+ * matching ref names to an island named after the regex's capture
+ * groups. pack-objects then only stores an object as a delta against
+ * a base that is reachable from every island the object is, so a
+ * client fetching the refs of a single island can reuse the deltas.
+ */
+
+/*
+ * Read the "pack.island" configuration and mark the objects pointed
+ * to by matching refs. Must be called before the object walk.
+ */
+extern void load_delta_islands(int progress);
+
+/*
+ * Pass the marks of a commit on to its tree and parents. The walk
+ * must show children before their parents (i.e. use --topo-order).
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Pass the marks of every tree in "to_pack" on to its entries, once
+ * the walk is over and the tree depths are known.
+ */
+extern void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+/*
+ * May "trg" be stored as a delta against "src"? True when islands are
+ * not in use, when "trg" is in no island, or when "src" is in every
+ * island "trg" is in.
+ */
+extern int in_same_island(const struct object_id *trg_oid,
+			  const struct object_id *src_oid);
+
+/*
+ * Order objects for the delta search so that objects belonging to
+ * more islands come first and are considered as bases for the others.
+ */
+extern int island_delta_cmp(const struct object_id *a,
+			    const struct object_id *b);
+
+#endif /* DELTA_ISLANDS_H */
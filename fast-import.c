@@ -3391,7 +3391,7 @@ static void git_pack_config(void)
 	}
 	if (!git_config_get_int("pack.indexversion", &indexversion_value)) {
 		pack_idx_opts.version = indexversion_value;
-		if (pack_idx_opts.version > 2)
+		if (pack_idx_opts.version > 3)
 			git_die_config("pack.indexversion",
 					"bad pack.indexversion=%"PRIu32, pack_idx_opts.version);
 	}
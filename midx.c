@@ -0,0 +1,757 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "packfile.h"
+#include "sha1-lookup.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_VERSION 1
+
+#define MIDX_OID_VERSION_SHA1 1
+#define MIDX_OID_LEN_SHA1 GIT_SHA1_RAWSZ
+#define MIDX_OID_VERSION MIDX_OID_VERSION_SHA1
+#define MIDX_OID_LEN MIDX_OID_LEN_SHA1
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+#define MIDX_MAX_CHUNKS 5
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_CHUNKLOOKUP_WIDTH + \
+		       MIDX_OID_LEN)
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m = NULL;
+	const unsigned char *data, *chunk_lookup, *names, *end;
+	void *midx_map;
+	size_t midx_size;
+	struct stat st;
+	uint32_t i;
+	char *midx_name = get_midx_filename(object_dir);
+	int fd = git_open(midx_name);
+
+	if (fd < 0)
+		goto cleanup_fail;
+	if (fstat(fd, &st)) {
+		error_errno("failed to read %s", midx_name);
+		goto cleanup_fail;
+	}
+	midx_size = xsize_t(st.st_size);
+
+	if (midx_size < MIDX_MIN_SIZE) {
+		error("multi-pack-index file %s is too small", midx_name);
+		goto cleanup_fail;
+	}
+	midx_map = xmmap(NULL, midx_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	data = midx_map;
+	/* everything but the trailing checksum */
+	end = data + midx_size - MIDX_OID_LEN;
+
+	FLEX_ALLOC_STR(m, object_dir, object_dir);
+	m->fd = fd;
+	m->data = data;
+	m->data_len = midx_size;
+
+	if (get_be32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index signature %X does not match signature %X",
+		      get_be32(data), MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+
+	m->version = data[4];
+	if (m->version != MIDX_VERSION) {
+		error("multi-pack-index version %d not recognized", m->version);
+		goto cleanup_fail;
+	}
+
+	if (data[5] != MIDX_OID_VERSION) {
+		error("hash version %u does not match", data[5]);
+		goto cleanup_fail;
+	}
+	m->hash_len = MIDX_OID_LEN;
+
+	m->num_chunks = data[6];
+	if (data[7]) {
+		error("multi-pack-index with base files is not supported");
+		goto cleanup_fail;
+	}
+	m->num_packs = get_be32(data + 8);
+
+	if (MIDX_HEADER_SIZE + (m->num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH >
+	    end - data) {
+		error("multi-pack-index file %s is too small for %d chunks",
+		      midx_name, m->num_chunks);
+		goto cleanup_fail;
+	}
+
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	for (i = 0; i < m->num_chunks; i++) {
+		uint32_t chunk_id = get_be32(chunk_lookup);
+		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t next_offset = get_be64(chunk_lookup + 4 +
+						MIDX_CHUNKLOOKUP_WIDTH);
+		const unsigned char **chunk = NULL;
+
+		chunk_lookup += MIDX_CHUNKLOOKUP_WIDTH;
+
+		if (chunk_offset > next_offset || next_offset > end - data) {
+			error("improper chunk offset %08x%08x",
+			      (uint32_t)(chunk_offset >> 32),
+			      (uint32_t)chunk_offset);
+			goto cleanup_fail;
+		}
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			chunk = &m->chunk_pack_names;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			chunk = (const unsigned char **)&m->chunk_oid_fanout;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			chunk = &m->chunk_oid_lookup;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			chunk = &m->chunk_object_offsets;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			chunk = &m->chunk_large_offsets;
+			m->num_large_offsets = (next_offset - chunk_offset) /
+					       MIDX_LARGE_OFFSET_WIDTH;
+			break;
+		default:
+			/* ignore chunks we do not know about */
+			continue;
+		}
+
+		if (*chunk) {
+			error("chunk id %08x appears multiple times", chunk_id);
+			goto cleanup_fail;
+		}
+		*chunk = data + chunk_offset;
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error("multi-pack-index file %s is missing a required chunk",
+		      midx_name);
+		goto cleanup_fail;
+	}
+
+	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+	if (m->chunk_oid_lookup + (size_t)m->num_objects * m->hash_len > end ||
+	    m->chunk_object_offsets + (size_t)m->num_objects * MIDX_OFFSET_WIDTH > end) {
+		error("multi-pack-index file %s is truncated", midx_name);
+		goto cleanup_fail;
+	}
+
+	ALLOC_ARRAY(m->pack_names, m->num_packs);
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	names = m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const unsigned char *nul = memchr(names, '\0', end - names);
+
+		if (!nul) {
+			error("multi-pack-index pack names are truncated");
+			goto cleanup_fail;
+		}
+		m->pack_names[i] = (const char *)names;
+		if (i && strcmp(m->pack_names[i - 1], m->pack_names[i]) >= 0) {
+			error("multi-pack-index pack names out of order: '%s' before '%s'",
+			      m->pack_names[i - 1], m->pack_names[i]);
+			goto cleanup_fail;
+		}
+		names = nul + 1;
+	}
+
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	close_midx(m);
+	if (!m && fd >= 0)
+		close(fd);
+	free(midx_name);
+	return NULL;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	uint32_t i;
+
+	if (!m)
+		return;
+	if (m->packs) {
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i])
+				m->packs[i]->multi_pack_index = 0;
+	}
+	munmap((void *)m->data, m->data_len);
+	close(m->fd);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+/* global storage */
+static struct multi_pack_index *multi_pack_index;
+
+struct multi_pack_index *get_multi_pack_index(void)
+{
+	return multi_pack_index;
+}
+
+void close_all_midx(void)
+{
+	while (multi_pack_index) {
+		struct multi_pack_index *m = multi_pack_index;
+		multi_pack_index = m->next;
+		close_midx(m);
+	}
+}
+
+static int midx_pack_pos(struct multi_pack_index *m, const char *idx_name)
+{
+	uint32_t first = 0, last = m->num_packs;
+
+	while (first < last) {
+		uint32_t mid = first + (last - first) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mid]);
+
+		if (!cmp)
+			return mid;
+		if (cmp > 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return -1;
+}
+
+int midx_contains_pack(struct multi_pack_index *m, const char *idx_name)
+{
+	return midx_pack_pos(m, idx_name) >= 0;
+}
+
+void prepare_multi_pack_index_one(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	struct strbuf pack_dir = STRBUF_INIT;
+	struct strbuf idx_name = STRBUF_INIT;
+	uint32_t i;
+
+	if (!core_multi_pack_index)
+		return;
+
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(m->object_dir, object_dir))
+			return;
+
+	m = load_multi_pack_index(object_dir);
+	if (!m)
+		return;
+
+	strbuf_addf(&pack_dir, "%s/pack/", object_dir);
+	for (p = packed_git; p; p = p->next) {
+		const char *base;
+		size_t len;
+		int pos;
+
+		if (!skip_prefix(p->pack_name, pack_dir.buf, &base) ||
+		    strchr(base, '/') ||
+		    !strip_suffix(base, ".pack", &len))
+			continue;
+
+		strbuf_reset(&idx_name);
+		strbuf_add(&idx_name, base, len);
+		strbuf_addstr(&idx_name, ".idx");
+		pos = midx_pack_pos(m, idx_name.buf);
+		if (pos >= 0)
+			m->packs[pos] = p;
+	}
+	strbuf_release(&pack_dir);
+	strbuf_release(&idx_name);
+
+	/*
+	 * A pack that went away since the file was written (e.g. removed
+	 * by an older repack) makes the whole file stale; the packs are
+	 * still searched one by one in that case.
+	 */
+	for (i = 0; i < m->num_packs; i++) {
+		if (!m->packs[i]) {
+			close_midx(m);
+			return;
+		}
+	}
+	for (i = 0; i < m->num_packs; i++)
+		m->packs[i]->multi_pack_index = 1;
+
+	m->next = multi_pack_index;
+	multi_pack_index = m;
+}
+
+int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m,
+		 uint32_t *result)
+{
+	return bsearch_hash(oid->hash, m->chunk_oid_fanout,
+			    m->chunk_oid_lookup, m->hash_len, result);
+}
+
+struct object_id *nth_midxed_object_oid(struct object_id *oid,
+					struct multi_pack_index *m,
+					uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+
+	hashcpy(oid->hash, m->chunk_oid_lookup + m->hash_len * n);
+	return oid;
+}
+
+static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+{
+	return get_be32(m->chunk_object_offsets + pos * MIDX_OFFSET_WIDTH);
+}
+
+static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + pos * MIDX_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + sizeof(uint32_t));
+
+	if (offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		offset32 ^= MIDX_LARGE_OFFSET_NEEDED;
+		if (sizeof(off_t) < sizeof(uint64_t))
+			die(_("multi-pack-index stores a 64-bit offset, but off_t is too small"));
+		if (offset32 >= m->num_large_offsets)
+			die(_("multi-pack-index large offset out of bounds"));
+		return get_be64(m->chunk_large_offsets +
+				(size_t)offset32 * MIDX_LARGE_OFFSET_WIDTH);
+	}
+
+	return offset32;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+		    struct multi_pack_index *m)
+{
+	struct object_id oid;
+	uint32_t pos, pack_int_id;
+	struct packed_git *p;
+
+	hashcpy(oid.hash, sha1);
+	if (!bsearch_midx(&oid, m, &pos))
+		return 0;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pos);
+	if (pack_int_id >= m->num_packs)
+		die(_("bad pack-int-id: %u (%u total packs)"),
+		    pack_int_id, m->num_packs);
+	p = m->packs[pack_int_id];
+
+	if (p->num_bad_objects) {
+		uint32_t i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+				return -1;
+	}
+
+	/*
+	 * As in fill_pack_entry(), make sure the pack is still there
+	 * before telling the caller to read from it.
+	 */
+	if (!is_pack_valid(p))
+		return -1;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+struct pack_info {
+	char *name;
+	struct packed_git *p;
+};
+
+static int pack_info_compare(const void *_a, const void *_b)
+{
+	const struct pack_info *a = _a, *b = _b;
+	return strcmp(a->name, b->name);
+}
+
+struct pack_midx_entry {
+	struct object_id oid;
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int midx_oid_compare(const void *_a, const void *_b)
+{
+	const struct pack_midx_entry *a = _a, *b = _b;
+	int cmp = oidcmp(&a->oid, &b->oid);
+
+	if (cmp)
+		return cmp;
+
+	/* prefer the copy in the newest pack, like sort_pack() does */
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	if (a->pack_mtime < b->pack_mtime)
+		return 1;
+
+	return a->pack_int_id - b->pack_int_id;
+}
+
+static void write_midx_chunk_pack_names(struct sha1file *f,
+					struct pack_info *packs,
+					uint32_t nr_packs,
+					size_t pad)
+{
+	uint32_t i;
+	static const unsigned char padding[4];
+
+	for (i = 0; i < nr_packs; i++)
+		sha1write(f, packs[i].name, strlen(packs[i].name) + 1);
+	if (pad)
+		sha1write(f, padding, pad);
+}
+
+static void write_midx_chunk_oid_fanout(struct sha1file *f,
+					struct pack_midx_entry *objects,
+					uint32_t nr_objects)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < nr_objects && objects[count].oid.hash[0] == i)
+			count++;
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_midx_chunk_oid_lookup(struct sha1file *f,
+					struct pack_midx_entry *objects,
+					uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++)
+		sha1write(f, objects[i].oid.hash, MIDX_OID_LEN);
+}
+
+static void write_midx_chunk_object_offsets(struct sha1file *f,
+					    struct pack_midx_entry *objects,
+					    uint32_t nr_objects)
+{
+	uint32_t i, nr_large_offset = 0;
+
+	for (i = 0; i < nr_objects; i++) {
+		sha1write_be32(f, objects[i].pack_int_id);
+		if (objects[i].offset >> 31)
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | nr_large_offset++);
+		else
+			sha1write_be32(f, (uint32_t)objects[i].offset);
+	}
+}
+
+static void write_midx_chunk_large_offsets(struct sha1file *f,
+					   struct pack_midx_entry *objects,
+					   uint32_t nr_objects)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr_objects; i++) {
+		uint64_t offset = objects[i].offset;
+
+		if (!(offset >> 31))
+			continue;
+		sha1write_be32(f, offset >> 32);
+		sha1write_be32(f, offset & 0xffffffff);
+	}
+}
+
+int write_midx_file(const char *object_dir)
+{
+	struct strbuf pack_dir = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct pack_info *packs = NULL;
+	struct pack_midx_entry *objects = NULL;
+	uint32_t nr_packs = 0, alloc_packs = 0;
+	uint32_t nr_entries = 0, nr_objects = 0, nr_large_offset = 0;
+	uint32_t chunk_ids[MIDX_MAX_CHUNKS + 1];
+	uint64_t chunk_offsets[MIDX_MAX_CHUNKS + 1];
+	size_t pack_name_len = 0, pad;
+	uint64_t total_entries = 0;
+	uint32_t i, j, num_chunks = 0;
+	char *midx_name;
+	struct sha1file *f;
+	struct dirent *de;
+	DIR *dir;
+	int fd;
+
+	strbuf_addf(&pack_dir, "%s/pack", object_dir);
+	dir = opendir(pack_dir.buf);
+	if (!dir) {
+		error_errno("unable to open pack directory: %s", pack_dir.buf);
+		strbuf_release(&pack_dir);
+		return -1;
+	}
+	strbuf_addch(&pack_dir, '/');
+
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+		size_t dirlen = pack_dir.len;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+
+		strbuf_addstr(&pack_dir, de->d_name);
+		p = add_packed_git(pack_dir.buf, pack_dir.len, 0);
+		if (p && open_pack_index(p)) {
+			warning("failed to open pack-index '%s'", pack_dir.buf);
+			close_pack(p);
+			FREE_AND_NULL(p);
+		}
+		strbuf_setlen(&pack_dir, dirlen);
+		if (!p)
+			continue;
+
+		ALLOC_GROW(packs, nr_packs + 1, alloc_packs);
+		packs[nr_packs].name = xstrdup(de->d_name);
+		packs[nr_packs].p = p;
+		nr_packs++;
+		pack_name_len += strlen(de->d_name) + 1;
+		total_entries += p->num_objects;
+	}
+	closedir(dir);
+
+	if (total_entries >= 0xffffffff)
+		die(_("too many objects for a multi-pack-index: %"PRIuMAX),
+		    (uintmax_t)total_entries);
+
+	QSORT(packs, nr_packs, pack_info_compare);
+
+	ALLOC_ARRAY(objects, total_entries);
+	for (i = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *entry = &objects[nr_entries++];
+
+			nth_packed_object_oid(&entry->oid, p, j);
+			entry->pack_int_id = i;
+			entry->pack_mtime = p->mtime;
+			entry->offset = nth_packed_object_offset(p, j);
+		}
+	}
+
+	QSORT(objects, nr_entries, midx_oid_compare);
+
+	/* keep only the preferred copy of each object */
+	for (i = 0; i < nr_entries; i++) {
+		if (nr_objects && !oidcmp(&objects[nr_objects - 1].oid,
+					  &objects[i].oid))
+			continue;
+		objects[nr_objects++] = objects[i];
+		if (objects[i].offset >> 31)
+			nr_large_offset++;
+	}
+
+	pad = (4 - pack_name_len % 4) % 4;
+
+	chunk_ids[num_chunks] = MIDX_CHUNKID_PACKNAMES;
+	chunk_offsets[num_chunks++] = pack_name_len + pad;
+	chunk_ids[num_chunks] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_offsets[num_chunks++] = MIDX_FANOUT_SIZE;
+	chunk_ids[num_chunks] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_offsets[num_chunks++] = (uint64_t)nr_objects * MIDX_OID_LEN;
+	chunk_ids[num_chunks] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_offsets[num_chunks++] = (uint64_t)nr_objects * MIDX_OFFSET_WIDTH;
+	if (nr_large_offset) {
+		chunk_ids[num_chunks] = MIDX_CHUNKID_LARGEOFFSETS;
+		chunk_offsets[num_chunks++] =
+			(uint64_t)nr_large_offset * MIDX_LARGE_OFFSET_WIDTH;
+	}
+	chunk_ids[num_chunks] = 0;
+	chunk_offsets[num_chunks] = 0;
+
+	/* turn the chunk sizes into offsets from the start of the file */
+	{
+		uint64_t offset = MIDX_HEADER_SIZE +
+				  (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+		for (i = 0; i <= num_chunks; i++) {
+			uint64_t size = chunk_offsets[i];
+			chunk_offsets[i] = offset;
+			offset += size;
+		}
+	}
+
+	midx_name = get_midx_filename(object_dir);
+	strbuf_addf(&tmp_file, "%s/pack/tmp_midx_XXXXXX", object_dir);
+	fd = xmkstemp_mode(tmp_file.buf, 0444);
+	f = sha1fd(fd, tmp_file.buf);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, nr_packs);
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be32(f, chunk_offsets[i] >> 32);
+		sha1write_be32(f, chunk_offsets[i] & 0xffffffff);
+	}
+
+	write_midx_chunk_pack_names(f, packs, nr_packs, pad);
+	write_midx_chunk_oid_fanout(f, objects, nr_objects);
+	write_midx_chunk_oid_lookup(f, objects, nr_objects);
+	write_midx_chunk_object_offsets(f, objects, nr_objects);
+	write_midx_chunk_large_offsets(f, objects, nr_objects);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno("unable to make temporary multi-pack-index file readable");
+
+	/* Make sure we do not keep the old file mapped while replacing it. */
+	close_all_midx();
+	if (rename(tmp_file.buf, midx_name))
+		die_errno("unable to rename temporary multi-pack-index file to '%s'",
+			  midx_name);
+	/* let prepare_packed_git() pick up the new file */
+	reprepare_packed_git();
+
+	for (i = 0; i < nr_packs; i++) {
+		close_pack(packs[i].p);
+		free(packs[i].p);
+		free(packs[i].name);
+	}
+	free(packs);
+	free(objects);
+	free(midx_name);
+	strbuf_release(&tmp_file);
+	strbuf_release(&pack_dir);
+	return 0;
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+
+	close_all_midx();
+	if (unlink(midx_name) && errno != ENOENT)
+		die_errno(_("failed to clear multi-pack-index at %s"), midx_name);
+	reprepare_packed_git();
+
+	free(midx_name);
+}
+
+int verify_midx_file(const char *object_dir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(object_dir);
+	struct object_id oid, prev;
+	unsigned char sha1[GIT_MAX_RAWSZ];
+	git_SHA_CTX ctx;
+	uint32_t i;
+	int errors = 0;
+
+	if (!m)
+		return 0;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - MIDX_OID_LEN);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, m->data + m->data_len - MIDX_OID_LEN)) {
+		error(_("multi-pack-index checksum mismatch"));
+		errors++;
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/pack/%s", object_dir, m->pack_names[i]);
+		m->packs[i] = add_packed_git(path.buf, path.len, 0);
+		if (!m->packs[i] || open_pack_index(m->packs[i])) {
+			error(_("failed to load pack '%s' in multi-pack-index"),
+			      m->pack_names[i]);
+			errors++;
+		}
+		strbuf_release(&path);
+	}
+	if (errors)
+		goto cleanup;
+
+	for (i = 0; i < 255; i++) {
+		if (ntohl(m->chunk_oid_fanout[i]) >
+		    ntohl(m->chunk_oid_fanout[i + 1])) {
+			error(_("multi-pack-index oid fanout out of order: fanout[%d] > fanout[%d]"),
+			      i, i + 1);
+			errors++;
+		}
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		struct packed_git *p;
+		uint32_t pack_int_id;
+		off_t m_offset, p_offset;
+
+		nth_midxed_object_oid(&oid, m, i);
+		if (i && oidcmp(&prev, &oid) >= 0) {
+			error(_("multi-pack-index oid lookup out of order: oid[%d] = %s >= %s = oid[%d]"),
+			      i - 1, oid_to_hex(&prev), oid_to_hex(&oid), i);
+			errors++;
+		}
+		oidcpy(&prev, &oid);
+
+		pack_int_id = nth_midxed_pack_int_id(m, i);
+		if (pack_int_id >= m->num_packs) {
+			error(_("bad pack-int-id: %u (%u total packs)"),
+			      pack_int_id, m->num_packs);
+			errors++;
+			continue;
+		}
+		p = m->packs[pack_int_id];
+		m_offset = nth_midxed_offset(m, i);
+		p_offset = find_pack_entry_one(oid.hash, p);
+		if (m_offset != p_offset) {
+			error(_("incorrect object offset for oid[%d] = %s: %"PRIuMAX" != %"PRIuMAX),
+			      i, oid_to_hex(&oid), (uintmax_t)m_offset,
+			      (uintmax_t)p_offset);
+			errors++;
+		}
+	}
+
+cleanup:
+	for (i = 0; i < m->num_packs; i++) {
+		if (m->packs[i]) {
+			close_pack(m->packs[i]);
+			free(m->packs[i]);
+			m->packs[i] = NULL;
+		}
+	}
+	close_midx(m);
+	return errors;
+}
@@ -0,0 +1,106 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#include "git-compat-util.h"
+
+struct object_id;
+struct pack_entry;
+struct packed_git;
+
+/*
+ * A multi-pack-index lives at "<obj_dir>/pack/multi-pack-index" and
+ * indexes the objects of every pack in that directory at the time it
+ * was written, so that a lookup costs one binary search instead of one
+ * per pack. See Documentation/technical/multi-pack-index-format.txt
+ * for the layout.
+ */
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	int fd;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	unsigned char version;
+	unsigned char hash_len;
+	unsigned char num_chunks;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	uint32_t num_large_offsets;
+
+	/* sorted names of the ".idx" files, and the packs they refer to */
+	const char **pack_names;
+	struct packed_git **packs;
+
+	char object_dir[FLEX_ARRAY];
+};
+
+extern char *get_midx_filename(const char *object_dir);
+
+/*
+ * Open and validate the multi-pack-index of "object_dir". Returns NULL
+ * (after printing an error for a corrupt file) if there is none.
+ */
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir);
+extern void close_midx(struct multi_pack_index *m);
+
+/*
+ * Load the multi-pack-index of "object_dir" if core.multiPackIndex is
+ * enabled, and tie it to the packs already in the packed_git list. A
+ * file naming a pack that cannot be found is ignored. Called by
+ * prepare_packed_git().
+ */
+extern void prepare_multi_pack_index_one(const char *object_dir);
+
+/* The loaded multi-pack-indexes, if any. */
+extern struct multi_pack_index *get_multi_pack_index(void);
+
+/*
+ * Forget the loaded multi-pack-indexes so that the next call to
+ * prepare_packed_git() reads them again.
+ */
+extern void close_all_midx(void);
+
+extern int bsearch_midx(const struct object_id *oid,
+			struct multi_pack_index *m, uint32_t *result);
+extern struct object_id *nth_midxed_object_oid(struct object_id *oid,
+					       struct multi_pack_index *m,
+					       uint32_t n);
+
+/*
+ * Look up "sha1" in "m" and, when found, fill "e" with its pack and
+ * offset. Returns 1 on success, 0 if "m" does not know the object, and
+ * -1 if it does but the entry cannot be used (the pack went away or the
+ * object is marked bad), in which case the caller should fall back to
+ * searching every pack.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+			   struct multi_pack_index *m);
+
+/* Does "m" cover the pack whose index file is named "idx_name"? */
+extern int midx_contains_pack(struct multi_pack_index *m, const char *idx_name);
+
+/*
+ * Write a multi-pack-index covering every pack in "<object_dir>/pack".
+ * Returns 0 on success.
+ */
+extern int write_midx_file(const char *object_dir);
+
+/* Remove the multi-pack-index of "object_dir", if any. */
+extern void clear_midx_file(const char *object_dir);
+
+/*
+ * Check the checksum, the ordering of the objects, and that every
+ * offset agrees with the pack index it came from. Returns the number
+ * of problems found.
+ */
+extern int verify_midx_file(const char *object_dir);
+
+#endif
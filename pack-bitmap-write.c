@@ -48,7 +48,8 @@ void bitmap_writer_show_progress(int show)
 /**
  * Build the initial type index for the packfile
  */
-void bitmap_writer_build_type_index(struct pack_idx_entry **index,
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
 				    uint32_t index_nr)
 {
 	uint32_t i;
@@ -62,14 +63,14 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 		struct object_entry *entry = (struct object_entry *)index[i];
 		enum object_type real_type;
 
-		entry->in_pack_pos = i;
+		oe_set_in_pack_pos(to_pack, entry, i);
 
-		switch (entry->type) {
+		switch (oe_type(entry)) {
 		case OBJ_COMMIT:
 		case OBJ_TREE:
 		case OBJ_BLOB:
 		case OBJ_TAG:
-			real_type = entry->type;
+			real_type = oe_type(entry);
 			break;
 
 		default:
@@ -98,7 +99,7 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 		default:
 			die("Missing type information for %s (%d/%d)",
 			    oid_to_hex(&entry->idx.oid), real_type,
-			    entry->type);
+			    oe_type(entry));
 		}
 	}
 }
@@ -147,7 +148,7 @@ static uint32_t find_object_pos(const unsigned char *sha1)
 			"(object %s is missing)", sha1_to_hex(sha1));
 	}
 
-	return entry->in_pack_pos;
+	return oe_in_pack_pos(writer.to_pack, entry);
 }
 
 static void show_object(struct object *object, const char *name, void *data)
@@ -462,22 +463,32 @@ static const unsigned char *sha1_access(size_t pos, void *table)
 	return index[pos]->oid.hash;
 }
 
+static uint32_t selected_commit_pos(int i,
+				    struct pack_idx_entry **index,
+				    uint32_t index_nr)
+{
+	int commit_pos = sha1_pos(writer.selected[i].commit->object.oid.hash,
+				  index, index_nr, sha1_access);
+
+	if (commit_pos < 0)
+		die("BUG: trying to write commit not in index");
+	return commit_pos;
+}
+
 static void write_selected_commits_v1(struct sha1file *f,
 				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t index_nr,
+				      off_t *offsets)
 {
 	int i;
 
 	for (i = 0; i < writer.selected_nr; ++i) {
 		struct bitmapped_commit *stored = &writer.selected[i];
 
-		int commit_pos =
-			sha1_pos(stored->commit->object.oid.hash, index, index_nr, sha1_access);
-
-		if (commit_pos < 0)
-			die("BUG: trying to write commit not in index");
+		if (offsets)
+			offsets[i] = f->total + f->offset;
 
-		sha1write_be32(f, commit_pos);
+		sha1write_be32(f, selected_commit_pos(i, index, index_nr));
 		sha1write_u8(f, stored->xor_offset);
 		sha1write_u8(f, stored->flags);
 
@@ -485,6 +496,61 @@ static void write_selected_commits_v1(struct sha1file *f,
 	}
 }
 
+struct lookup_table_row {
+	uint32_t commit_pos;
+	int selected;
+};
+
+static int lookup_table_row_cmp(const void *va, const void *vb)
+{
+	const struct lookup_table_row *a = va, *b = vb;
+
+	if (a->commit_pos < b->commit_pos)
+		return -1;
+	if (a->commit_pos > b->commit_pos)
+		return 1;
+	return 0;
+}
+
+/*
+ * Write one row per selected commit, sorted by index position, so that
+ * readers can find a single bitmap without parsing all of them.
+ */
+static void write_lookup_table(struct sha1file *f,
+			       struct pack_idx_entry **index,
+			       uint32_t index_nr,
+			       off_t *offsets)
+{
+	struct lookup_table_row *rows;
+	uint32_t *row_of;
+	int i;
+
+	ALLOC_ARRAY(rows, writer.selected_nr);
+	ALLOC_ARRAY(row_of, writer.selected_nr);
+
+	for (i = 0; i < writer.selected_nr; ++i) {
+		rows[i].commit_pos = selected_commit_pos(i, index, index_nr);
+		rows[i].selected = i;
+	}
+	QSORT(rows, writer.selected_nr, lookup_table_row_cmp);
+
+	for (i = 0; i < writer.selected_nr; ++i)
+		row_of[rows[i].selected] = i;
+
+	for (i = 0; i < writer.selected_nr; ++i) {
+		int selected = rows[i].selected;
+		int xor_offset = writer.selected[selected].xor_offset;
+
+		sha1write_be32(f, rows[i].commit_pos);
+		sha1write_be64(f, offsets[selected]);
+		sha1write_be32(f, xor_offset ?
+			       row_of[selected - xor_offset] : BITMAP_NO_XOR_ROW);
+	}
+
+	free(rows);
+	free(row_of);
+}
+
 static void write_hash_cache(struct sha1file *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -512,6 +578,7 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct sha1file *f;
+	off_t *offsets = NULL;
 
 	struct bitmap_disk_header header;
 
@@ -530,7 +597,13 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.trees);
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		ALLOC_ARRAY(offsets, writer.selected_nr);
+
+	write_selected_commits_v1(f, index, index_nr, offsets);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, index, index_nr, offsets);
 
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
@@ -543,5 +616,6 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	if (rename(tmp_file.buf, filename))
 		die_errno("unable to rename temporary bitmap file to '%s'", filename);
 
+	free(offsets);
 	strbuf_release(&tmp_file);
 }
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "commit.h"
 #include "tag.h"
 #include "diff.h"
@@ -34,13 +35,6 @@ static struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
 	struct packed_git *pack;
 
-	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
-	 */
-	uint32_t reuse_objects;
-
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
 	size_t map_size; /* size of the mmaped buffer */
@@ -67,6 +61,13 @@ static struct bitmap_index {
 	/* Name-hash cache (or NULL if not present). */
 	uint32_t *hashes;
 
+	/*
+	 * Commit lookup table (or NULL if not present or not used). When
+	 * set, the stored bitmaps are not parsed up front, but looked up
+	 * here and loaded into `bitmaps` the first time they are needed.
+	 */
+	const unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -146,21 +147,35 @@ static int load_bitmap_header(struct bitmap_index *index)
 	if (index->version != 1)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
+	index->entry_count = ntohl(header->entry_count);
+
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
+		size_t cache_size = 0, table_size = 0;
+		unsigned char *end = index->map + index->map_size - 20;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
-		if (flags & BITMAP_OPT_HASH_CACHE) {
-			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
-		}
+		if (flags & BITMAP_OPT_HASH_CACHE)
+			cache_size = st_mult(index->pack->num_objects, sizeof(uint32_t));
+		if (flags & BITMAP_OPT_LOOKUP_TABLE)
+			table_size = st_mult(index->entry_count,
+					     BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH);
+
+		if (index->map_size < sizeof(*header) + 20 + cache_size + table_size)
+			return error("Corrupted bitmap index (too small for its sections)");
+
+		if (flags & BITMAP_OPT_HASH_CACHE)
+			index->hashes = (uint32_t *)(end - cache_size);
+
+		if ((flags & BITMAP_OPT_LOOKUP_TABLE) &&
+		    git_env_bool("GIT_TEST_READ_COMMIT_TABLE", 1))
+			index->table_lookup = end - cache_size - table_size;
 	}
 
-	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header);
 	return 0;
 }
@@ -248,6 +263,173 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+static inline const unsigned char *bitmap_table_triplet(struct bitmap_index *index,
+							uint32_t row)
+{
+	return index->table_lookup + (size_t)row * BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH;
+}
+
+/*
+ * Binary search the commit lookup table for `sha1`. The table is sorted
+ * by index position, i.e. in the same order as the object names.
+ */
+static int bitmap_table_find(struct bitmap_index *index,
+			     const unsigned char *sha1, uint32_t *row)
+{
+	uint32_t lo = 0, hi = index->entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t commit_pos = get_be32(bitmap_table_triplet(index, mi));
+		const unsigned char *found;
+		int cmp;
+
+		found = nth_packed_object_sha1(index->pack, commit_pos);
+		if (!found)
+			return error("Corrupted bitmap lookup table");
+
+		cmp = hashcmp(sha1, found);
+		if (!cmp) {
+			*row = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/*
+ * Load the bitmap stored for row `row` of the lookup table, XOR'ed
+ * against the already loaded `xor_bitmap` (which may be NULL).
+ */
+static struct stored_bitmap *load_bitmap_table_row(struct bitmap_index *index,
+						   uint32_t row,
+						   struct stored_bitmap *xor_bitmap)
+{
+	const unsigned char *triplet = bitmap_table_triplet(index, row);
+	uint32_t commit_pos = get_be32(triplet);
+	uint64_t offset = get_be64(triplet + 4);
+	const unsigned char *sha1;
+	struct ewah_bitmap *bitmap;
+	int flags;
+
+	if (offset < sizeof(struct bitmap_disk_header) ||
+	    offset + 6 > index->table_lookup - index->map) {
+		error("Corrupted bitmap lookup table (bad offset)");
+		return NULL;
+	}
+
+	index->map_pos = offset;
+	if (read_be32(index->map, &index->map_pos) != commit_pos) {
+		error("Corrupted bitmap lookup table (entry mismatch)");
+		return NULL;
+	}
+	read_u8(index->map, &index->map_pos); /* xor offset */
+	flags = read_u8(index->map, &index->map_pos);
+
+	sha1 = nth_packed_object_sha1(index->pack, commit_pos);
+	if (!sha1) {
+		error("Corrupted bitmap lookup table (bad commit position)");
+		return NULL;
+	}
+
+	bitmap = read_bitmap_1(index);
+	if (!bitmap)
+		return NULL;
+
+	return store_bitmap(index, bitmap, sha1, xor_bitmap, flags);
+}
+
+/*
+ * Make sure the bitmap of row `row` of the lookup table, and every
+ * bitmap it is XOR'ed against, is loaded into `index->bitmaps`.
+ */
+static struct stored_bitmap *lazy_bitmap_for_row(struct bitmap_index *index,
+						 uint32_t row)
+{
+	struct stored_bitmap *xor_bitmap = NULL;
+	uint32_t *chain = NULL;
+	size_t chain_nr = 0, chain_alloc = 0;
+
+	/*
+	 * Walk the XOR chain until we reach its end or a bitmap that has
+	 * already been loaded, then load the missing ones base first.
+	 */
+	for (;;) {
+		const unsigned char *triplet;
+		const unsigned char *sha1;
+		khiter_t hash_pos;
+
+		if (row >= index->entry_count || chain_nr >= index->entry_count) {
+			error("Corrupted bitmap lookup table (bad XOR row)");
+			goto out;
+		}
+
+		triplet = bitmap_table_triplet(index, row);
+		sha1 = nth_packed_object_sha1(index->pack, get_be32(triplet));
+		if (!sha1) {
+			error("Corrupted bitmap lookup table (bad commit position)");
+			goto out;
+		}
+
+		hash_pos = kh_get_sha1(index->bitmaps, sha1);
+		if (hash_pos < kh_end(index->bitmaps)) {
+			xor_bitmap = kh_value(index->bitmaps, hash_pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+
+		row = get_be32(triplet + 12);
+		if (row == BITMAP_NO_XOR_ROW)
+			break;
+	}
+
+	while (chain_nr) {
+		xor_bitmap = load_bitmap_table_row(index, chain[--chain_nr],
+						   xor_bitmap);
+		if (!xor_bitmap)
+			break;
+	}
+
+out:
+	free(chain);
+	return chain_nr ? NULL : xor_bitmap;
+}
+
+static int load_all_bitmap_table_rows(struct bitmap_index *index)
+{
+	uint32_t i;
+
+	for (i = 0; i < index->entry_count; i++)
+		if (!lazy_bitmap_for_row(index, i))
+			return -1;
+	return 0;
+}
+
+/*
+ * Return the bitmap stored for the commit `sha1`, loading it from the
+ * lookup table if needed, or NULL if there is none.
+ */
+static struct ewah_bitmap *bitmap_for_commit(const unsigned char *sha1)
+{
+	khiter_t hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+	struct stored_bitmap *st = NULL;
+	uint32_t row;
+
+	if (hash_pos < kh_end(bitmap_git.bitmaps))
+		st = kh_value(bitmap_git.bitmaps, hash_pos);
+	else if (bitmap_git.table_lookup &&
+		 bitmap_table_find(&bitmap_git, sha1, &row) > 0)
+		st = lazy_bitmap_for_row(&bitmap_git, row);
+
+	return st ? lookup_stored_bitmap(st) : NULL;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	size_t len;
@@ -306,7 +488,8 @@ static int load_pack_bitmap(void)
 
 	bitmap_git.bitmaps = kh_init_sha1();
 	bitmap_git.ext_index.positions = kh_init_sha1_pos();
-	load_pack_revindex(bitmap_git.pack);
+	if (load_pack_revindex(bitmap_git.pack))
+		goto failed;
 
 	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
 		!(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
@@ -314,7 +497,8 @@ static int load_pack_bitmap(void)
 		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+	if (!bitmap_git.table_lookup &&
+	    load_bitmap_entries_v1(&bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git.loaded = 1;
@@ -354,6 +538,26 @@ int prepare_bitmap_git(void)
 	return -1;
 }
 
+int bitmap_add_reachable(struct bitmap *reachable, const struct object_id *oid)
+{
+	struct ewah_bitmap *or_with = bitmap_for_commit(oid->hash);
+
+	if (!or_with)
+		return 0;
+	bitmap_or_ewah(reachable, or_with);
+	return 1;
+}
+
+int bitmap_is_reachable(struct bitmap *reachable, const struct object_id *oid)
+{
+	off_t offset = find_pack_entry_one(oid->hash, bitmap_git.pack);
+	uint32_t pos;
+
+	if (!offset || offset_to_pack_pos(bitmap_git.pack, offset, &pos) < 0)
+		return 0;
+	return bitmap_get(reachable, pos);
+}
+
 struct include_data {
 	struct bitmap *base;
 	struct bitmap *seen;
@@ -375,10 +579,13 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 static inline int bitmap_position_packfile(const unsigned char *sha1)
 {
 	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
+	uint32_t pos;
+
 	if (!offset)
 		return -1;
-
-	return find_revindex_position(bitmap_git.pack, offset);
+	if (offset_to_pack_pos(bitmap_git.pack, offset, &pos) < 0)
+		return -1;
+	return pos;
 }
 
 static int bitmap_position(const unsigned char *sha1)
@@ -436,7 +643,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct ewah_bitmap *stored;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -444,10 +651,9 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
-		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
+	stored = bitmap_for_commit(sha1);
+	if (stored) {
+		bitmap_or_ewah(data->base, stored);
 		return 0;
 	}
 
@@ -500,12 +706,9 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->oid.hash);
-
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
-				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
+			struct ewah_bitmap *or_with = bitmap_for_commit(object->oid.hash);
 
+			if (or_with) {
 				if (base == NULL)
 					base = ewah_to_bitmap(or_with);
 				else
@@ -603,9 +806,6 @@ static void show_objects_for_type(
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
@@ -613,24 +813,22 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
 			struct object_id oid;
-			struct revindex_entry *entry;
-			uint32_t hash = 0;
+			uint32_t hash = 0, index_pos;
+			off_t ofs;
 
 			if ((word >> offset) == 0)
 				break;
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git.reuse_objects)
-				continue;
-
-			entry = &bitmap_git.pack->revindex[pos + offset];
-			nth_packed_object_oid(&oid, bitmap_git.pack, entry->nr);
+			index_pos = pack_pos_to_index(bitmap_git.pack, pos + offset);
+			ofs = pack_pos_to_offset(bitmap_git.pack, pos + offset);
+			nth_packed_object_oid(&oid, bitmap_git.pack, index_pos);
 
 			if (bitmap_git.hashes)
-				hash = get_be32(bitmap_git.hashes + entry->nr);
+				hash = get_be32(bitmap_git.hashes + index_pos);
 
-			show_reach(&oid, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(&oid, object_type, 0, hash, bitmap_git.pack, ofs);
 		}
 
 		pos += BITS_IN_EWORD;
@@ -739,64 +937,124 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	return 0;
 }
 
-int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
-				       uint32_t *entries,
-				       off_t *up_to)
+static void try_partial_reuse(uint32_t pos, struct bitmap *reuse,
+			      struct pack_window **w_curs)
 {
+	struct packed_git *pack = bitmap_git.pack;
+	off_t offset, header;
+	enum object_type type;
+	unsigned long size;
+
+	if (pos >= pack->num_objects)
+		return; /* not actually in the pack */
+
+	offset = header = pack_pos_to_offset(pack, pos);
+	type = unpack_object_header(pack, w_curs, &offset, &size);
+	if (type < 0)
+		return; /* broken packfile, punt */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		uint32_t base_pos;
+
+		/*
+		 * Find the position of the base object so we can look it up
+		 * in our bitmaps. If we can't come up with an offset, or if
+		 * that offset is not in the revindex, the pack is corrupt.
+		 * There's nothing we can do, so just punt on this object,
+		 * and the normal slow path will complain about it in
+		 * more detail.
+		 */
+		base_offset = get_delta_base(pack, w_curs, &offset, type, header);
+		if (!base_offset)
+			return;
+		if (offset_to_pack_pos(pack, base_offset, &base_pos) < 0)
+			return;
+
+		/*
+		 * We assume delta dependencies always point backwards. This
+		 * lets us do a single pass, and is basically always true
+		 * due to the way OFS_DELTAs work. You would not typically
+		 * find REF_DELTA in a bitmapped pack, since we only bitmap
+		 * packs we write fresh, and OFS_DELTA is the default). But
+		 * let's double check to make sure the pack wasn't written with
+		 * odd parameters.
+		 */
+		if (base_pos >= pos)
+			return;
+
+		/*
+		 * And finally, if we're not sending the base as part of our
+		 * reuse chunk, then don't send this object either. The base
+		 * would come after us, along with other objects not
+		 * necessarily in the pack, which means we'd need to convert
+		 * to REF_DELTA on the fly. Better to just let the normal
+		 * object_entry code path handle it.
+		 */
+		if (!bitmap_get(reuse, base_pos))
+			return;
+	}
+
 	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
+	 * If we got here, then the object is OK to reuse. Mark it.
 	 */
-	static const double REUSE_PERCENT = 0.9;
+	bitmap_set(reuse, pos);
+}
 
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out)
+{
 	struct bitmap *result = bitmap_git.result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	struct bitmap *reuse;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t offset;
 
 	assert(result);
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
-
-		reuse_objects += BITS_IN_EWORD;
-	}
+	/*
+	 * A run of full words at the start of the pack can be sent as a
+	 * single chunk: every delta in it has its base in it as well.
+	 */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	/* Don't mark objects not in the packfile */
+	if (i > bitmap_git.pack->num_objects / BITS_IN_EWORD)
+		i = bitmap_git.pack->num_objects / BITS_IN_EWORD;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+	reuse = bitmap_word_alloc(i);
+	memset(reuse->words, 0xFF, i * sizeof(eword_t));
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
-	}
-#endif
+	for (; i < result->word_alloc; ++i) {
+		eword_t word = result->words[i];
+		size_t pos = (i * BITS_IN_EWORD);
 
-	if (!reuse_objects)
-		return -1;
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
 
-	if (reuse_objects >= bitmap_git.pack->num_objects) {
-		bitmap_git.reuse_objects = *entries = bitmap_git.pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git.pack;
-		return 0;
+			offset += ewah_bit_ctz64(word >> offset);
+			try_partial_reuse(pos + offset, reuse, &w_curs);
+		}
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git.result) * REUSE_PERCENT;
+	unuse_pack(&w_curs);
 
-	if (reuse_objects < reuse_threshold)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
 		return -1;
+	}
 
-	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.pack->revindex[reuse_objects].offset;
+	/*
+	 * Drop any reused objects from the result, since they will not
+	 * need to be handled separately.
+	 */
+	bitmap_and_not(result, reuse);
 	*packfile = bitmap_git.pack;
-
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -918,7 +1176,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct ewah_bitmap *bm;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -932,12 +1190,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->oid.hash);
-
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
-		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
+	bm = bitmap_for_commit(root->oid.hash);
 
+	if (bm) {
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
 			oid_to_hex(&root->oid), (int)bm->bit_size, ewah_checksum(bm));
 
@@ -1019,20 +1274,23 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	if (prepare_bitmap_git() < 0)
 		return -1;
 
+	if (bitmap_git.table_lookup &&
+	    load_all_bitmap_table_rows(&bitmap_git) < 0)
+		return -1;
+
 	num_objects = bitmap_git.pack->num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git.pack->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+				pack_pos_to_index(bitmap_git.pack, i));
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
-			reposition[i] = oe->in_pack_pos + 1;
+			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
 	}
 
 	rebuild = bitmap_new();
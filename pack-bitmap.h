@@ -20,8 +20,17 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 16,
 };
 
+/*
+ * Each row of the optional commit lookup table holds the index position
+ * of a bitmapped commit, the offset of its entry in the .bitmap file and
+ * the row of the bitmap it is XOR'ed against (or BITMAP_NO_XOR_ROW).
+ */
+#define BITMAP_LOOKUP_TABLE_TRIPLET_WIDTH (4 + 8 + 4)
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -35,16 +44,31 @@ typedef int (*show_reachable_fn)(
 	off_t found_offset);
 
 int prepare_bitmap_git(void);
+
+/*
+ * Every object reachable from a bitmapped commit is in the bitmapped
+ * pack, along with everything it reaches. After prepare_bitmap_git(),
+ * bitmap_add_reachable() adds those objects for the commit "oid" to
+ * "reachable" and returns 1, or returns 0 if "oid" has no bitmap.
+ * bitmap_is_reachable() tells whether "oid" is in "reachable".
+ */
+int bitmap_add_reachable(struct bitmap *reachable, const struct object_id *oid);
+int bitmap_is_reachable(struct bitmap *reachable, const struct object_id *oid);
+
 void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees, uint32_t *blobs, uint32_t *tags);
 void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
 int prepare_bitmap_walk(struct rev_info *revs);
-int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
 void bitmap_writer_show_progress(int show);
 void bitmap_writer_set_checksum(unsigned char *sha1);
-void bitmap_writer_build_type_index(struct pack_idx_entry **index, uint32_t index_nr);
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
+				    uint32_t index_nr);
 void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
@@ -3,6 +3,7 @@
 #include "pack-revindex.h"
 #include "progress.h"
 #include "packfile.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -46,10 +47,183 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * Check the i-th object of "entries" (sorted by offset) and hand it to
+ * "fn". Called with pack_read_lock() held; the lock is dropped while
+ * the object is hashed.
+ */
+static int verify_entry(struct packed_git *p, struct pack_window **w_curs,
+			struct idx_entry *entries, uint32_t i, verify_fn fn)
+{
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	off_t curpos;
+	int data_valid;
+	int is_delta, idx_is_delta;
+	enum object_type idx_type;
+	unsigned long idx_size;
+	int err = 0;
+
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    oid_to_hex(entries[i].oid.oid),
+				    p->pack_name, (uintmax_t)offset);
+	}
+
+	curpos = entries[i].offset;
+	type = unpack_object_header(p, w_curs, &curpos, &size);
+	unuse_pack(w_curs);
+	is_delta = (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA);
+
+	if (type == OBJ_BLOB && big_file_threshold <= size) {
+		/*
+		 * Let check_sha1_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		data = NULL;
+		data_valid = 0;
+	} else {
+		data = unpack_entry(p, entries[i].offset, &type, &size);
+		data_valid = 1;
+	}
+
+	if (data_valid && !data)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    oid_to_hex(entries[i].oid.oid), p->pack_name,
+			    (uintmax_t)entries[i].offset);
+	else {
+		int bad;
+
+		/* the streaming check reads from the pack as it goes */
+		if (data)
+			pack_read_unlock();
+		bad = check_sha1_signature(entries[i].oid.hash, data, size,
+					   typename(type));
+		if (data)
+			pack_read_lock();
+
+		if (bad)
+			err = error("packed %s from %s is corrupt",
+				    oid_to_hex(entries[i].oid.oid), p->pack_name);
+		else if (!packed_object_info_from_index(p, entries[i].nr,
+							&idx_type, &idx_size,
+							&idx_is_delta) &&
+			 (idx_type != type || idx_size != size ||
+			  idx_is_delta != is_delta))
+			err = error("index type and size of %s from %s do not match the pack",
+				    oid_to_hex(entries[i].oid.oid), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			err |= fn(entries[i].oid.oid, type, size, data, &eaten);
+			if (eaten)
+				data = NULL;
+		}
+	}
+	free(data);
+	return err;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * Each thread takes this many consecutive entries at a time, so that it
+ * reads its part of the pack in order and finds recent delta bases in
+ * the cache.
+ */
+#define VERIFY_BATCH 256
+
+struct verify_state {
+	struct packed_git *p;
+	struct idx_entry *entries;
+	uint32_t nr_objects;
+	verify_fn fn;
+	struct progress *progress;
+	uint32_t base_count;
+
+	/* protected by pack_read_lock() */
+	uint32_t next;
+	uint32_t done;
+	int err;
+};
+
+static void *verify_entries_thread(void *arg)
+{
+	struct verify_state *state = arg;
+	struct pack_window *w_curs = NULL;
+
+	pack_read_lock();
+	while (state->next < state->nr_objects) {
+		uint32_t start = state->next, end, i;
+
+		end = state->nr_objects - start < VERIFY_BATCH ?
+			state->nr_objects : start + VERIFY_BATCH;
+		state->next = end;
+		for (i = start; i < end; i++)
+			state->err |= verify_entry(state->p, &w_curs,
+						   state->entries, i, state->fn);
+		unuse_pack(&w_curs);
+		state->done += end - start;
+		display_progress(state->progress,
+				 state->base_count + state->done);
+	}
+	pack_read_unlock();
+	return NULL;
+}
+
+/*
+ * Verify the entries in "nr_threads" threads. Reading from the pack,
+ * calling "fn" and updating the progress all happen under
+ * pack_read_lock(); inflating, applying deltas and hashing do not, nor
+ * does whatever "fn" chooses to do unlocked.
+ */
+static int verify_entries_threaded(struct packed_git *p,
+				   struct idx_entry *entries,
+				   uint32_t nr_objects, verify_fn fn,
+				   struct progress *progress,
+				   uint32_t base_count, int nr_threads)
+{
+	struct verify_state state;
+	pthread_t *threads;
+	int i, ret;
+
+	memset(&state, 0, sizeof(state));
+	state.p = p;
+	state.entries = entries;
+	state.nr_objects = nr_objects;
+	state.fn = fn;
+	state.progress = progress;
+	state.base_count = base_count;
+
+	enable_pack_read_lock();
+	ALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ret = pthread_create(&threads[i], NULL,
+				     verify_entries_thread, &state);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_pack_read_lock();
+
+	return state.err;
+}
+
+#endif
+
 static int verify_packfile(struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
@@ -102,58 +276,20 @@ static int verify_packfile(struct packed_git *p,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(entries[i].oid.oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
-
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let check_sha1_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		err |= verify_entries_threaded(p, entries, nr_objects, fn,
+					       progress, base_count,
+					       nr_threads);
+		free(entries);
+		return err;
+	}
+#endif
 
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(entries[i].oid.oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_sha1_signature(entries[i].oid.hash, data, size, typename(type)))
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(entries[i].oid.oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(entries[i].oid.oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
+	for (i = 0; i < nr_objects; i++) {
+		err |= verify_entry(p, w_curs, entries, i, fn);
 		if (((base_count + i) & 1023) == 0)
 			display_progress(progress, base_count + i);
-		free(data);
-
 	}
 	display_progress(progress, base_count + i);
 	free(entries);
@@ -185,7 +321,8 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count,
+		int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -194,7 +331,8 @@ int verify_pack(struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
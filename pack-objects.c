@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "object.h"
 #include "pack.h"
+#include "packfile.h"
 #include "pack-objects.h"
 
 static uint32_t locate_object_entry_hash(struct packing_data *pdata,
@@ -95,6 +96,13 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->nr_objects >= pdata->nr_alloc) {
 		pdata->nr_alloc = (pdata->nr_alloc  + 1024) * 3 / 2;
 		REALLOC_ARRAY(pdata->objects, pdata->nr_alloc);
+
+		if (!pdata->in_pack_by_idx)
+			REALLOC_ARRAY(pdata->in_pack, pdata->nr_alloc);
+		if (pdata->in_pack_pos)
+			REALLOC_ARRAY(pdata->in_pack_pos, pdata->nr_alloc);
+		if (pdata->tree_depth)
+			REALLOC_ARRAY(pdata->tree_depth, pdata->nr_alloc);
 	}
 
 	new_entry = pdata->objects + pdata->nr_objects++;
@@ -102,6 +110,11 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	memset(new_entry, 0, sizeof(*new_entry));
 	hashcpy(new_entry->idx.oid.hash, sha1);
 
+	if (!pdata->in_pack_by_idx)
+		pdata->in_pack[pdata->nr_objects - 1] = NULL;
+	if (pdata->tree_depth)
+		pdata->tree_depth[pdata->nr_objects - 1] = 0;
+
 	if (pdata->index_size * 3 <= pdata->nr_objects * 4)
 		rehash_objects(pdata);
 	else
@@ -109,3 +122,130 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 	return new_entry;
 }
+
+static void prepare_in_pack_by_idx(struct packing_data *pdata)
+{
+	struct packed_git **mapping, *p;
+	int cnt = 0, nr = 1U << OE_IN_PACK_BITS;
+
+	mapping = xcalloc(nr, sizeof(*mapping));
+	/*
+	 * oe_in_pack() on an all-zero'd object_entry (i.e. in_pack_idx
+	 * also zero) should return NULL.
+	 */
+	mapping[cnt++] = NULL;
+	for (p = packed_git; p; p = p->next, cnt++) {
+		if (cnt == nr) {
+			free(mapping);
+			return;
+		}
+		p->index = cnt;
+		mapping[cnt] = p;
+	}
+	pdata->in_pack_by_idx = mapping;
+}
+
+/*
+ * A new pack appeared after prepare_in_pack_by_idx() has been set up
+ * (e.g. it was added by another process while we were running). Give
+ * it an index if there is room left, otherwise switch everybody over
+ * to the per-object "in_pack" array.
+ */
+void oe_map_new_pack(struct packing_data *pack, struct packed_git *p)
+{
+	uint32_t i, nr = 1;
+
+	while (nr < (1U << OE_IN_PACK_BITS) && pack->in_pack_by_idx[nr])
+		nr++;
+	if (nr < (1U << OE_IN_PACK_BITS)) {
+		p->index = nr;
+		pack->in_pack_by_idx[nr] = p;
+		return;
+	}
+
+	ALLOC_ARRAY(pack->in_pack, pack->nr_alloc);
+	for (i = 0; i < pack->nr_objects; i++)
+		pack->in_pack[i] = oe_in_pack(pack, pack->objects + i);
+
+	FREE_AND_NULL(pack->in_pack_by_idx);
+}
+
+void prepare_packing_data(struct packing_data *pdata)
+{
+	prepare_packed_git();
+	prepare_in_pack_by_idx(pdata);
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&pdata->large_size_lock, NULL);
+#endif
+}
+
+static inline void large_size_lock(struct packing_data *pdata)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&pdata->large_size_lock);
+#endif
+}
+
+static inline void large_size_unlock(struct packing_data *pdata)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&pdata->large_size_lock);
+#endif
+}
+
+unsigned long oe_get_large_size(struct packing_data *pack,
+				const struct object_entry *e, int delta)
+{
+	kh_oe_size_t *map;
+	unsigned long size = 0;
+	khiter_t pos;
+
+	large_size_lock(pack);
+	map = delta ? pack->large_delta_size : pack->large_size;
+	if (map) {
+		pos = kh_get_oe_size(map, e - pack->objects);
+		if (pos != kh_end(map))
+			size = kh_value(map, pos);
+	}
+	large_size_unlock(pack);
+	return size;
+}
+
+void oe_set_large_size(struct packing_data *pack,
+		       const struct object_entry *e, int delta,
+		       unsigned long size)
+{
+	kh_oe_size_t **map;
+	khiter_t pos;
+	int hash_ret;
+
+	large_size_lock(pack);
+	map = delta ? &pack->large_delta_size : &pack->large_size;
+	if (!*map)
+		*map = kh_init_oe_size();
+	pos = kh_put_oe_size(*map, e - pack->objects, &hash_ret);
+	kh_value(*map, pos) = size;
+	large_size_unlock(pack);
+}
+
+size_t packing_data_footprint(const struct packing_data *pdata)
+{
+	size_t total = st_mult(pdata->nr_alloc, sizeof(*pdata->objects));
+
+	total += st_mult(pdata->index_size, sizeof(*pdata->index));
+	if (pdata->in_pack_by_idx)
+		total += sizeof(*pdata->in_pack_by_idx) << OE_IN_PACK_BITS;
+	if (pdata->in_pack)
+		total += st_mult(pdata->nr_alloc, sizeof(*pdata->in_pack));
+	if (pdata->in_pack_pos)
+		total += st_mult(pdata->nr_alloc, sizeof(*pdata->in_pack_pos));
+	if (pdata->tree_depth)
+		total += st_mult(pdata->nr_alloc, sizeof(*pdata->tree_depth));
+	if (pdata->large_size)
+		total += kh_n_buckets(pdata->large_size) *
+			(sizeof(uint32_t) + sizeof(unsigned long));
+	if (pdata->large_delta_size)
+		total += kh_n_buckets(pdata->large_delta_size) *
+			(sizeof(uint32_t) + sizeof(unsigned long));
+	return total;
+}
@@ -1,45 +1,92 @@
 #ifndef PACK_OBJECTS_H
 #define PACK_OBJECTS_H
 
+#include "khash.h"
+#include "thread-utils.h"
+
+#define OE_DFS_STATE_BITS	2
+#define OE_DEPTH_BITS		12
+#define OE_IN_PACK_BITS		10
+#define OE_Z_DELTA_BITS		20
+/*
+ * These are not the upper limits on the size of an object or of a
+ * delta; bigger values are kept out of line, see oe_set_size().
+ */
+#define OE_SIZE_BITS		31
+#define OE_DELTA_SIZE_BITS	23
+
+#define oe_size_hash(key) (khint32_t)(key)
+#define oe_size_equal(a, b) ((a) == (b))
+KHASH_INIT(oe_size, uint32_t, unsigned long, 1, oe_size_hash, oe_size_equal)
+
+/*
+ * State flags for depth-first search used for analyzing delta cycles.
+ *
+ * The depth is measured in delta-links to the base (so if A is a delta
+ * against B, then A has a depth of 1, and B a depth of 0).
+ */
+enum dfs_state {
+	DFS_NONE = 0,
+	DFS_ACTIVE,
+	DFS_DONE,
+	DFS_NUM_STATES
+};
+
+/*
+ * One entry per object considered by pack-objects; a repository with
+ * tens of millions of objects keeps as many of these in memory, so
+ * the layout is kept tight:
+ *
+ * - the delta, delta_child and delta_sibling links are 1-based indexes
+ *   into packing_data->objects (0 means NULL), see oe_delta() and
+ *   friends;
+ *
+ * - the pack an object is found in is an index into
+ *   packing_data->in_pack_by_idx, see oe_in_pack();
+ *
+ * - "size" and "delta_size" only hold values that fit in their bit
+ *   fields; larger ones are stored out of line in packing_data, see
+ *   oe_size() and oe_delta_size();
+ *
+ * - "z_delta_size" is only set when the compressed delta is cached,
+ *   which never happens for deltas that large;
+ *
+ * - "depth" is capped at (1 << OE_DEPTH_BITS) - 1, the maximum value of
+ *   --depth.
+ *
+ * Always go through the oe_* accessors below for these fields.
+ */
 struct object_entry {
 	struct pack_idx_entry idx;
-	unsigned long size;	/* uncompressed size */
-	struct packed_git *in_pack;	/* already in pack */
-	off_t in_pack_offset;
-	struct object_entry *delta;	/* delta base object */
-	struct object_entry *delta_child; /* deltified objects who bases me */
-	struct object_entry *delta_sibling; /* other deltified objects who
-					     * uses the same base as me
-					     */
 	void *delta_data;	/* cached delta (uncompressed) */
-	unsigned long delta_size;	/* delta data size (uncompressed) */
-	unsigned long z_delta_size;	/* delta data size (compressed) */
-	enum object_type type;
-	enum object_type in_pack_type;	/* could be delta */
+	off_t in_pack_offset;
 	uint32_t hash;			/* name hint hash */
-	unsigned int in_pack_pos;
-	unsigned char in_pack_header_size;
+	unsigned size_:OE_SIZE_BITS;	/* uncompressed size */
+	unsigned size_valid:1;
+	uint32_t delta_idx;	/* delta base object */
+	uint32_t delta_child_idx; /* deltified objects who bases me */
+	uint32_t delta_sibling_idx; /* other deltified objects who
+				     * uses the same base as me
+				     */
+	unsigned delta_size_:OE_DELTA_SIZE_BITS; /* delta data size (uncompressed) */
+	unsigned delta_size_valid:1;
+	unsigned type_valid:1;
+	unsigned type_:TYPE_BITS;
+	unsigned in_pack_type:TYPE_BITS; /* could be delta */
 	unsigned preferred_base:1; /*
 				    * we do not pack this, but is available
 				    * to be used as the base object to delta
 				    * objects against.
 				    */
+	unsigned in_pack_idx:OE_IN_PACK_BITS;	/* already in pack */
+	unsigned z_delta_size:OE_Z_DELTA_BITS;	/* delta data size (compressed) */
 	unsigned no_try_delta:1;
 	unsigned tagged:1; /* near the very tip of refs */
 	unsigned filled:1; /* assigned write-order */
-
-	/*
-	 * State flags for depth-first search used for analyzing delta cycles.
-	 *
-	 * The depth is measured in delta-links to the base (so if A is a delta
-	 * against B, then A has a depth of 1, and B a depth of 0).
-	 */
-	enum {
-		DFS_NONE = 0,
-		DFS_ACTIVE,
-		DFS_DONE
-	} dfs_state;
-	int depth;
+	unsigned dfs_state:OE_DFS_STATE_BITS;
+	unsigned depth:OE_DEPTH_BITS;
+	unsigned as_delta:1; /* written to the pack as a delta */
+	unsigned char in_pack_header_size;
 };
 
 struct packing_data {
@@ -48,8 +95,41 @@ struct packing_data {
 
 	int32_t *index;
 	uint32_t index_size;
+
+	/*
+	 * Packs that objects may come from, indexed by
+	 * object_entry->in_pack_idx. When there are more packs than
+	 * in_pack_idx can address, this is NULL and "in_pack" holds the
+	 * pack of each object instead, parallel to `objects`.
+	 */
+	struct packed_git **in_pack_by_idx;
+	struct packed_git **in_pack;
+
+	/*
+	 * Sizes too large for object_entry->size_ and ->delta_size_,
+	 * keyed by the position of the entry in `objects`.
+	 */
+	kh_oe_size_t *large_size;
+	kh_oe_size_t *large_delta_size;
+#ifndef NO_PTHREADS
+	pthread_mutex_t large_size_lock;
+#endif
+
+	/*
+	 * Position of each object in its pack, parallel to `objects`;
+	 * only allocated when writing bitmaps.
+	 */
+	uint32_t *in_pack_pos;
+
+	/*
+	 * Depth of each tree in the walk, parallel to `objects`; only
+	 * allocated when delta islands are in use.
+	 */
+	unsigned int *tree_depth;
 };
 
+void prepare_packing_data(struct packing_data *pdata);
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const unsigned char *sha1,
 				    uint32_t index_pos);
@@ -58,6 +138,199 @@ struct object_entry *packlist_find(struct packing_data *pdata,
 				   const unsigned char *sha1,
 				   uint32_t *index_pos);
 
+/*
+ * Number of bytes used by the object entries of "pdata" and the
+ * side tables that go with them.
+ */
+size_t packing_data_footprint(const struct packing_data *pdata);
+
+static inline enum object_type oe_type(const struct object_entry *e)
+{
+	return e->type_valid ? e->type_ : OBJ_BAD;
+}
+
+static inline void oe_set_type(struct object_entry *e,
+			       enum object_type type)
+{
+	if (type >= OBJ_ANY)
+		die("BUG: OBJ_ANY cannot be set in pack-objects code");
+
+	e->type_valid = type >= OBJ_NONE;
+	e->type_ = (unsigned)type;
+}
+
+static inline struct object_entry *oe_delta(const struct packing_data *pack,
+					    const struct object_entry *e)
+{
+	if (e->delta_idx)
+		return &pack->objects[e->delta_idx - 1];
+	return NULL;
+}
+
+static inline void oe_set_delta(const struct packing_data *pack,
+				struct object_entry *e,
+				struct object_entry *delta)
+{
+	if (delta)
+		e->delta_idx = (delta - pack->objects) + 1;
+	else
+		e->delta_idx = 0;
+}
+
+static inline struct object_entry *oe_delta_child(const struct packing_data *pack,
+						  const struct object_entry *e)
+{
+	if (e->delta_child_idx)
+		return &pack->objects[e->delta_child_idx - 1];
+	return NULL;
+}
+
+static inline void oe_set_delta_child(const struct packing_data *pack,
+				      struct object_entry *e,
+				      struct object_entry *delta)
+{
+	if (delta)
+		e->delta_child_idx = (delta - pack->objects) + 1;
+	else
+		e->delta_child_idx = 0;
+}
+
+static inline struct object_entry *oe_delta_sibling(const struct packing_data *pack,
+						    const struct object_entry *e)
+{
+	if (e->delta_sibling_idx)
+		return &pack->objects[e->delta_sibling_idx - 1];
+	return NULL;
+}
+
+static inline void oe_set_delta_sibling(const struct packing_data *pack,
+					struct object_entry *e,
+					struct object_entry *delta)
+{
+	if (delta)
+		e->delta_sibling_idx = (delta - pack->objects) + 1;
+	else
+		e->delta_sibling_idx = 0;
+}
+
+static inline struct packed_git *oe_in_pack(const struct packing_data *pack,
+					    const struct object_entry *e)
+{
+	if (pack->in_pack_by_idx)
+		return pack->in_pack_by_idx[e->in_pack_idx];
+	else
+		return pack->in_pack[e - pack->objects];
+}
+
+void oe_map_new_pack(struct packing_data *pack, struct packed_git *p);
+
+static inline void oe_set_in_pack(struct packing_data *pack,
+				  struct object_entry *e,
+				  struct packed_git *p)
+{
+	if (pack->in_pack_by_idx) {
+		if (p->index) {
+			e->in_pack_idx = p->index;
+			return;
+		}
+		/*
+		 * A pack that appeared after prepare_packing_data(); give
+		 * it an index, or fall back to the "in_pack" array.
+		 */
+		oe_map_new_pack(pack, p);
+		if (pack->in_pack_by_idx) {
+			e->in_pack_idx = p->index;
+			return;
+		}
+	}
+	pack->in_pack[e - pack->objects] = p;
+}
+
+unsigned long oe_get_large_size(struct packing_data *pack,
+				const struct object_entry *e, int delta);
+void oe_set_large_size(struct packing_data *pack,
+		       const struct object_entry *e, int delta,
+		       unsigned long size);
+
+static inline unsigned long oe_size(struct packing_data *pack,
+				    const struct object_entry *e)
+{
+	if (e->size_valid)
+		return e->size_;
+	return oe_get_large_size(pack, e, 0);
+}
+
+/*
+ * Setting or reading a size that does not fit in the entry takes a
+ * lock, so this is safe to call from several threads as long as each
+ * works on its own entries.
+ */
+static inline void oe_set_size(struct packing_data *pack,
+			       struct object_entry *e,
+			       unsigned long size)
+{
+	if (size < (1UL << OE_SIZE_BITS)) {
+		e->size_ = size;
+		e->size_valid = 1;
+	} else {
+		e->size_valid = 0;
+		oe_set_large_size(pack, e, 0, size);
+	}
+}
+
+static inline unsigned long oe_delta_size(struct packing_data *pack,
+					  const struct object_entry *e)
+{
+	if (e->delta_size_valid)
+		return e->delta_size_;
+	return oe_get_large_size(pack, e, 1);
+}
+
+static inline void oe_set_delta_size(struct packing_data *pack,
+				     struct object_entry *e,
+				     unsigned long size)
+{
+	if (size < (1UL << OE_DELTA_SIZE_BITS)) {
+		e->delta_size_ = size;
+		e->delta_size_valid = 1;
+	} else {
+		e->delta_size_valid = 0;
+		oe_set_large_size(pack, e, 1, size);
+	}
+}
+
+static inline uint32_t oe_in_pack_pos(const struct packing_data *pack,
+				      const struct object_entry *e)
+{
+	return pack->in_pack_pos[e - pack->objects];
+}
+
+static inline void oe_set_in_pack_pos(struct packing_data *pack,
+				      const struct object_entry *e,
+				      uint32_t pos)
+{
+	if (!pack->in_pack_pos)
+		ALLOC_ARRAY(pack->in_pack_pos, pack->nr_alloc);
+	pack->in_pack_pos[e - pack->objects] = pos;
+}
+
+static inline unsigned int oe_tree_depth(struct packing_data *pack,
+					 struct object_entry *e)
+{
+	if (!pack->tree_depth)
+		return 0;
+	return pack->tree_depth[e - pack->objects];
+}
+
+static inline void oe_set_tree_depth(struct packing_data *pack,
+				     struct object_entry *e,
+				     unsigned int tree_depth)
+{
+	if (!pack->tree_depth)
+		pack->tree_depth = xcalloc(pack->nr_alloc, sizeof(*pack->tree_depth));
+	pack->tree_depth[e - pack->objects] = tree_depth;
+}
+
 static inline uint32_t pack_name_hash(const char *name)
 {
 	uint32_t c, hash = 0;
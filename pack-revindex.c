@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "pack-revindex.h"
+#include "packfile.h"
 
 /*
  * Pack index for existing packs give us easy access to the offsets into
@@ -13,6 +14,10 @@
  * ordered by offset, so if you know the offset of an object, next offset
  * is where its packed representation ends and the index_nr can be used to
  * get the object sha1 from the main index.
+ *
+ * When the pack has a ".rev" file next to its ".idx", the list of index
+ * positions in pack order is read from there instead, and the offsets
+ * are looked up in the main index; nothing needs to be sorted.
  */
 
 /*
@@ -157,23 +162,102 @@ static void create_pack_revindex(struct packed_git *p)
 	sort_revindex(p->revindex, num_ent, p->pack_size);
 }
 
-void load_pack_revindex(struct packed_git *p)
+static int load_pack_revindex_from_disk(struct packed_git *p)
 {
-	if (!p->revindex)
-		create_pack_revindex(p);
+	struct strbuf revindex_name = STRBUF_INIT;
+	const unsigned char *data;
+	void *map;
+	size_t len, revindex_size;
+	struct stat st;
+	int fd, ret = -1;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack name %s does not end in .pack", p->pack_name);
+	strbuf_add(&revindex_name, p->pack_name, len);
+	strbuf_addstr(&revindex_name, ".rev");
+
+	fd = git_open(revindex_name.buf);
+	if (fd < 0)
+		goto cleanup;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto cleanup;
+	}
+
+	revindex_size = xsize_t(st.st_size);
+	if (revindex_size != RIDX_MIN_SIZE + (size_t)p->num_objects * 4) {
+		close(fd);
+		error("reverse-index file %s has wrong size", revindex_name.buf);
+		goto cleanup;
+	}
+
+	map = xmmap(NULL, revindex_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != RIDX_SIGNATURE) {
+		error("reverse-index file %s has unknown signature", revindex_name.buf);
+		goto unmap;
+	}
+	if (get_be32(data + 4) != RIDX_VERSION) {
+		error("reverse-index file %s has unsupported version %"PRIu32,
+		      revindex_name.buf, get_be32(data + 4));
+		goto unmap;
+	}
+	if (get_be32(data + 8) != RIDX_HASH_VERSION) {
+		error("reverse-index file %s has unsupported hash id %"PRIu32,
+		      revindex_name.buf, get_be32(data + 8));
+		goto unmap;
+	}
+	/* the pack checksum is also the second-to-last hash in the .idx */
+	if (hashcmp(data + revindex_size - 40,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		error("reverse-index file %s does not match its pack",
+		      revindex_name.buf);
+		goto unmap;
+	}
+
+	p->revindex_map = map;
+	p->revindex_size = revindex_size;
+	p->revindex_data = (const uint32_t *)(data + RIDX_HEADER_SIZE);
+	ret = 0;
+	goto cleanup;
+
+unmap:
+	munmap(map, revindex_size);
+cleanup:
+	strbuf_release(&revindex_name);
+	return ret;
+}
+
+int load_pack_revindex(struct packed_git *p)
+{
+	if (p->revindex || p->revindex_data)
+		return 0;
+	if (open_pack_index(p))
+		return -1;
+	if (!load_pack_revindex_from_disk(p))
+		return 0;
+	create_pack_revindex(p);
+	return 0;
 }
 
-int find_revindex_position(struct packed_git *p, off_t ofs)
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
 {
-	int lo = 0;
-	int hi = p->num_objects + 1;
-	struct revindex_entry *revindex = p->revindex;
+	uint32_t lo = 0;
+	uint32_t hi = p->num_objects + 1;
+
+	if (load_pack_revindex(p))
+		return -1;
 
 	do {
-		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t got = pack_pos_to_offset(p, mi);
+
+		if (got == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < got)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -183,15 +267,28 @@ int find_revindex_position(struct packed_git *p, off_t ofs)
 	return -1;
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
 {
-	int pos;
+	if (!p->revindex && !p->revindex_data)
+		BUG("pack_pos_to_index: reverse index not yet loaded");
+	if (p->num_objects <= pos)
+		BUG("pack_pos_to_index: out-of-bounds object at %"PRIu32, pos);
 
-	load_pack_revindex(p);
-	pos = find_revindex_position(p, ofs);
+	if (p->revindex)
+		return p->revindex[pos].nr;
+	return get_be32(p->revindex_data + pos);
+}
 
-	if (pos < 0)
-		return NULL;
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (!p->revindex && !p->revindex_data)
+		BUG("pack_pos_to_offset: reverse index not yet loaded");
+	if (p->num_objects < pos)
+		BUG("pack_pos_to_offset: out-of-bounds object at %"PRIu32, pos);
 
-	return p->revindex + pos;
+	if (p->revindex)
+		return p->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, pack_pos_to_index(p, pos));
 }
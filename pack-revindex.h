@@ -1,6 +1,35 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/*
+ * A revindex lets us map between the three orders of the objects in a
+ * pack:
+ *
+ *  - index position: the order of the ".idx" file, sorted by name;
+ *  - pack position: the order in which they appear in the ".pack";
+ *  - offset: the byte offset of the object in the ".pack".
+ *
+ * Pack position "num_objects" is valid for pack_pos_to_offset() and
+ * yields the offset of the pack trailer, so that the on-disk size of
+ * the object at position "pos" is
+ * pack_pos_to_offset(p, pos + 1) - pack_pos_to_offset(p, pos).
+ *
+ * The ".rev" file stores the index positions in pack order:
+ *
+ *   4-byte signature "RIDX", 4-byte version (1), 4-byte hash id (1);
+ *   num_objects 4-byte index positions;
+ *   the 20-byte checksum of the pack, and of everything above.
+ *
+ * All numbers are in network byte order.
+ */
+
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HASH_VERSION 1
+
+#define RIDX_HEADER_SIZE 12
+#define RIDX_MIN_SIZE (RIDX_HEADER_SIZE + 2 * 20)
+
 struct packed_git;
 
 struct revindex_entry {
@@ -8,9 +37,25 @@ struct revindex_entry {
 	unsigned int nr;
 };
 
-void load_pack_revindex(struct packed_git *p);
-int find_revindex_position(struct packed_git *p, off_t ofs);
+/*
+ * Make the reverse index of "p" available, mapping its ".rev" file if
+ * there is one and computing it in memory otherwise. Returns 0 on
+ * success.
+ */
+int load_pack_revindex(struct packed_git *p);
+
+/*
+ * Store in "pos" the pack position of the object starting at "ofs".
+ * Returns 0 on success, or -1 (after printing an error) when no object
+ * starts there.
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * The two functions below require load_pack_revindex() to have been
+ * called on "p".
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 
 #endif
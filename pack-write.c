@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "dir.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -84,7 +85,12 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	}
 
 	/* if last object's offset is >= 2^31 we should use index V2 */
-	index_version = need_large_offset(last_obj_offset, opts) ? 2 : opts->version;
+	index_version = opts->version;
+	if (index_version < 2 && need_large_offset(last_obj_offset, opts))
+		index_version = 2;
+	/* ... and we cannot write V3 without knowing types and sizes */
+	if (index_version > 2 && !opts->object_info)
+		index_version = 2;
 
 	/* index versions 2 and above need a header */
 	if (index_version >= 2) {
@@ -169,12 +175,113 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 		}
 	}
 
+	if (index_version >= 3) {
+		/* write the type and size table */
+		list = sorted_by_sha;
+		for (i = 0; i < nr_objects; i++) {
+			struct pack_idx_entry *obj = *list++;
+			enum object_type type;
+			unsigned long size;
+			int is_delta;
+			uint64_t val;
+			uint32_t split[2];
+
+			opts->object_info(obj, &type, &size, &is_delta,
+					  opts->object_info_data);
+			if (type <= OBJ_NONE || type > OBJ_TAG)
+				die("BUG: bad type %d for %s in index v3",
+				    type, oid_to_hex(&obj->oid));
+			if ((uint64_t)size >> PACK_IDX_V3_SIZE_BITS)
+				die("object %s is too large for index v3",
+				    oid_to_hex(&obj->oid));
+			val = (uint64_t)size |
+			      ((uint64_t)type << PACK_IDX_V3_SIZE_BITS);
+			if (is_delta)
+				val |= PACK_IDX_V3_DELTA_BIT;
+			split[0] = htonl(val >> 32);
+			split[1] = htonl(val & 0xffffffff);
+			sha1write(f, split, 8);
+		}
+	}
+
 	sha1write(f, sha1, 20);
 	sha1close(f, NULL, ((opts->flags & WRITE_IDX_VERIFY)
 			    ? CSUM_CLOSE : CSUM_FSYNC));
 	return index_name;
 }
 
+struct pack_order_entry {
+	off_t offset;
+	uint32_t nr;
+};
+
+static int pack_order_cmp(const void *_a, const void *_b)
+{
+	const struct pack_order_entry *a = _a, *b = _b;
+
+	if (a->offset < b->offset)
+		return -1;
+	return a->offset > b->offset;
+}
+
+/*
+ * Write the ".rev" reverse index for a pack whose ".idx" was just
+ * written by write_idx_file(), i.e. "objects" must already be sorted by
+ * object name. "sha1" is the pack checksum. Returns the name of the
+ * file written, or NULL when WRITE_REV is not set (or, when verifying,
+ * there is no file to check against).
+ */
+const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects,
+			   uint32_t nr_objects, const struct pack_idx_option *opts,
+			   const unsigned char *sha1)
+{
+	struct sha1file *f;
+	struct pack_order_entry *pack_order;
+	uint32_t i;
+	int fd;
+
+	if (!(opts->flags & WRITE_REV))
+		return NULL;
+
+	if (opts->flags & WRITE_IDX_VERIFY) {
+		assert(rev_name);
+		if (!file_exists(rev_name))
+			return NULL;
+		f = sha1fd_check(rev_name);
+	} else {
+		if (!rev_name) {
+			struct strbuf tmp_file = STRBUF_INIT;
+			fd = odb_mkstemp(&tmp_file, "pack/tmp_rev_XXXXXX");
+			rev_name = strbuf_detach(&tmp_file, NULL);
+		} else {
+			unlink(rev_name);
+			fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+			if (fd < 0)
+				die_errno("unable to create '%s'", rev_name);
+		}
+		f = sha1fd(fd, rev_name);
+	}
+
+	ALLOC_ARRAY(pack_order, nr_objects);
+	for (i = 0; i < nr_objects; i++) {
+		pack_order[i].offset = objects[i]->offset;
+		pack_order[i].nr = i;
+	}
+	QSORT(pack_order, nr_objects, pack_order_cmp);
+
+	sha1write_be32(f, RIDX_SIGNATURE);
+	sha1write_be32(f, RIDX_VERSION);
+	sha1write_be32(f, RIDX_HASH_VERSION);
+	for (i = 0; i < nr_objects; i++)
+		sha1write_be32(f, pack_order[i].nr);
+	sha1write(f, sha1, 20);
+	free(pack_order);
+
+	sha1close(f, NULL, ((opts->flags & WRITE_IDX_VERIFY)
+			    ? CSUM_CLOSE : CSUM_FSYNC));
+	return rev_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -349,7 +456,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -360,6 +467,11 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+				      pack_idx_opts, sha1);
+	if (rev_tmp_name && adjust_shared_perm(rev_tmp_name))
+		die_errno("unable to make temporary reverse-index file readable");
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 
 	if (rename(pack_tmp_name, name_buffer->buf))
@@ -367,6 +479,15 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	/* the ".rev" goes in place before the ".idx" makes the pack visible */
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse-index file");
+
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
@@ -374,4 +495,5 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	strbuf_setlen(name_buffer, basename_len);
 
 	free((void *)idx_tmp_name);
+	free((void *)rev_tmp_name);
 }
@@ -35,11 +35,14 @@ struct pack_header {
  */
 #define PACK_IDX_SIGNATURE 0xff744f63	/* "\377tOc" */
 
+struct pack_idx_entry;
+
 struct pack_idx_option {
 	unsigned flags;
 	/* flag bits */
 #define WRITE_IDX_VERIFY 01 /* verify only, do not write the idx file */
 #define WRITE_IDX_STRICT 02
+#define WRITE_REV 04 /* also write a ".rev" reverse index */
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -51,10 +54,30 @@ struct pack_idx_option {
 	 */
 	int anomaly_alloc, anomaly_nr;
 	uint32_t *anomaly;
+
+	/*
+	 * Version 3 records the type and size of each object; this is
+	 * called to learn them (without it, version 2 is written
+	 * instead). It must return the final type and inflated size of
+	 * the object, and whether it is stored as a delta in the pack.
+	 */
+	void (*object_info)(const struct pack_idx_entry *obj,
+			    enum object_type *type, unsigned long *size,
+			    int *is_delta, void *data);
+	void *object_info_data;
 };
 
 extern void reset_pack_idx_option(struct pack_idx_option *);
 
+/*
+ * Each entry of the type and size table of a version 3 index holds,
+ * in network byte order, the inflated size of the object in the low
+ * 60 bits, its type in the next 3 bits, and in the top bit whether it
+ * is stored as a delta.
+ */
+#define PACK_IDX_V3_SIZE_BITS 60
+#define PACK_IDX_V3_DELTA_BIT ((uint64_t)1 << 63)
+
 /*
  * Packed object index header
  */
@@ -74,13 +97,19 @@ struct pack_idx_entry {
 
 
 struct progress;
-/* Note, the data argument could be NULL if object type is blob */
+/*
+ * Note, the data argument could be NULL if object type is blob.
+ * verify_pack() may check objects in several threads. It calls the
+ * function with pack_read_lock() held, which the function may drop
+ * while it does work that touches no shared state.
+ */
 typedef int (*verify_fn)(const struct object_id *, enum object_type, unsigned long, void*, int*);
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
-extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t, int nr_threads);
 extern off_t write_pack_header(struct sha1file *f, uint32_t);
 extern void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
 extern char *index_pack_lockfile(int fd);
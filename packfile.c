@@ -8,6 +8,9 @@
 #include "list.h"
 #include "streaming.h"
 #include "sha1-lookup.h"
+#include "midx.h"
+#include "pack-revindex.h"
+#include "thread-utils.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *sha1,
@@ -97,7 +100,7 @@ static int check_packed_git_idx(const char *path, struct packed_git *p)
 	hdr = idx_map;
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
 		version = ntohl(hdr->idx_version);
-		if (version < 2 || version > 2) {
+		if (version < 2 || version > 3) {
 			munmap(idx_map, idx_size);
 			return error("index file %s is version %"PRIu32
 				     " and is not supported by this binary"
@@ -132,7 +135,7 @@ static int check_packed_git_idx(const char *path, struct packed_git *p)
 			munmap(idx_map, idx_size);
 			return error("wrong index v1 file size in %s", path);
 		}
-	} else if (version == 2) {
+	} else {
 		/*
 		 * Minimum size:
 		 *  - 8 bytes of header
@@ -140,6 +143,7 @@ static int check_packed_git_idx(const char *path, struct packed_git *p)
 		 *  - 20-byte sha1 entry * nr
 		 *  - 4-byte crc entry * nr
 		 *  - 4-byte offset entry * nr
+		 *  - 8-byte type and size entry * nr (v3 only)
 		 *  - 20-byte SHA1 of the packfile
 		 *  - 20-byte SHA1 file checksum
 		 * And after the 4-byte offset table might be a
@@ -147,12 +151,16 @@ static int check_packed_git_idx(const char *path, struct packed_git *p)
 		 * for offsets larger than 2^31.
 		 */
 		unsigned long min_size = 8 + 4*256 + nr*(20 + 4 + 4) + 20 + 20;
-		unsigned long max_size = min_size;
+		unsigned long max_size;
+		if (version == 3)
+			min_size += nr*8;
+		max_size = min_size;
 		if (nr)
 			max_size += (nr - 1)*8;
 		if (idx_size < min_size || idx_size > max_size) {
 			munmap(idx_map, idx_size);
-			return error("wrong index v2 file size in %s", path);
+			return error("wrong index v%"PRIu32" file size in %s",
+				     version, path);
 		}
 		if (idx_size != min_size &&
 		    /*
@@ -297,9 +305,15 @@ void close_pack_index(struct packed_git *p)
 		munmap((void *)p->index_data, p->index_size);
 		p->index_data = NULL;
 	}
+	/* offsets from a mapped ".rev" file are looked up in the index */
+	if (p->revindex_map) {
+		munmap((void *)p->revindex_map, p->revindex_size);
+		p->revindex_map = NULL;
+		p->revindex_data = NULL;
+	}
 }
 
-static void close_pack(struct packed_git *p)
+void close_pack(struct packed_git *p)
 {
 	close_pack_windows(p);
 	close_pack_fd(p);
@@ -444,7 +458,11 @@ static int open_packed_git_1(struct packed_git *p)
 	long fd_flag;
 	ssize_t read_result;
 
-	if (!p->index_data && open_pack_index(p))
+	/*
+	 * A pack reached through the multi-pack-index does not need its
+	 * own index to be read; it is opened lazily if something asks.
+	 */
+	if (!p->index_data && !p->multi_pack_index && open_pack_index(p))
 		return error("packfile %s index unavailable", p->pack_name);
 
 	if (!pack_max_fds) {
@@ -497,6 +515,8 @@ static int open_packed_git_1(struct packed_git *p)
 			p->pack_name, ntohl(hdr.hdr_version));
 
 	/* Verify the pack matches its index. */
+	if (!p->index_data)
+		return 0;
 	if (p->num_objects != ntohl(hdr.hdr_entries))
 		return error("packfile %s claims to have %"PRIu32" objects"
 			     " while index indicates %"PRIu32" objects",
@@ -778,10 +798,15 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (!report_garbage)
 			continue;
 
+		if (!strcmp(de->d_name, "multi-pack-index") ||
+		    starts_with(de->d_name, "tmp_midx_"))
+			continue;
+
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
-		    ends_with(de->d_name, ".keep"))
+		    ends_with(de->d_name, ".keep") ||
+		    ends_with(de->d_name, ".rev"))
 			string_list_append(&garbage, path.buf);
 		else
 			report_garbage(PACKDIR_FILE_GARBAGE, path.buf);
@@ -807,9 +832,15 @@ unsigned long approximate_object_count(void)
 	if (!approximate_object_count_valid) {
 		struct packed_git *p;
 
+		struct multi_pack_index *m;
+
 		prepare_packed_git();
 		count = 0;
+		for (m = get_multi_pack_index(); m; m = m->next)
+			count += m->num_objects;
 		for (p = packed_git; p; p = p->next) {
+			if (p->multi_pack_index)
+				continue;
 			if (open_pack_index(p))
 				continue;
 			count += p->num_objects;
@@ -883,6 +914,9 @@ void prepare_packed_git(void)
 	for (alt = alt_odb_list; alt; alt = alt->next)
 		prepare_packed_git_one(alt->path, 0);
 	rearrange_packed_git();
+	prepare_multi_pack_index_one(get_object_directory());
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		prepare_multi_pack_index_one(alt->path);
 	prepare_packed_git_mru();
 	prepare_packed_git_run_once = 1;
 }
@@ -891,6 +925,8 @@ void reprepare_packed_git(void)
 {
 	approximate_object_count_valid = 0;
 	prepare_packed_git_run_once = 0;
+	close_all_midx();
+	clear_loose_object_caches();
 	prepare_packed_git();
 }
 
@@ -1009,11 +1045,11 @@ const struct packed_git *has_packed_and_bad(const unsigned char *sha1)
 	return NULL;
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1064,18 +1100,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1083,12 +1118,11 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -1165,6 +1199,21 @@ static enum object_type packed_to_object_type(struct packed_git *p,
 	goto out;
 }
 
+/*
+ * The delta base cache keeps recently used delta bases (keyed by pack
+ * and offset) so that we do not have to rebuild them for each delta
+ * that uses them. It has no lock of its own: threads reading objects
+ * already serialize on pack_read_lock() or on a read lock of their own,
+ * and only drop it while no cache entry is in use (see unpack_entry()).
+ */
+
+/*
+ * When the cache is over its limit, we evict the entry that is cheapest
+ * to rebuild (i.e. that has the shortest delta chain) among this many
+ * least recently used ones.
+ */
+#define DELTA_BASE_EVICT_CANDIDATES 4
+
 static struct hashmap delta_base_cache;
 static size_t delta_base_cached;
 
@@ -1182,6 +1231,7 @@ struct delta_base_cache_entry {
 	void *data;
 	unsigned long size;
 	enum object_type type;
+	unsigned int depth;
 };
 
 static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
@@ -1193,21 +1243,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	return hashmap_get(&delta_base_cache, &entry, &key);
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1226,6 +1261,42 @@ static int delta_base_cache_hash_cmp(const void *unused_cmp_data,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
+static void do_init_delta_base_cache(void)
+{
+	hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
+}
+
+/*
+ * The cache is set up by the first object read, which may come from
+ * any of several threads (e.g. the workers of "fsck --threads").
+ */
+static void init_delta_base_cache(void)
+{
+#ifndef NO_PTHREADS
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, do_init_delta_base_cache);
+#else
+	static int initialized;
+	if (!initialized) {
+		do_init_delta_base_cache();
+		initialized = 1;
+	}
+#endif
+}
+
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry;
+	struct delta_base_cache_key key;
+
+	init_delta_base_cache();
+	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
+	key.p = p;
+	key.base_offset = base_offset;
+	return hashmap_get(&delta_base_cache, &entry, &key);
+}
+
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
 	return !!get_delta_base_cache_entry(p, base_offset);
@@ -1244,6 +1315,36 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 	free(ent);
 }
 
+static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+{
+	free(ent->data);
+	detach_delta_base_cache_entry(ent);
+}
+
+/*
+ * Take the entry for "base_offset" in "p" out of the cache, and return
+ * its data (which the caller now owns), or NULL if it is not cached.
+ */
+static void *take_delta_base_cache_entry(struct packed_git *p,
+					 off_t base_offset,
+					 enum object_type *type,
+					 unsigned long *size,
+					 unsigned int *depth)
+{
+	struct delta_base_cache_entry *ent;
+	void *data;
+
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (!ent)
+		return NULL;
+	data = ent->data;
+	*type = ent->type;
+	*size = ent->size;
+	*depth = ent->depth;
+	detach_delta_base_cache_entry(ent);
+	return data;
+}
+
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type)
 {
@@ -1260,12 +1361,6 @@ static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	return xmemdupz(ent->data, ent->size);
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
-{
-	free(ent->data);
-	detach_delta_base_cache_entry(ent);
-}
-
 void clear_delta_base_cache(void)
 {
 	struct list_head *lru, *tmp;
@@ -1276,31 +1371,55 @@ void clear_delta_base_cache(void)
 	}
 }
 
+/*
+ * Evict entries until the cache fits in core.deltaBaseCacheLimit.
+ * Among the few least recently used entries, drop the one with the
+ * shortest delta chain first, as it is the cheapest to rebuild.
+ */
+static void prune_delta_base_cache(void)
+{
+	while (delta_base_cached > delta_base_cache_limit &&
+	       !list_empty(&delta_base_cache_lru)) {
+		struct delta_base_cache_entry *victim = NULL;
+		struct list_head *lru;
+		int n = 0;
+
+		list_for_each(lru, &delta_base_cache_lru) {
+			struct delta_base_cache_entry *f =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			if (!victim || f->depth < victim->depth)
+				victim = f;
+			if (!victim->depth || ++n >= DELTA_BASE_EVICT_CANDIDATES)
+				break;
+		}
+		release_delta_base_cache(victim);
+	}
+}
+
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
-	void *base, unsigned long base_size, enum object_type type)
+	void *base, unsigned long base_size, enum object_type type,
+	unsigned int depth)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
-	struct list_head *lru, *tmp;
-
-	delta_base_cached += base_size;
+	struct delta_base_cache_entry *ent;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *f =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
-			break;
-		release_delta_base_cache(f);
+	if (get_delta_base_cache_entry(p, base_offset)) {
+		/* another thread has cached the same base meanwhile */
+		free(base);
+		return;
 	}
 
+	delta_base_cached += base_size;
+	prune_delta_base_cache();
+
+	ent = xmalloc(sizeof(*ent));
 	ent->key.p = p;
 	ent->key.base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	ent->depth = depth;
 	list_add_tail(&ent->lru, &delta_base_cache_lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
 	hashmap_entry_init(ent, pack_entry_hash(p, base_offset));
 	hashmap_add(&delta_base_cache, ent);
 }
@@ -1346,8 +1465,12 @@ int packed_object_info(struct packed_git *p, off_t obj_offset,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t pos;
+		if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
 	}
 
 	if (oi->typep || oi->typename) {
@@ -1391,6 +1514,55 @@ int packed_object_info(struct packed_git *p, off_t obj_offset,
 	return type;
 }
 
+#ifndef NO_PTHREADS
+static int pack_read_lock_enabled;
+static pthread_mutex_t pack_read_mutex;
+
+void enable_pack_read_lock(void)
+{
+	if (pack_read_lock_enabled++)
+		return;
+	pthread_mutex_init(&pack_read_mutex, NULL);
+}
+
+void disable_pack_read_lock(void)
+{
+	if (!pack_read_lock_enabled)
+		die("BUG: pack read lock is not enabled");
+	if (--pack_read_lock_enabled)
+		return;
+	pthread_mutex_destroy(&pack_read_mutex);
+}
+
+void pack_read_lock(void)
+{
+	if (pack_read_lock_enabled)
+		pthread_mutex_lock(&pack_read_mutex);
+}
+
+void pack_read_unlock(void)
+{
+	if (pack_read_lock_enabled)
+		pthread_mutex_unlock(&pack_read_mutex);
+}
+#else
+void enable_pack_read_lock(void)
+{
+}
+
+void disable_pack_read_lock(void)
+{
+}
+
+void pack_read_lock(void)
+{
+}
+
+void pack_read_unlock(void)
+{
+}
+#endif
+
 static void *unpack_compressed_entry(struct packed_git *p,
 				    struct pack_window **w_curs,
 				    off_t curpos,
@@ -1399,10 +1571,32 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	int st;
 	git_zstream stream;
 	unsigned char *buffer, *in;
+#ifdef USE_LIBDEFLATE
+	unsigned long avail;
+#endif
 
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+#ifdef USE_LIBDEFLATE
+	/*
+	 * We know how large the result is, so if the whole stream is
+	 * within the current window, let libdeflate inflate it in one
+	 * go. Objects straddling the window end (or corrupt ones) fail
+	 * here and go through zlib below. With plain zlib this would be
+	 * the same inflate() as the loop below, so we skip it there.
+	 * The window stays in use while we inflate, so it is safe to
+	 * let other readers in.
+	 */
+	in = use_pack(p, w_curs, curpos, &avail);
+	pack_read_unlock();
+	st = git_inflate_buffer(buffer, size, in, avail);
+	pack_read_lock();
+	if (!st)
+		return buffer;
+#endif
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -1411,7 +1605,9 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		pack_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		pack_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1467,6 +1663,7 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	struct unpack_entry_stack_ent *delta_stack = small_delta_stack;
 	int delta_stack_nr = 0, delta_stack_alloc = UNPACK_ENTRY_STACK_PREALLOC;
 	int base_from_cache = 0;
+	unsigned int base_depth = 0;
 
 	write_pack_access_log(p, obj_offset);
 
@@ -1474,24 +1671,27 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (ent) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+
+		data = take_delta_base_cache_entry(p, curpos, &type, &size,
+						   &base_depth);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			off_t len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pack_pos, index_pos;
+			off_t len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pack_pos) < 0) {
+				data = NULL;
+				goto out;
+			}
+			len = pack_pos_to_offset(p, pack_pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pack_pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, index_pos);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -1562,13 +1762,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		void *base = data;
 		void *external_base = NULL;
 		unsigned long delta_size, base_size = size;
+		off_t base_offset = obj_offset;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -1576,11 +1774,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			if (!offset_to_pack_pos(p, obj_offset, &pos)) {
+				base_sha1 = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
@@ -1606,27 +1804,38 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
-			free(external_base);
-			continue;
-		}
+		} else {
+			pack_read_unlock();
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+			pack_read_lock();
+
+			/*
+			 * We could not apply the delta; warn the user, but
+			 * keep going. Our failure will be noticed either in
+			 * the next iteration of the loop, or if this is the
+			 * final delta, in the caller when we return NULL.
+			 * Those code paths will take care of making a more
+			 * explicit warning and retrying with another copy of
+			 * the object.
+			 */
+			if (!data)
+				error("failed to apply delta");
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
+			free(delta_data);
+		}
 
 		/*
-		 * We could not apply the delta; warn the user, but keep going.
-		 * Our failure will be noticed either in the next iteration of
-		 * the loop, or if this is the final delta, in the caller when
-		 * we return NULL. Those code paths will take care of making
-		 * a more explicit warning and retrying with another copy of
-		 * the object.
+		 * Hand the base over to the cache only now that we are
+		 * done with it, as another thread may evict it right away.
 		 */
-		if (!data)
-			error("failed to apply delta");
-
-		free(delta_data);
-		free(external_base);
+		if (external_base)
+			free(external_base);
+		else
+			add_delta_base_cache(p, base_offset, base, base_size,
+					     type, base_depth);
+		base_depth++;
 	}
 
 	if (final_type)
@@ -1707,8 +1916,30 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 	}
 }
 
-off_t find_pack_entry_one(const unsigned char *sha1,
-				  struct packed_git *p)
+int packed_object_info_from_index(struct packed_git *p, uint32_t n,
+				  enum object_type *type, unsigned long *size,
+				  int *is_delta)
+{
+	const unsigned char *entry;
+	uint64_t val;
+
+	if (p->index_version < 3 || n >= p->num_objects)
+		return -1;
+	/* the table sits right before the trailer */
+	entry = (const unsigned char *)p->index_data + p->index_size - 40 -
+		(p->num_objects - n) * 8;
+	val = get_be64(entry);
+	if (type)
+		*type = (val >> PACK_IDX_V3_SIZE_BITS) & ((1 << TYPE_BITS) - 1);
+	if (size)
+		*size = val & (((uint64_t)1 << PACK_IDX_V3_SIZE_BITS) - 1);
+	if (is_delta)
+		*is_delta = !!(val & PACK_IDX_V3_DELTA_BIT);
+	return 0;
+}
+
+int find_pack_entry_pos(const unsigned char *sha1, struct packed_git *p,
+			uint32_t *pos)
 {
 	const uint32_t *level1_ofs = p->index_data;
 	const unsigned char *index = p->index_data;
@@ -1749,8 +1980,10 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 		if (debug_lookup)
 			printf("lo %u hi %u rg %u mi %u\n",
 			       lo, hi, hi - lo, mi);
-		if (!cmp)
-			return nth_packed_object_offset(p, mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
 		if (cmp > 0)
 			hi = mi;
 		else
@@ -1759,6 +1992,16 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 	return 0;
 }
 
+off_t find_pack_entry_one(const unsigned char *sha1,
+				  struct packed_git *p)
+{
+	uint32_t pos;
+
+	if (!find_pack_entry_pos(sha1, p, &pos))
+		return 0;
+	return nth_packed_object_offset(p, pos);
+}
+
 int is_pack_valid(struct packed_git *p)
 {
 	/* An already open pack is known to be valid. */
@@ -1832,13 +2075,31 @@ static int fill_pack_entry(const unsigned char *sha1,
 int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct mru_entry *p;
+	struct multi_pack_index *m;
+	int midx_failed = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
 
+	for (m = get_multi_pack_index(); m; m = m->next) {
+		int ret = fill_midx_entry(sha1, e, m);
+		if (ret > 0)
+			return 1;
+		if (ret < 0)
+			midx_failed = 1;
+	}
+
+	/*
+	 * Packs covered by a multi-pack-index need not be searched again,
+	 * unless the entry found there turned out to be unusable.
+	 */
 	for (p = packed_git_mru.head; p; p = p->next) {
-		if (fill_pack_entry(sha1, e, p->item)) {
+		struct packed_git *pack = p->item;
+
+		if (pack->multi_pack_index && !midx_failed)
+			continue;
+		if (fill_pack_entry(sha1, e, pack)) {
 			mru_mark(&packed_git_mru, p);
 			return 1;
 		}
@@ -1860,19 +2121,29 @@ int has_pack_index(const unsigned char *sha1)
 	return 1;
 }
 
-static int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn cb, void *data)
+static int for_each_object_in_pack(struct packed_git *p,
+				   each_packed_object_fn cb, void *data,
+				   unsigned flags)
 {
 	uint32_t i;
 	int r = 0;
 
+	if ((flags & FOR_EACH_OBJECT_PACK_ORDER) && load_pack_revindex(p))
+		return error("unable to load reverse index of %s",
+			     p->pack_name);
+
 	for (i = 0; i < p->num_objects; i++) {
 		struct object_id oid;
+		uint32_t pos = i;
+
+		if (flags & FOR_EACH_OBJECT_PACK_ORDER)
+			pos = pack_pos_to_index(p, i);
 
-		if (!nth_packed_object_oid(&oid, p, i))
+		if (!nth_packed_object_oid(&oid, p, pos))
 			return error("unable to get sha1 of object %u in %s",
-				     i, p->pack_name);
+				     pos, p->pack_name);
 
-		r = cb(&oid, p, i, data);
+		r = cb(&oid, p, pos, data);
 		if (r)
 			break;
 	}
@@ -1893,9 +2164,124 @@ int for_each_packed_object(each_packed_object_fn cb, void *data, unsigned flags)
 			pack_errors = 1;
 			continue;
 		}
-		r = for_each_object_in_pack(p, cb, data);
+		r = for_each_object_in_pack(p, cb, data, flags);
 		if (r)
 			break;
 	}
 	return r ? r : pack_errors;
 }
+
+struct pack_order_entry {
+	size_t pos;
+	struct packed_git *p;
+	off_t offset;
+};
+
+static int pack_order_cmp(const void *va, const void *vb)
+{
+	const struct pack_order_entry *a = va, *b = vb;
+
+	/* packed objects first, then the others in list order */
+	if (!a->p || !b->p) {
+		if (a->p != b->p)
+			return a->p ? -1 : 1;
+	} else if (a->p != b->p) {
+		return a->p < b->p ? -1 : 1;
+	} else if (a->offset != b->offset) {
+		return a->offset < b->offset ? -1 : 1;
+	}
+	return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
+
+/*
+ * Objects closer than this are advised as part of the same range, and
+ * this much is advised past the start of the last object in a range.
+ */
+#define PACK_READAHEAD_GAP (1024 * 1024)
+#define PACK_READAHEAD_TAIL (64 * 1024)
+
+static void advise_pack_range(struct packed_git *p, off_t start, off_t end)
+{
+#ifdef POSIX_FADV_WILLNEED
+	if (p->pack_fd < 0)
+		return;
+	if (end > p->pack_size)
+		end = p->pack_size;
+	posix_fadvise(p->pack_fd, start, end - start, POSIX_FADV_WILLNEED);
+#endif
+}
+
+static void advise_pack_order(struct pack_order_entry *entries, size_t nr)
+{
+	size_t i = 0;
+
+	while (i < nr && entries[i].p) {
+		struct packed_git *p = entries[i].p;
+		off_t start = entries[i].offset, end;
+
+		end = start + PACK_READAHEAD_TAIL;
+		for (i++; i < nr && entries[i].p == p; i++) {
+			if (entries[i].offset > end + PACK_READAHEAD_GAP) {
+				advise_pack_range(p, start, end);
+				start = entries[i].offset;
+			}
+			end = entries[i].offset + PACK_READAHEAD_TAIL;
+		}
+		advise_pack_range(p, start, end);
+	}
+}
+
+int for_each_object_in_pack_order(const struct object_id *oids,
+				  size_t nr, unsigned long max_size,
+				  each_object_in_pack_order_fn fn,
+				  void *data)
+{
+	struct pack_order_entry *entries;
+	size_t i;
+	int ret = 0;
+
+	ALLOC_ARRAY(entries, nr);
+	for (i = 0; i < nr; i++) {
+		struct pack_entry e;
+
+		entries[i].pos = i;
+		if (find_pack_entry(oids[i].hash, &e)) {
+			entries[i].p = e.p;
+			entries[i].offset = e.offset;
+		} else {
+			entries[i].p = NULL;
+			entries[i].offset = 0;
+		}
+	}
+	QSORT(entries, nr, pack_order_cmp);
+	advise_pack_order(entries, nr);
+
+	for (i = 0; i < nr && !ret; i++) {
+		const struct object_id *oid = &oids[entries[i].pos];
+		struct object_info oi = OBJECT_INFO_INIT;
+		enum object_type type;
+		unsigned long size = 0;
+		void *contents = NULL;
+
+		oi.typep = &type;
+		oi.sizep = &size;
+		if (entries[i].p) {
+			if (packed_object_info(entries[i].p, entries[i].offset,
+					       &oi) < 0)
+				type = OBJ_BAD;
+			else if (size <= max_size)
+				contents = unpack_entry(entries[i].p,
+							entries[i].offset,
+							&type, &size);
+		} else {
+			if (sha1_object_info_extended(oid->hash, &oi, 0) < 0)
+				type = OBJ_BAD;
+			else if (size <= max_size)
+				contents = read_sha1_file(oid->hash, &type, &size);
+		}
+		ret = fn(oid, entries[i].pos, type, size, contents, data);
+	}
+
+	free(entries);
+	return ret;
+}
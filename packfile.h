@@ -61,6 +61,7 @@ extern void close_pack_index(struct packed_git *);
 
 extern unsigned char *use_pack(struct packed_git *, struct pack_window **, off_t, unsigned long *);
 extern void close_pack_windows(struct packed_git *);
+extern void close_pack(struct packed_git *);
 extern void close_all_packs(void);
 extern void unuse_pack(struct pack_window **);
 extern void clear_delta_base_cache(void);
@@ -102,12 +103,52 @@ extern off_t nth_packed_object_offset(const struct packed_git *, uint32_t n);
  */
 extern off_t find_pack_entry_one(const unsigned char *sha1, struct packed_git *);
 
+/*
+ * If the object named sha1 is present in the specified packfile, store
+ * its position in the index in "pos" and return 1; otherwise return 0.
+ */
+extern int find_pack_entry_pos(const unsigned char *sha1, struct packed_git *,
+			       uint32_t *pos);
+
+/*
+ * Look up the type and size of the nth object of a pack, and whether it
+ * is stored as a delta, in the pack's index. Returns -1 if the index
+ * does not record them (i.e. it is older than version 3).
+ */
+extern int packed_object_info_from_index(struct packed_git *, uint32_t n,
+					 enum object_type *type,
+					 unsigned long *size, int *is_delta);
+
 extern int is_pack_valid(struct packed_git *);
+
+/*
+ * Reading packed objects is not thread-safe. Callers that want to read
+ * them from several threads at once call enable_pack_read_lock() before
+ * starting the threads, and hold pack_read_lock() around every read.
+ * unpack_entry() then drops the lock while it inflates data and applies
+ * deltas, so that those run concurrently. All of these are no-ops
+ * unless the lock is enabled.
+ */
+extern void enable_pack_read_lock(void);
+extern void disable_pack_read_lock(void);
+extern void pack_read_lock(void);
+extern void pack_read_unlock(void);
+
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Parse the delta base reference of the delta object at "delta_obj_offset"
+ * of the given type, whose header ends at "*curpos", and return the
+ * offset of the base in the pack (or 0 if it cannot be found). "*curpos"
+ * is advanced past the reference.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 extern void release_pack_memory(size_t);
 
 /* global flag to enable extra checks when accessing packed objects */
@@ -128,6 +169,9 @@ extern int has_pack_index(const unsigned char *sha1);
  * Iterate over packed objects in both the local
  * repository and any alternates repositories (unless the
  * FOR_EACH_OBJECT_LOCAL_ONLY flag, defined in cache.h, is set).
+ * With FOR_EACH_OBJECT_PACK_ORDER, the objects of each pack are
+ * visited in the order they are stored in it; "pos" is always the
+ * position of the object in the index.
  */
 typedef int each_packed_object_fn(const struct object_id *oid,
 				  struct packed_git *pack,
@@ -135,4 +179,27 @@ typedef int each_packed_object_fn(const struct object_id *oid,
 				  void *data);
 extern int for_each_packed_object(each_packed_object_fn, void *, unsigned flags);
 
+/*
+ * Read the "nr" objects in "oids" in the order they are stored in, and
+ * call "fn" for each of them. "pos" is the index of the object in
+ * "oids". Packed objects come first, sorted by pack and offset, and
+ * the rest (loose or missing objects) follow in list order. The OS is
+ * told beforehand which parts of the packs we are about to read.
+ *
+ * "contents" is NULL for missing objects (whose type is then
+ * OBJ_BAD), for objects larger than "max_size", and for objects that
+ * could not be read; otherwise "fn" takes ownership of it. A non-zero
+ * return from "fn" stops the iteration and is returned.
+ */
+typedef int each_object_in_pack_order_fn(const struct object_id *oid,
+					 size_t pos,
+					 enum object_type type,
+					 unsigned long size,
+					 void *contents,
+					 void *data);
+extern int for_each_object_in_pack_order(const struct object_id *oids,
+					 size_t nr, unsigned long max_size,
+					 each_object_in_pack_order_fn fn,
+					 void *data);
+
 #endif
@@ -16,6 +16,7 @@
 #include "trailer.h"
 #include "wt-status.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
 
 static struct ref_msg {
 	const char *gone;
@@ -1964,11 +1965,19 @@ static void do_merge_filter(struct ref_filter_cbdata *ref_cbdata)
 	struct ref_filter *filter = ref_cbdata->filter;
 	struct ref_array *array = ref_cbdata->array;
 	struct commit **to_clear = xcalloc(sizeof(struct commit *), array->nr);
+	uint32_t merge_generation = commit_generation(filter->merge_commit);
 
 	init_revisions(&revs, NULL);
 
 	for (i = 0; i < array->nr; i++) {
 		struct ref_array_item *item = array->items[i];
+
+		/*
+		 * A commit with a higher generation than the merge commit
+		 * cannot be merged into it; do not bother walking it.
+		 */
+		if (commit_generation(item->commit) > merge_generation)
+			continue;
 		add_pending_object(&revs, &item->commit->object, item->refname);
 		to_clear[i] = item->commit;
 	}
@@ -1996,7 +2005,8 @@ static void do_merge_filter(struct ref_filter_cbdata *ref_cbdata)
 	}
 
 	for (i = 0; i < old_nr; i++)
-		clear_commit_marks(to_clear[i], ALL_REV_FLAGS);
+		if (to_clear[i])
+			clear_commit_marks(to_clear[i], ALL_REV_FLAGS);
 	clear_commit_marks(filter->merge_commit, ALL_REV_FLAGS);
 	free(to_clear);
 }
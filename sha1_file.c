@@ -626,6 +626,81 @@ void prepare_alt_odb(void)
 	read_info_alternates(get_object_directory(), 0);
 }
 
+static struct alternate_object_database *local_odb;
+
+struct alternate_object_database *local_and_alt_odbs(void)
+{
+	if (!local_odb)
+		local_odb = alloc_alt_odb(get_object_directory());
+	prepare_alt_odb();
+	local_odb->next = alt_odb_list;
+	return local_odb;
+}
+
+static int append_loose_object(const struct object_id *oid, const char *path,
+			       void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+struct oid_array *odb_loose_cache(struct alternate_object_database *odb,
+				  int subdir_nr)
+{
+	struct oid_array *cache = &odb->loose_objects_cache[subdir_nr];
+
+	if (!odb->loose_objects_subdir_seen[subdir_nr]) {
+		for_each_file_in_obj_subdir(subdir_nr, alt_scratch_buf(odb),
+					    append_loose_object, NULL, NULL,
+					    cache);
+		odb->loose_objects_subdir_seen[subdir_nr] = 1;
+	}
+	return cache;
+}
+
+static void clear_loose_object_cache(struct alternate_object_database *odb)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(odb->loose_objects_cache); i++)
+		oid_array_clear(&odb->loose_objects_cache[i]);
+	memset(odb->loose_objects_subdir_seen, 0,
+	       sizeof(odb->loose_objects_subdir_seen));
+}
+
+void clear_loose_object_caches(void)
+{
+	struct alternate_object_database *odb;
+
+	if (local_odb)
+		clear_loose_object_cache(local_odb);
+	for (odb = alt_odb_list; odb; odb = odb->next)
+		clear_loose_object_cache(odb);
+}
+
+/*
+ * Record an object this process has just written to our own object
+ * directory, if the cache of its fan-out directory is in use.
+ */
+static void add_to_loose_object_cache(const unsigned char *sha1)
+{
+	struct object_id oid;
+
+	if (!local_odb || !local_odb->loose_objects_subdir_seen[sha1[0]])
+		return;
+	hashcpy(oid.hash, sha1);
+	oid_array_append(&local_odb->loose_objects_cache[sha1[0]], &oid);
+}
+
+static int loose_object_cached(struct alternate_object_database *odb,
+			       const unsigned char *sha1)
+{
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	return oid_array_lookup(odb_loose_cache(odb, sha1[0]), &oid) >= 0;
+}
+
 /* Returns 1 if we have successfully freshened the file, 0 otherwise. */
 static int freshen_file(const char *fn)
 {
@@ -683,6 +758,21 @@ static int has_loose_object(const unsigned char *sha1)
 	return check_and_freshen(sha1, 0);
 }
 
+/*
+ * Like has_loose_object(), but answer from the loose object caches
+ * (see odb_loose_cache()), which may miss objects that other processes
+ * have written or pruned since. Only for OBJECT_INFO_QUICK lookups.
+ */
+static int has_loose_object_quick(const unsigned char *sha1)
+{
+	struct alternate_object_database *odb;
+
+	for (odb = local_and_alt_odbs(); odb; odb = odb->next)
+		if (loose_object_cached(odb, sha1))
+			return 1;
+	return 0;
+}
+
 static void mmap_limit_check(size_t length)
 {
 	static size_t limit = 0;
@@ -1098,11 +1188,14 @@ static int sha1_loose_object_info(const unsigned char *sha1,
 	 * do not optimize out the stat call, even if the
 	 * caller doesn't care about the disk-size, since our
 	 * return value implicitly indicates whether the
-	 * object even exists.
+	 * object even exists. Quick lookups are answered from the
+	 * loose object caches instead.
 	 */
 	if (!oi->typep && !oi->typename && !oi->sizep && !oi->contentp) {
 		const char *path;
 		struct stat st;
+		if (!oi->disk_sizep && (flags & OBJECT_INFO_QUICK))
+			return has_loose_object_quick(sha1) ? 0 : -1;
 		if (stat_sha1_file(sha1, &st, &path) < 0)
 			return -1;
 		if (oi->disk_sizep)
@@ -1209,6 +1302,29 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 		 */
 		return 0;
 
+	if (!oi->contentp && !oi->disk_sizep && !oi->delta_base_sha1 &&
+	    !oi->typename && e.p->index_version >= 3) {
+		enum object_type type;
+		unsigned long size;
+		uint32_t pos;
+		int is_delta;
+
+		/* a version 3 index can answer without reading the pack */
+		if (find_pack_entry_pos(real, e.p, &pos) &&
+		    !packed_object_info_from_index(e.p, pos, &type, &size,
+						   &is_delta)) {
+			if (oi->typep)
+				*oi->typep = type;
+			if (oi->sizep)
+				*oi->sizep = size;
+			oi->whence = OI_PACKED;
+			oi->u.packed.offset = e.offset;
+			oi->u.packed.pack = e.p;
+			oi->u.packed.is_delta = is_delta;
+			return 0;
+		}
+	}
+
 	rtype = packed_object_info(e.p, e.offset, oi);
 	if (rtype < 0) {
 		mark_bad_packed_object(e.p, real);
@@ -1551,7 +1667,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 			warning_errno("failed utime() on %s", tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename);
+	ret = finalize_object_file(tmp_file.buf, filename);
+	if (!ret)
+		add_to_loose_object_cache(sha1);
+	return ret;
 }
 
 static int freshen_loose_object(const unsigned char *sha1)
@@ -1572,6 +1691,112 @@ static int freshen_packed_object(const unsigned char *sha1)
 	return 1;
 }
 
+int stream_loose_object(struct input_stream *in_stream, size_t len,
+			struct object_id *oid)
+{
+	int fd, ret;
+	unsigned char compressed[4096];
+	git_zstream stream;
+	git_SHA_CTX c;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
+	char hdr[32];
+	int hdrlen;
+	size_t total_in = 0;
+
+	/* we do not know the name yet, so start in the object directory */
+	strbuf_addf(&filename, "%s/", get_object_directory());
+	fd = create_tmpfile(&tmp_file, filename.buf);
+	if (fd < 0) {
+		if (errno == EACCES)
+			ret = error("insufficient permission for adding an object to repository database %s", get_object_directory());
+		else
+			ret = error_errno("unable to create temporary file");
+		goto cleanup;
+	}
+
+	hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %"PRIuMAX,
+			   blob_type, (uintmax_t)len) + 1;
+
+	git_deflate_init(&stream, zlib_compression_level);
+	stream.next_out = compressed;
+	stream.avail_out = sizeof(compressed);
+	git_SHA1_Init(&c);
+
+	stream.next_in = (unsigned char *)hdr;
+	stream.avail_in = hdrlen;
+	while (git_deflate(&stream, 0) == Z_OK)
+		; /* nothing */
+	git_SHA1_Update(&c, hdr, hdrlen);
+
+	do {
+		int flush = Z_NO_FLUSH;
+
+		if (!stream.avail_in && !in_stream->is_finished) {
+			const void *in = in_stream->read(in_stream,
+							 &stream.avail_in);
+			stream.next_in = (void *)in;
+			total_in += stream.avail_in;
+		}
+		if (in_stream->is_finished)
+			flush = Z_FINISH;
+
+		do {
+			unsigned char *in0 = stream.next_in;
+
+			ret = git_deflate(&stream, flush);
+			git_SHA1_Update(&c, in0, stream.next_in - in0);
+			if (write_buffer(fd, compressed,
+					 stream.next_out - compressed) < 0)
+				die("unable to write loose object file");
+			stream.next_out = compressed;
+			stream.avail_out = sizeof(compressed);
+		} while (ret == Z_OK && (stream.avail_in || flush == Z_FINISH));
+	} while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+	if (ret != Z_STREAM_END)
+		die("unable to stream deflate new object (%d)", ret);
+	if (total_in != len)
+		die("object of %"PRIuMAX" bytes streamed as %"PRIuMAX,
+		    (uintmax_t)len, (uintmax_t)total_in);
+	ret = git_deflate_end_gently(&stream);
+	if (ret != Z_OK)
+		die("deflateEnd on stream object failed (%d)", ret);
+	git_SHA1_Final(oid->hash, &c);
+	close_sha1_file(fd);
+
+	if (freshen_packed_object(oid->hash) ||
+	    freshen_loose_object(oid->hash)) {
+		unlink_or_warn(tmp_file.buf);
+		ret = 0;
+		goto cleanup;
+	}
+
+	strbuf_reset(&filename);
+	strbuf_addstr(&filename, sha1_file_name(oid->hash));
+	strbuf_setlen(&filename, directory_size(filename.buf) - 1);
+	if (mkdir(filename.buf, 0777) && errno != EEXIST) {
+		ret = error_errno("unable to create directory %s",
+				  filename.buf);
+		unlink_or_warn(tmp_file.buf);
+		goto cleanup;
+	}
+	if (adjust_shared_perm(filename.buf)) {
+		ret = error("unable to set permission to '%s'", filename.buf);
+		unlink_or_warn(tmp_file.buf);
+		goto cleanup;
+	}
+
+	ret = finalize_object_file(tmp_file.buf, sha1_file_name(oid->hash));
+	if (!ret)
+		add_to_loose_object_cache(oid->hash);
+
+cleanup:
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
+}
+
 int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1)
 {
 	char hdr[32];
@@ -1583,6 +1808,8 @@ int write_sha1_file(const void *buf, unsigned long len, const char *type, unsign
 	write_sha1_file_prepare(buf, len, type, sha1, hdr, &hdrlen);
 	if (freshen_packed_object(sha1) || freshen_loose_object(sha1))
 		return 0;
+	if (!strcmp(type, blob_type) && bulk_checkin_wants(OBJ_BLOB))
+		return write_bulk_checkin(sha1, buf, len, OBJ_BLOB);
 	return write_loose_object(sha1, hdr, hdrlen, buf, len, 0);
 }
 
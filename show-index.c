@@ -17,7 +17,7 @@ int cmd_main(int argc, const char **argv)
 		die("unable to read header");
 	if (top_index[0] == htonl(PACK_IDX_SIGNATURE)) {
 		version = ntohl(top_index[1]);
-		if (version < 2 || version > 2)
+		if (version < 2 || version > 3)
 			die("unknown index version");
 		if (fread(top_index, 256 * 4, 1, stdin) != 1)
 			die("unable to read index");
@@ -48,6 +48,7 @@ int cmd_main(int argc, const char **argv)
 			unsigned char sha1[20];
 			uint32_t crc;
 			uint32_t off;
+			uint64_t offset;
 		} *entries;
 		ALLOC_ARRAY(entries, nr);
 		for (i = 0; i < nr; i++)
@@ -74,10 +75,30 @@ int cmd_main(int argc, const char **argv)
 						     ntohl(off64[1]);
 				off64_nr++;
 			}
-			printf("%" PRIuMAX " %s (%08"PRIx32")\n",
-			       (uintmax_t) offset,
+			entries[i].offset = offset;
+		}
+		for (i = 0; i < nr; i++) {
+			printf("%" PRIuMAX " %s (%08"PRIx32")",
+			       (uintmax_t) entries[i].offset,
 			       sha1_to_hex(entries[i].sha1),
 			       ntohl(entries[i].crc));
+			if (version >= 3) {
+				uint32_t info[2];
+				uint64_t val;
+
+				if (fread(info, 8, 1, stdin) != 1)
+					die("unable to read type and size %u/%u",
+					    i, nr);
+				val = ((uint64_t)ntohl(info[0]) << 32) |
+				      ntohl(info[1]);
+				printf(" %s %" PRIuMAX "%s",
+				       typename((val >> PACK_IDX_V3_SIZE_BITS) &
+						((1 << TYPE_BITS) - 1)),
+				       (uintmax_t)(val &
+						   (((uint64_t)1 << PACK_IDX_V3_SIZE_BITS) - 1)),
+				       (val & PACK_IDX_V3_DELTA_BIT) ? " delta" : "");
+			}
+			putchar('\n');
 		}
 		free(entries);
 	}
@@ -9,7 +9,8 @@ enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -42,6 +43,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -50,6 +52,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -64,6 +67,27 @@ struct filtered_istream {
 	int input_finished;
 };
 
+#define DELTA_BUFFER (1024*4)
+
+struct pack_delta_istream {
+	struct packed_git *pack;
+	off_t pos; /* of the deflated delta data yet to be inflated */
+	off_t base_offset;
+	unsigned long base_size;
+
+	/* the base is either in core, or streamed from "base_offset" */
+	char *base_buf;
+	struct git_istream *base;
+	unsigned long base_pos; /* of the next byte "base" returns */
+
+	unsigned char dbuf[DELTA_BUFFER]; /* inflated delta data */
+	int d_ptr, d_end;
+
+	unsigned long copy_off, copy_left; /* current copy from base */
+	unsigned long insert_left; /* current literal insert */
+	unsigned long out_pos; /* bytes of the result produced so far */
+};
+
 struct git_istream {
 	const struct stream_vtbl *vtbl;
 	unsigned long size; /* inflated size of full object */
@@ -89,6 +113,8 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct pack_delta_istream in_pack_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -122,8 +148,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -440,7 +466,7 @@ static open_method_decl(pack_non_delta)
 	unuse_pack(&window);
 	switch (in_pack_type) {
 	default:
-		return -1; /* we do not do deltas for now */
+		return -1; /* deltas are for pack_delta */
 	case OBJ_COMMIT:
 	case OBJ_TREE:
 	case OBJ_BLOB:
@@ -453,6 +479,308 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Deltified packed object stream
+ *
+ * The delta is inflated a little at a time and applied as it goes,
+ * so the result is never held in core. A base no larger than
+ * core.bigFileThreshold is read into core; a larger one is itself
+ * streamed, and reopened whenever the delta copies from a part of it
+ * that was already read, which trades time for bounded memory.
+ *
+ *****************************************************************/
+
+static struct git_istream *open_istream_pack_entry(struct packed_git *p,
+						   off_t offset)
+{
+	struct git_istream *st = xmalloc(sizeof(*st));
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	oi.u.packed.pack = p;
+	oi.u.packed.offset = offset;
+	if (!open_istream_pack_non_delta(st, &oi, NULL, NULL) ||
+	    !open_istream_pack_delta(st, &oi, NULL, NULL))
+		return st;
+	free(st);
+	return NULL;
+}
+
+static int fill_delta(struct git_istream *st)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	if (st->z_state != z_used)
+		return -1;
+
+	st->z.next_out = ds->dbuf;
+	st->z.avail_out = sizeof(ds->dbuf);
+	while (st->z.next_out == ds->dbuf) {
+		int status;
+		struct pack_window *window = NULL;
+		unsigned char *mapped;
+
+		mapped = use_pack(ds->pack, &window, ds->pos, &st->z.avail_in);
+		st->z.next_in = mapped;
+		status = git_inflate(&st->z, Z_FINISH);
+		ds->pos += st->z.next_in - mapped;
+		unuse_pack(&window);
+
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+			break;
+		}
+		if (status != Z_OK && status != Z_BUF_ERROR) {
+			git_inflate_end(&st->z);
+			st->z_state = z_error;
+			return -1;
+		}
+	}
+	ds->d_ptr = 0;
+	ds->d_end = st->z.next_out - ds->dbuf;
+	return ds->d_end ? 0 : -1;
+}
+
+static int read_delta(struct git_istream *st, void *buf, size_t sz)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	while (sz) {
+		size_t to_copy;
+
+		if (ds->d_ptr == ds->d_end && fill_delta(st))
+			return -1;
+		to_copy = ds->d_end - ds->d_ptr;
+		if (sz < to_copy)
+			to_copy = sz;
+		memcpy(buf, ds->dbuf + ds->d_ptr, to_copy);
+		ds->d_ptr += to_copy;
+		buf = (char *)buf + to_copy;
+		sz -= to_copy;
+	}
+	return 0;
+}
+
+static int read_delta_size(struct git_istream *st, unsigned long *sizep)
+{
+	unsigned long size = 0;
+	int shift = 0;
+	unsigned char c;
+
+	do {
+		if (read_delta(st, &c, 1))
+			return -1;
+		size |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	*sizep = size;
+	return 0;
+}
+
+static int read_base(struct git_istream *st, unsigned long off,
+		     char *buf, size_t sz)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	if (ds->base_buf) {
+		memcpy(buf, ds->base_buf + off, sz);
+		return 0;
+	}
+
+	if (off < ds->base_pos) {
+		close_istream(ds->base);
+		ds->base = open_istream_pack_entry(ds->pack, ds->base_offset);
+		ds->base_pos = 0;
+		if (!ds->base)
+			return -1;
+	}
+	while (ds->base_pos < off) {
+		char skip[1024 * 16];
+		size_t to_skip = off - ds->base_pos;
+		ssize_t readlen;
+
+		if (sizeof(skip) < to_skip)
+			to_skip = sizeof(skip);
+		readlen = read_istream(ds->base, skip, to_skip);
+		if (readlen <= 0)
+			return -1;
+		ds->base_pos += readlen;
+	}
+	while (sz) {
+		ssize_t readlen = read_istream(ds->base, buf, sz);
+
+		if (readlen <= 0)
+			return -1;
+		ds->base_pos += readlen;
+		buf += readlen;
+		sz -= readlen;
+	}
+	return 0;
+}
+
+/* Read the next delta opcode, see patch_delta() for the format. */
+static int next_delta_op(struct git_istream *st)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	unsigned long left = st->size - ds->out_pos;
+	unsigned char cmd;
+
+	if (read_delta(st, &cmd, 1))
+		return -1;
+	if (cmd & 0x80) {
+		unsigned long off = 0, size = 0;
+		unsigned char c;
+		int i;
+
+		for (i = 0; i < 4; i++) {
+			if (!(cmd & (0x01 << i)))
+				continue;
+			if (read_delta(st, &c, 1))
+				return -1;
+			off |= (unsigned long)c << (i * 8);
+		}
+		for (i = 0; i < 3; i++) {
+			if (!(cmd & (0x10 << i)))
+				continue;
+			if (read_delta(st, &c, 1))
+				return -1;
+			size |= (unsigned long)c << (i * 8);
+		}
+		if (!size)
+			size = 0x10000;
+		if (unsigned_add_overflows(off, size) ||
+		    off + size > ds->base_size || size > left)
+			return -1;
+		ds->copy_off = off;
+		ds->copy_left = size;
+	} else if (cmd) {
+		if (cmd > left)
+			return -1;
+		ds->insert_left = cmd;
+	} else {
+		/* cmd == 0 is reserved for future encoding extensions */
+		return -1;
+	}
+	return 0;
+}
+
+static read_method_decl(pack_delta)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	size_t total_read = 0;
+
+	if (st->z_state == z_error)
+		return -1;
+
+	while (total_read < sz && ds->out_pos < st->size) {
+		size_t to_read = sz - total_read;
+
+		if (ds->copy_left) {
+			if (ds->copy_left < to_read)
+				to_read = ds->copy_left;
+			if (read_base(st, ds->copy_off, buf + total_read, to_read))
+				goto error;
+			ds->copy_off += to_read;
+			ds->copy_left -= to_read;
+		} else if (ds->insert_left) {
+			if (ds->insert_left < to_read)
+				to_read = ds->insert_left;
+			if (read_delta(st, buf + total_read, to_read))
+				goto error;
+			ds->insert_left -= to_read;
+		} else {
+			if (next_delta_op(st))
+				goto error;
+			continue;
+		}
+		total_read += to_read;
+		ds->out_pos += to_read;
+	}
+	return total_read;
+
+error:
+	close_deflated_stream(st);
+	st->z_state = z_error;
+	return -1;
+}
+
+static close_method_decl(pack_delta)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+
+	close_deflated_stream(st);
+	if (ds->base)
+		close_istream(ds->base);
+	free(ds->base_buf);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static open_method_decl(pack_delta)
+{
+	struct pack_delta_istream *ds = &st->u.in_pack_delta;
+	struct object_info base_oi = OBJECT_INFO_INIT;
+	struct pack_window *window = NULL;
+	enum object_type in_pack_type;
+	unsigned long delta_size, src_size;
+
+	memset(ds, 0, sizeof(*ds));
+	ds->pack = oi->u.packed.pack;
+	ds->pos = oi->u.packed.offset;
+
+	in_pack_type = unpack_object_header(ds->pack, &window, &ds->pos,
+					    &delta_size);
+	if (in_pack_type == OBJ_OFS_DELTA || in_pack_type == OBJ_REF_DELTA)
+		ds->base_offset = get_delta_base(ds->pack, &window, &ds->pos,
+						 in_pack_type,
+						 oi->u.packed.offset);
+	unuse_pack(&window);
+	if (!ds->base_offset)
+		return -1;
+
+	base_oi.sizep = &ds->base_size;
+	if (packed_object_info(ds->pack, ds->base_offset, &base_oi) < 0)
+		return -1;
+
+	memset(&st->z, 0, sizeof(st->z));
+	git_inflate_init(&st->z);
+	st->z_state = z_used;
+
+	/* the delta starts with the sizes of the base and of the result */
+	if (read_delta_size(st, &src_size) ||
+	    src_size != ds->base_size ||
+	    read_delta_size(st, &st->size))
+		goto error;
+
+	if (ds->base_size <= big_file_threshold) {
+		enum object_type base_type;
+		unsigned long size;
+
+		ds->base_buf = unpack_entry(ds->pack, ds->base_offset,
+					    &base_type, &size);
+		if (!ds->base_buf || size != ds->base_size)
+			goto error;
+	} else {
+		ds->base = open_istream_pack_entry(ds->pack, ds->base_offset);
+		if (!ds->base)
+			goto error;
+	}
+
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+error:
+	close_deflated_stream(st);
+	free(ds->base_buf);
+	return -1;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
@@ -0,0 +1,57 @@
+#include "cache.h"
+#include "blob.h"
+#include "packfile.h"
+#include "run-command.h"
+
+/*
+ * Run a sequence of commands against the loose object cache of one
+ * process:
+ *
+ *   has <object>      print whether a quick lookup finds the object
+ *   nonlocal <object> print whether it is loose in an alternate
+ *   write <text>      write <text> as a blob and print its name
+ *   run <command>     run a shell command, e.g. one writing objects
+ *   reprepare         forget what we know about the object store
+ */
+int cmd_main(int argc, const char **argv)
+{
+	int i;
+
+	setup_git_directory();
+
+	for (i = 1; i < argc; i++) {
+		struct object_id oid;
+
+		if (!strcmp(argv[i], "has") && i + 1 < argc) {
+			if (get_oid_hex(argv[++i], &oid))
+				die("not an object name: %s", argv[i]);
+			printf("%s %s\n", argv[i],
+			       has_sha1_file_with_flags(oid.hash,
+							OBJECT_INFO_QUICK) ?
+			       "yes" : "no");
+		} else if (!strcmp(argv[i], "nonlocal") && i + 1 < argc) {
+			if (get_oid_hex(argv[++i], &oid))
+				die("not an object name: %s", argv[i]);
+			printf("%s %s\n", argv[i],
+			       has_loose_object_nonlocal(oid.hash) ?
+			       "yes" : "no");
+		} else if (!strcmp(argv[i], "write") && i + 1 < argc) {
+			const char *text = argv[++i];
+
+			if (write_sha1_file(text, strlen(text), blob_type,
+					    oid.hash))
+				die("unable to write blob");
+			printf("%s\n", oid_to_hex(&oid));
+		} else if (!strcmp(argv[i], "run") && i + 1 < argc) {
+			const char *cmd[] = { argv[++i], NULL };
+
+			if (run_command_v_opt(cmd, RUN_USING_SHELL))
+				die("command failed: %s", argv[i]);
+		} else if (!strcmp(argv[i], "reprepare")) {
+			reprepare_packed_git();
+		} else
+			die("unknown command: %s", argv[i]);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -28,4 +28,9 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+# a cache much smaller than the working set puts the eviction policy to work
+test_perf 'log -S, small cache' '
+	git -c core.deltaBaseCacheLimit=2m log --raw -Sfoo >/dev/null
+'
+
 test_done
@@ -73,6 +73,18 @@ do
 		git rev-list --objects --all >/dev/null
 	'
 
+	test_expect_success "write multi-pack-index ($nr_packs)" '
+		git multi-pack-index write
+	'
+
+	test_perf "rev-list with midx ($nr_packs)" '
+		git -c core.multiPackIndex=true rev-list --objects --all >/dev/null
+	'
+
+	test_expect_success "remove multi-pack-index ($nr_packs)" '
+		rm -f .git/objects/pack/multi-pack-index
+	'
+
 	# This simulates the interesting part of the repack, which is the
 	# actual pack generation, without smudging the on-disk setup
 	# between trials.
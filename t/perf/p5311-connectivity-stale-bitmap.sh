@@ -0,0 +1,41 @@
+#!/bin/sh
+
+test_description='connectivity check against a stale bitmap
+
+The receiving repository has a bitmap that covers only old history; the
+commits since then are reachable from its refs but not from any bitmapped
+commit, as if they had been pushed up incrementally since the last repack.
+Fetching a single new commit into it then has to decide connectivity
+either by walking all of that history in-process or by handing the tips
+to rev-list, which stops at our refs.
+'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'create repository with a stale bitmap' '
+	cutoff=$(git rev-list HEAD~1000 -1) &&
+	tip=$(git rev-parse HEAD~1) &&
+	git clone --bare --no-local . stale.git &&
+	(
+		cd stale.git &&
+		git for-each-ref --format="delete %(refname)" refs/ |
+		git update-ref --stdin &&
+		git update-ref refs/heads/master $cutoff &&
+		git repack -Adb &&
+		git update-ref refs/heads/master $tip
+	)
+'
+
+test_perf 'fetch one commit past a stale bitmap' '
+	git -C stale.git update-ref -d refs/heads/new &&
+	git -C stale.git fetch --quiet "$PWD" HEAD:refs/heads/new
+'
+
+test_perf 'fetch one commit past a stale bitmap (unbounded walk)' '
+	git -C stale.git update-ref -d refs/heads/new &&
+	GIT_TEST_CONNECTIVITY_WALK_LIMIT=4294967295 \
+		git -C stale.git fetch --quiet "$PWD" HEAD:refs/heads/new
+'
+
+test_done
@@ -573,4 +573,70 @@ test_expect_success 'cat-file --batch-all-objects shows all objects' '
 	test_cmp expect actual
 '
 
+test_expect_success 'cat-file --batch --buffer reads in pack order, prints in input order' '
+	git init buffer &&
+	(
+		cd buffer &&
+		for i in $(test_seq 1 20)
+		do
+			test_seq 1 $((100 * $i)) >file &&
+			git add file &&
+			git commit -qm "commit $i" || return 1
+		done &&
+		git repack -adq &&
+		echo loose >loose &&
+		git hash-object -w loose &&
+		git rev-list --objects --all >objects &&
+		cut -d" " -f1 objects | sort -r >input &&
+		echo HEAD~3:file >>input &&
+		echo missing >>input &&
+		git rev-parse HEAD:file >>input &&
+		git cat-file --batch <input >expect &&
+		git cat-file --batch --buffer <input >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'cat-file --batch --buffer reports an ambiguous name once' '
+	(
+		cd buffer &&
+		# both blobs have object names starting with 6bb2
+		echo 195 | git hash-object -w --stdin &&
+		echo 389 | git hash-object -w --stdin &&
+		echo 6bb2 >input &&
+		git cat-file --batch <input >expect 2>expect.err &&
+		git cat-file --batch --buffer <input >actual 2>actual.err &&
+		test_cmp expect actual &&
+		test_cmp expect.err actual.err &&
+		test_i18ngrep "short SHA1 6bb2 is ambiguous" actual.err
+	)
+'
+
+test_expect_success 'cat-file --unordered shows all objects' '
+	git -C all-two cat-file --batch-all-objects --unordered \
+				--batch-check="%(objectname)" >actual.unsorted &&
+	sort <actual.unsorted >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --batch --unordered shows each object once' '
+	(
+		cd buffer &&
+		git rev-parse HEAD HEAD:file |
+		git pack-objects .git/objects/pack/pack &&
+		git cat-file --batch-all-objects --batch-check >expect.unsorted &&
+		git cat-file --batch-all-objects --unordered \
+			--batch-check >order &&
+		sort <order >actual.unsorted &&
+		test_cmp expect.unsorted actual.unsorted &&
+		cut -d" " -f1 order | git cat-file --batch >expect &&
+		git cat-file --batch-all-objects --unordered --batch >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'cat-file --unordered requires --batch-all-objects' '
+	test_must_fail git cat-file --batch-check --unordered </dev/null
+'
+
 test_done
@@ -194,6 +194,68 @@ test_expect_success 'pack-objects with large loose object' '
 	test_cmp huge actual
 '
 
+test_expect_success 'large deltified blobs are streamed' '
+	test_create_repo delta &&
+	(
+		cd delta &&
+		printf "%2000000s" Z >base &&
+		{ echo head && cat base && echo tail; } >result &&
+		{ cat result && cat base; } >result2 &&
+		GIT_ALLOC_LIMIT=0 &&
+		export GIT_ALLOC_LIMIT &&
+		git config core.bigfilethreshold 10m &&
+		B=$(git hash-object -w base) &&
+		R=$(git hash-object -w result) &&
+		R2=$(git hash-object -w result2) &&
+		printf "%s\n" $B $R $R2 |
+		git pack-objects .git/objects/pack/pack &&
+		git prune-packed &&
+		git verify-pack -v .git/objects/pack/pack-*.idx >list &&
+		git config --unset core.bigfilethreshold &&
+		GIT_ALLOC_LIMIT=1500k &&
+		grep "^$B blob .* 1 $R2$" list &&
+		grep "^$R blob .* 1 $R2$" list &&
+		git cat-file blob $B >actual &&
+		test_cmp base actual &&
+		git cat-file blob $R >actual &&
+		test_cmp result actual
+	)
+'
+
+test_expect_success 'large delta chains and backward copies are streamed' '
+	test_create_repo chain &&
+	(
+		cd chain &&
+		test-genrandom one 1000000 >p1 &&
+		test-genrandom two 1000000 >p2 &&
+		test-genrandom three 1000000 >p3 &&
+		test-genrandom four 500000 >p4 &&
+		cat p1 p2 p3 >x1 &&
+		# copies from the middle of x1 first, then from its start
+		cat p2 p1 p4 >x2 &&
+		# only x2 can be a base for x3
+		{ cat p4 && echo end; } >x3 &&
+		GIT_ALLOC_LIMIT=0 &&
+		export GIT_ALLOC_LIMIT &&
+		git config core.bigfilethreshold 10m &&
+		X1=$(git hash-object -w x1) &&
+		X2=$(git hash-object -w x2) &&
+		X3=$(git hash-object -w x3) &&
+		printf "%s\n" $X1 $X2 $X3 |
+		git pack-objects .git/objects/pack/pack &&
+		git prune-packed &&
+		git verify-pack -v .git/objects/pack/pack-*.idx >list &&
+		git config --unset core.bigfilethreshold &&
+		GIT_ALLOC_LIMIT=1500k &&
+		grep "^$X2 blob .* 1 $X1$" list &&
+		grep "^$X3 blob .* 2 $X2$" list &&
+		git cat-file blob $X2 >actual &&
+		test_cmp x2 actual &&
+		git cat-file blob $X3 >actual &&
+		test_cmp x3 actual
+	)
+'
+
 test_expect_success 'tar achiving' '
 	git archive --format=tar HEAD >/dev/null
 '
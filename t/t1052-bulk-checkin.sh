@@ -0,0 +1,81 @@
+#!/bin/sh
+
+test_description='adding many small blobs with core.bulkCheckin'
+
+. ./test-lib.sh
+
+count_loose () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l
+}
+
+count_packs () {
+	ls .git/objects/pack/pack-*.pack 2>/dev/null | wc -l
+}
+
+test_expect_success setup '
+	for i in $(test_seq 1 50)
+	do
+		echo "content $i" >file-$i || return 1
+	done &&
+	echo "content 1" >dup &&
+	printf "a\r\nb\r\n" >crlf
+'
+
+test_expect_success 'add without core.bulkCheckin writes loose objects' '
+	test_when_finished "rm -rf .git/objects/?? .git/index" &&
+	git add file-1 file-2 &&
+	test $(count_loose) = 2 &&
+	test $(count_packs) = 0
+'
+
+test_expect_success 'add with core.bulkCheckin writes a single pack' '
+	git -c core.bulkCheckin=true add file-* dup &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1 &&
+	git verify-pack -v .git/objects/pack/pack-*.idx >actual &&
+	test $(grep -c " blob " actual) = 50 &&
+	git ls-files -s >index &&
+	while read mode sha1 stage path
+	do
+		git cat-file -e $sha1 || return 1
+	done <index
+'
+
+test_expect_success 'existing blobs are not written again' '
+	echo "content 51" >file-51 &&
+	git -c core.bulkCheckin=true add file-* &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 2 &&
+	for p in .git/objects/pack/pack-*.idx
+	do
+		git verify-pack -v $p || return 1
+	done >actual &&
+	test $(grep -c " blob " actual) = 51
+'
+
+test_expect_success 'converted content goes to the pack' '
+	git -c core.bulkCheckin=true -c core.autocrlf=true add crlf &&
+	test $(count_loose) = 0 &&
+	test "$(git cat-file blob :crlf)" = "$(printf "a\nb")"
+'
+
+test_expect_success 'update-index with core.bulkCheckin writes a single pack' '
+	rm -rf .git/objects/pack .git/index &&
+	mkdir .git/objects/pack &&
+	git ls-files -o --exclude-standard -- file-* >list &&
+	git -c core.bulkCheckin=true update-index --add --stdin <list &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) = 1 &&
+	git fsck
+'
+
+test_expect_success 'pack.packSizeLimit splits the pack' '
+	rm -rf .git/objects/pack .git/index &&
+	mkdir .git/objects/pack &&
+	git -c core.bulkCheckin=true -c pack.packSizeLimit=200 add file-* &&
+	test $(count_loose) = 0 &&
+	test $(count_packs) -gt 1 &&
+	git fsck
+'
+
+test_done
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+test_description='existence checks answered from the loose object cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init alt &&
+	git init repo &&
+	echo "$(pwd)/alt/.git/objects" >repo/.git/objects/info/alternates
+'
+
+test_expect_success 'an object we write is seen at once' '
+	oid=$(printf written | git -C repo hash-object --stdin) &&
+	(
+		cd repo &&
+		# the first lookup reads the fan-out directory into the cache
+		test-loose-cache has $oid write written has $oid >../actual
+	) &&
+	cat >expect <<-EOF &&
+	$oid no
+	$oid
+	$oid yes
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'an object written by another process is seen after reprepare' '
+	oid=$(echo other | git -C repo hash-object --stdin) &&
+	(
+		cd repo &&
+		test-loose-cache has $oid \
+			run "echo other | git hash-object -w --stdin >/dev/null" \
+			reprepare has $oid >../actual
+	) &&
+	cat >expect <<-EOF &&
+	$oid no
+	$oid yes
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a loose object of an alternate is found' '
+	oid=$(echo alternate | git -C alt hash-object -w --stdin) &&
+	(
+		cd repo &&
+		test-loose-cache has $oid nonlocal $oid >../actual
+	) &&
+	cat >expect <<-EOF &&
+	$oid yes
+	$oid yes
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch finds objects loose in an alternate' '
+	(
+		cd alt &&
+		test_commit one &&
+		git count-objects -v >count &&
+		grep "^in-pack: 0" count
+	) &&
+	(
+		cd repo &&
+		GIT_TRACE_PACKET="$(pwd)/../trace" \
+			git fetch ../alt master:refs/heads/from-alt &&
+		git rev-parse --verify from-alt
+	) &&
+	! grep "want " trace
+'
+
+test_expect_success 'fetch-pack finds objects loose in an alternate' '
+	(
+		cd alt &&
+		test_commit two
+	) &&
+	(
+		cd repo &&
+		GIT_TRACE_PACKET="$(pwd)/../trace" \
+			git fetch-pack ../alt refs/heads/master >out &&
+		grep "refs/heads/master" out
+	) &&
+	! grep "want " trace
+'
+
+test_done
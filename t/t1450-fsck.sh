@@ -630,6 +630,36 @@ test_expect_success 'fsck errors in packed objects' '
 	! grep corrupt out
 '
 
+test_expect_success 'fsck checks packed objects in threads' '
+	git cat-file commit HEAD >basis &&
+	sed "s/</one/" basis >one &&
+	one=$(git hash-object -t commit -w one) &&
+	sed "s/</two/" basis >two &&
+	two=$(git hash-object -t commit -w two) &&
+	for i in $(test_seq 1 600)
+	do
+		echo "blob $i" | git hash-object -w --stdin || return 1
+	done >blobs &&
+	pack=$(
+		{
+			echo $one &&
+			cat blobs &&
+			echo $two
+		} | git pack-objects .git/objects/pack/pack
+	) &&
+	test_when_finished "rm -f .git/objects/pack/pack-$pack.*" &&
+	git prune-packed &&
+	test_must_fail git fsck --threads=4 --progress 2>out &&
+	grep "error in commit $one.* - bad name" out &&
+	grep "error in commit $two.* - bad name" out &&
+	test_i18ngrep "Checking objects: 100%" out &&
+	! grep corrupt out &&
+	test_must_fail env GIT_FORCE_THREADS=1 git fsck --threads=1 2>out &&
+	grep "error in commit $one.* - bad name" out &&
+	grep "error in commit $two.* - bad name" out &&
+	! grep corrupt out
+'
+
 test_expect_success 'fsck fails on corrupt packfile' '
 	hsh=$(git commit-tree -m mycommit HEAD^{tree}) &&
 	pack=$(echo $hsh | git pack-objects .git/objects/pack/pack) &&
@@ -386,6 +386,108 @@ test_expect_success 'index-pack with --strict' '
 	)
 '
 
+test_expect_success PTHREADS 'index-pack hashes objects in threads' '
+	for p in test-1-${packname_1} test-2-${packname_2} test-3-${packname_3}
+	do
+		GIT_FORCE_THREADS=1 git index-pack --threads=1 -o tmp.idx $p.pack &&
+		cmp tmp.idx $p.idx &&
+		git index-pack --threads=4 -o tmp.idx $p.pack &&
+		cmp tmp.idx $p.idx || return 1
+	done &&
+	test_create_repo test-9 &&
+	(
+		cd test-9 &&
+		git index-pack --threads=4 --strict --stdin <../test-5-$PACK5.pack &&
+		git ls-tree -r $LIST
+	)
+'
+
+test_expect_success 'index-pack --low-memory' '
+	for p in test-1-${packname_1} test-2-${packname_2} test-3-${packname_3}
+	do
+		git index-pack --low-memory -o tmp.idx $p.pack &&
+		cmp tmp.idx $p.idx &&
+		git -c pack.indexLowMemory=true index-pack --threads=4 \
+			-o tmp.idx $p.pack &&
+		cmp tmp.idx $p.idx || return 1
+	done &&
+	test_create_repo test-10 &&
+	(
+		cd test-10 &&
+		git index-pack --low-memory --strict --stdin \
+			<../test-5-$PACK5.pack &&
+		git ls-tree -r $LIST &&
+		ls .git/objects/pack >files &&
+		! grep _tables_ files
+	)
+'
+
+test_expect_success 'index-pack --low-memory --fix-thin' '
+	test_create_repo thin &&
+	(
+		cd thin &&
+		test_seq 1000 >file &&
+		git add file &&
+		test_tick &&
+		git commit -m one &&
+		git tag one &&
+		echo 1001 >>file &&
+		git commit -a -m two &&
+		git tag two &&
+		git rev-list --objects two ^one >objects &&
+		git pack-objects --thin --stdout --revs >../thin.pack <<-EOF
+		two
+		^one
+		EOF
+	) &&
+	test_create_repo thin-dst &&
+	(
+		cd thin-dst &&
+		git --git-dir=../thin/.git rev-list --objects one |
+		git --git-dir=../thin/.git pack-objects --stdout |
+		git index-pack --stdin &&
+		git index-pack --low-memory --stdin --fix-thin <../thin.pack >out &&
+		git verify-pack -v .git/objects/pack/pack-$(cut -f2 out).idx >list &&
+		grep "^$(git --git-dir=../thin/.git rev-parse two:file) blob .* 1 " list &&
+		git cat-file --batch-check <../thin/objects &&
+		git fsck
+	)
+'
+
+test_expect_success PTHREADS 'compressing objects in threads gives the same pack' '
+	git pack-objects --window=0 --no-reuse-object --threads=1 \
+		--stdout <obj-list >single.pack &&
+	git pack-objects --window=0 --no-reuse-object --threads=4 \
+		--stdout <obj-list >threaded.pack &&
+	cmp single.pack threaded.pack
+'
+
+test_expect_success PTHREADS 'checking objects in threads gives the same pack' '
+	test_create_repo many &&
+	(
+		cd many &&
+		awk "BEGIN {
+			for (i = 1; i <= 3000; i++) {
+				f = \"blob-\" i;
+				for (j = 1; j <= 40; j++)
+					print \"line \" j >f;
+				print i >f;
+				close(f);
+			}
+		}" &&
+		ls blob-* | git hash-object -w --stdin-paths >objects &&
+		git pack-objects .git/objects/pack/pack <objects &&
+		git prune-packed &&
+		git verify-pack -v .git/objects/pack/pack-*.idx >list &&
+		grep "chain length = 1:" list &&
+		git pack-objects --window=0 --threads=1 --stdout \
+			<objects >single.pack &&
+		git pack-objects --window=0 --threads=4 --stdout \
+			<objects >threaded.pack &&
+		cmp single.pack threaded.pack
+	)
+'
+
 test_expect_success 'honor pack.packSizeLimit' '
 	git config pack.packSizeLimit 3m &&
 	packname_10=$(git pack-objects test-10 <obj-list) &&
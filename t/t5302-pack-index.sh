@@ -73,6 +73,43 @@ test_expect_success 'index-pack --verify on index version 2' '
 	git index-pack --verify "test-2-${pack2}.pack"
 '
 
+test_expect_success 'pack-objects with index version 3' '
+	pack3=$(git pack-objects --index-version=3 test-3 <obj-list) &&
+	git verify-pack -v "test-3-${pack3}.pack" &&
+	cmp "test-1-${pack1}.pack" "test-3-${pack3}.pack"
+'
+
+test_expect_success 'index-pack with index version 3' '
+	git index-pack --index-version=3 -o 3.idx "test-1-${pack1}.pack" &&
+	cmp "test-3-${pack3}.idx" 3.idx &&
+	git index-pack --verify "test-3-${pack3}.pack"
+'
+
+test_expect_success 'index v3 records the type and size of every object' '
+	git show-index <2.idx >v2 &&
+	git show-index <3.idx >v3 &&
+	cut -d" " -f1-3 v3 >v3-prefix &&
+	test_cmp v2 v3-prefix &&
+	while read offset sha1 crc type size delta
+	do
+		echo "$sha1 $type $size" || return 1
+	done <v3 | sort >actual &&
+	sort obj-list | git cat-file --batch-check >expect &&
+	test_cmp expect actual &&
+	grep " delta$" v3
+'
+
+test_expect_success 'type and size are answered from index v3' '
+	test_when_finished "rm -rf v3-repo" &&
+	git init --bare v3-repo &&
+	cp "test-3-${pack3}.pack" v3-repo/objects/pack/pack-${pack3}.pack &&
+	cp "test-3-${pack3}.idx" v3-repo/objects/pack/pack-${pack3}.idx &&
+	git --git-dir=v3-repo cat-file --batch-check <obj-list >actual &&
+	git cat-file --batch-check <obj-list >expect &&
+	test_cmp expect actual &&
+	git --git-dir=v3-repo fsck
+'
+
 test_expect_success \
     'pack-objects --index-version=2, is not accepted' \
     'test_must_fail git pack-objects --index-version=2, test-3 <obj-list'
@@ -311,4 +311,29 @@ test_expect_success \
      test_must_fail git cat-file blob $blob_2 > /dev/null &&
      test_must_fail git cat-file blob $blob_3 > /dev/null'
 
+test_expect_success 'objects straddling a pack window read correctly' '
+	create_new_pack &&
+	test-genrandom "straddle" 40000 >file_4 &&
+	blob_4=$(git hash-object -w file_4) &&
+	printf "$blob_1\n$blob_4\n$blob_2\n$blob_3\n" |
+		git pack-objects .git/objects/pack/straddle &&
+	git prune-packed &&
+	for i in 1 2 3 4
+	do
+		eval "blob=\$blob_$i" &&
+		git -c core.packedGitWindowSize=8k cat-file blob $blob >actual &&
+		test_cmp file_$i actual || return 1
+	done
+'
+
+test_expect_success 'corrupt object straddling a pack window fails unpack' '
+	pack=$(ls .git/objects/pack/straddle-*.pack) &&
+	pack=${pack%.pack} &&
+	printf "\377\377\377\377" | do_corrupt_object $blob_4 20000 &&
+	test_must_fail git -c core.packedGitWindowSize=8k \
+		cat-file blob $blob_4 >/dev/null &&
+	git -c core.packedGitWindowSize=8k cat-file blob $blob_1 >actual &&
+	test_cmp file_1 actual
+'
+
 test_done
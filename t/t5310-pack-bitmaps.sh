@@ -331,4 +331,135 @@ test_expect_success 'pack reuse respects --incremental' '
 	git show-index <empty.idx >actual &&
 	test_cmp expect actual
 '
+
+test_expect_success 'repack writes a bitmap commit lookup table' '
+	git -c pack.writeBitmapLookupTable=false repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	size_without=$(wc -c <$bitmap) &&
+	git config pack.writeBitmapLookupTable true &&
+	git repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	size_with=$(wc -c <$bitmap) &&
+	test $size_with -gt $size_without &&
+	blob=$(git rev-parse tagged-blob)
+'
+
+test_expect_success 'rev-list --test-bitmap verifies bitmaps (lookup table)' '
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap other
+'
+
+test_expect_success 'lookup table gives the same answers as a full load' '
+	git rev-list --objects --use-bitmap-index master other >tmp &&
+	cut -d" " -f1 <tmp | sort >actual &&
+	GIT_TEST_READ_COMMIT_TABLE=0 \
+		git rev-list --objects --use-bitmap-index master other >tmp &&
+	cut -d" " -f1 <tmp | sort >expect &&
+	test_cmp expect actual
+'
+
+rev_list_tests 'lookup table'
+
+test_expect_success 'full repack reuses bitmaps loaded through the lookup table' '
+	test_commit after-lookup-table &&
+	git repack -adb &&
+	git rev-list --test-bitmap HEAD
+'
+
+bitmap_options () {
+	od -An -tx1 -j6 -N2 "$1" | tr -d " "
+}
+
+test_expect_success 'name-hash cache is written by default' '
+	git init hash-cache &&
+	(
+		cd hash-cache &&
+		test_commit one &&
+		git repack -adb &&
+		bitmap_options .git/objects/pack/*.bitmap >actual &&
+		echo 0005 >expect &&
+		test_cmp expect actual &&
+		git -c pack.writeBitmapHashCache=false repack -adb &&
+		bitmap_options .git/objects/pack/*.bitmap >actual &&
+		echo 0001 >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'pack reuse with gaps produces a valid pack' '
+	git init reuse-gaps &&
+	(
+		cd reuse-gaps &&
+		test-genrandom base 8192 >file &&
+		git add file &&
+		git commit -m base &&
+		for i in $(test_seq 1 20)
+		do
+			git checkout -q -B side-$i master &&
+			{ cat file && echo side $i; } >file.tmp &&
+			mv file.tmp file &&
+			git commit -qam "side $i" &&
+			git checkout -q master &&
+			{ cat file && echo master $i; } >file.tmp &&
+			mv file.tmp file &&
+			git commit -qam "master $i" || return 1
+		done &&
+		git repack -adb &&
+		for want in master side-7 "side-3 side-12"
+		do
+			git rev-list --objects $want >tmp &&
+			cut -d" " -f1 tmp | sort >expect &&
+			echo $want | tr " " "\n" |
+			git pack-objects --delta-base-offset --revs --stdout >gaps.pack &&
+			rm -f gaps.idx &&
+			git index-pack --strict gaps.pack &&
+			git show-index <gaps.idx >tmp &&
+			cut -d" " -f2 tmp | sort >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
+test_expect_success 'connectivity is checked in-process with bitmaps' '
+	git clone --bare . connected.git &&
+	git -C connected.git repack -adb &&
+	test_commit connected &&
+	GIT_TRACE="$PWD/trace" \
+		git -C connected.git fetch "$PWD" HEAD:refs/heads/connected &&
+	! grep rev-list trace &&
+	git rev-parse HEAD >expect &&
+	git -C connected.git rev-parse connected >actual &&
+	test_cmp expect actual &&
+	git -C connected.git fsck
+'
+
+test_expect_success 'long walks past a stale bitmap fall back to rev-list' '
+	test_commit stale-1 &&
+	test_commit stale-2 &&
+	GIT_TRACE="$PWD/trace-stale" GIT_TEST_CONNECTIVITY_WALK_LIMIT=2 \
+		git -C connected.git fetch "$PWD" HEAD:refs/heads/stale &&
+	grep rev-list trace-stale &&
+	git rev-parse HEAD >expect &&
+	git -C connected.git rev-parse stale >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'in-process connectivity check notices missing objects' '
+	git init broken &&
+	(
+		cd broken &&
+		echo hello >greetings &&
+		git add greetings &&
+		git commit -m greetings &&
+		S=$(git rev-parse :greetings | sed -e "s|^..|&/|") &&
+		X=$(echo bye | git hash-object -w --stdin | sed -e "s|^..|&/|") &&
+		mv -f .git/objects/$X .git/objects/$S
+	) &&
+	test_must_fail env GIT_TRACE="$PWD/trace" \
+		git -C broken push ../connected.git HEAD:refs/heads/broken 2>err &&
+	grep "missing necessary objects" err &&
+	! grep rev-list trace &&
+	test_must_fail git -C connected.git rev-parse --verify broken
+'
+
 test_done
@@ -94,4 +94,12 @@ test_expect_success '--depth limits depth' '
 	test_i18ncmp expect actual
 '
 
+test_expect_success '--depth is capped at 4095' '
+	pack=$(git pack-objects --all --depth=5000 </dev/null pack 2>err) &&
+	test_i18ngrep "forcing 4095" err &&
+	echo 9 >expect &&
+	max_chain pack-$pack.pack >actual &&
+	test_i18ncmp expect actual
+'
+
 test_done
@@ -0,0 +1,233 @@
+#!/bin/sh
+
+test_description='multi-pack-indexes'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_read_expect () {
+	NUM_PACKS=$1
+	NUM_OBJECTS=$2
+	NUM_CHUNKS=$3
+	OBJECT_DIR=$4
+	EXTRA_CHUNKS="$5"
+	{
+		cat <<-EOF &&
+		header: 4d494458 1 1 $NUM_CHUNKS 0
+		chunks: pack-names oid-fanout oid-lookup object-offsets$EXTRA_CHUNKS
+		num_objects: $NUM_OBJECTS
+		packs:
+		EOF
+		if test $NUM_PACKS -ge 1
+		then
+			ls $OBJECT_DIR/pack | grep "\.idx\$" | sort
+		fi
+	} >expect &&
+	git multi-pack-index --object-dir=$OBJECT_DIR read >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'write midx with no packs' '
+	test_when_finished "rm -f $objdir/pack/multi-pack-index" &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 0 0 4 $objdir
+'
+
+generate_objects () {
+	i=$1
+	iii=$(printf '%03i' $i)
+	{
+		test-genrandom "bar" 200 &&
+		test-genrandom "baz $iii" 50
+	} >wide_delta_$iii &&
+	{
+		test-genrandom "foo"$i 100 &&
+		test-genrandom "foo"$(( $i + 1 )) 100 &&
+		test-genrandom "foo"$(( $i + 2 )) 100
+	} >deep_delta_$iii &&
+	{
+		echo $iii &&
+		test-genrandom "$iii" 8192
+	} >file_$iii &&
+	git update-index --add file_$iii deep_delta_$iii wide_delta_$iii
+}
+
+commit_and_list_objects () {
+	{
+		echo 101 &&
+		test-genrandom 100 8192;
+	} >file_101 &&
+	git update-index --add file_101 &&
+	tree=$(git write-tree) &&
+	commit=$(git commit-tree $tree -p HEAD</dev/null) &&
+	{
+		echo $tree &&
+		git ls-tree $tree | sed -e "s/.* \\([0-9a-f]*\\)	.*/\\1/"
+	} >obj-list &&
+	git reset --hard $commit
+}
+
+test_expect_success 'create objects' '
+	test_commit initial &&
+	for i in $(test_seq 1 5)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'write midx with one v1 pack' '
+	pack=$(git pack-objects --index-version=1 $objdir/pack/test <obj-list) &&
+	test_when_finished rm $objdir/pack/test-$pack.pack \
+		$objdir/pack/test-$pack.idx $objdir/pack/multi-pack-index &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 1 18 4 $objdir
+'
+
+midx_git_two_modes () {
+	INPUT=${2:-/dev/null}
+	git -c core.multiPackIndex=false $1 <$INPUT >expect &&
+	git -c core.multiPackIndex=true $1 <$INPUT >actual &&
+	test_cmp expect actual
+}
+
+compare_results_with_midx () {
+	MSG=$1
+	test_expect_success "check normal git operations: $MSG" '
+		midx_git_two_modes "rev-list --objects --all" &&
+		midx_git_two_modes "log --raw" &&
+		midx_git_two_modes "count-objects --verbose" &&
+		midx_git_two_modes "cat-file --batch-all-objects --batch-check" &&
+		git rev-list --objects --all | cut -d" " -f1 >all-objects &&
+		midx_git_two_modes "cat-file --batch-check" all-objects &&
+		midx_git_two_modes "cat-file --batch" all-objects
+	'
+}
+
+test_expect_success 'write midx with one v2 pack' '
+	git pack-objects --index-version=2,0x40 $objdir/pack/test <obj-list &&
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 1 18 4 $objdir
+'
+
+compare_results_with_midx "one v2 pack"
+
+test_expect_success 'add more objects' '
+	for i in $(test_seq 6 10)
+	do
+		generate_objects $i
+	done &&
+	commit_and_list_objects
+'
+
+test_expect_success 'objects in packs added after the midx are found' '
+	git pack-objects $objdir/pack/test-extra <obj-list &&
+	git multi-pack-index --object-dir=$objdir read >out &&
+	grep "^num_objects: 18\$" out &&
+	! grep test-extra out &&
+	midx_git_two_modes "cat-file --batch-check" obj-list
+'
+
+compare_results_with_midx "pack not in the midx"
+
+test_expect_success 'write midx with two packs' '
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 2 34 4 $objdir
+'
+
+compare_results_with_midx "two packs"
+
+test_expect_success 'add more packs' '
+	for j in $(test_seq 11 20)
+	do
+		generate_objects $j &&
+		commit_and_list_objects &&
+		git pack-objects --index-version=2 $objdir/pack/test-pack <obj-list
+	done
+'
+
+compare_results_with_midx "mixed mode (two packs + extra)"
+
+test_expect_success 'write midx with twelve packs' '
+	git multi-pack-index --object-dir=$objdir write &&
+	midx_read_expect 12 74 4 $objdir
+'
+
+compare_results_with_midx "twelve packs"
+
+test_expect_success 'abbreviations are the same with and without midx' '
+	git rev-list --objects --all | cut -d" " -f1 >all-objects &&
+	while read oid
+	do
+		echo $(git rev-parse --short=4 $oid) || return 1
+	done <all-objects >expect &&
+	while read oid
+	do
+		echo $(git -c core.multiPackIndex=true rev-parse --short=4 $oid) ||
+		return 1
+	done <all-objects >actual &&
+	test_cmp expect actual &&
+	short=$(git rev-parse --short=4 HEAD) &&
+	git -c core.multiPackIndex=true rev-parse --verify $short^{commit} >actual &&
+	git rev-parse HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'verify multi-pack-index success' '
+	git multi-pack-index --object-dir=$objdir verify
+'
+
+test_expect_success 'count-objects does not report the midx as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'verify detects a corrupt multi-pack-index' '
+	test_when_finished "git multi-pack-index --object-dir=$objdir write" &&
+	midx=$objdir/pack/multi-pack-index &&
+	chmod u+w $midx &&
+	size=$(wc -c <$midx) &&
+	printf "\377\377\377\377" |
+	dd of=$midx bs=1 seek=$(($size - 40)) conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index --object-dir=$objdir verify
+'
+
+test_expect_success 'a midx naming a missing pack is ignored' '
+	test_when_finished "git multi-pack-index --object-dir=$objdir write" &&
+	git multi-pack-index --object-dir=$objdir write &&
+	idx=$(ls $objdir/pack/test-pack-*.idx | head -n 1) &&
+	pack=${idx%.idx}.pack &&
+	mkdir -p moved &&
+	mv $idx $pack moved/ &&
+	git -c core.multiPackIndex=true cat-file --batch-all-objects \
+		--batch-check >actual &&
+	git -c core.multiPackIndex=false cat-file --batch-all-objects \
+		--batch-check >expect &&
+	test_cmp expect actual &&
+	mv moved/* $objdir/pack/
+'
+
+test_expect_success 'repack --write-midx writes a multi-pack-index' '
+	git repack -ad --write-midx &&
+	midx_read_expect 1 $(git count-objects -v | sed -n "s/^in-pack: //p") 4 $objdir &&
+	git multi-pack-index --object-dir=$objdir verify
+'
+
+test_expect_success 'repack -d removes a stale multi-pack-index' '
+	test_commit after-repack &&
+	git repack -ad &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'midx of an alternate is used' '
+	git multi-pack-index --object-dir=$objdir write &&
+	git clone --shared . alt-user &&
+	(
+		cd alt-user &&
+		git -c core.multiPackIndex=true rev-list --objects --all >actual &&
+		git -c core.multiPackIndex=false rev-list --objects --all >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_done
@@ -0,0 +1,107 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in $(test_seq 1 20)
+	do
+		test_commit commit-$i || return 1
+	done &&
+	git repack -ad &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	rev=${pack%.pack}.rev &&
+	echo $pack >pack-name &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >expect.disk-sizes
+'
+
+test_expect_success 'no reverse index by default' '
+	test_path_is_missing $rev
+'
+
+test_expect_success 'index-pack --rev-index writes a reverse index' '
+	rm -f $rev &&
+	git index-pack --rev-index $pack &&
+	test_path_is_file $rev &&
+	size=$(wc -c <$rev) &&
+	nr=$(git show-index <${pack%.pack}.idx | wc -l) &&
+	test $size = $((12 + 4 * $nr + 40))
+'
+
+test_expect_success 'index-pack --no-rev-index overrides configuration' '
+	rm -f $rev &&
+	git -c pack.writeReverseIndex=true index-pack --no-rev-index $pack &&
+	test_path_is_missing $rev &&
+	git -c pack.writeReverseIndex=true index-pack $pack &&
+	test_path_is_file $rev
+'
+
+test_expect_success 'index-pack --stdin writes a reverse index' '
+	git init stdin &&
+	git -C stdin -c pack.writeReverseIndex=true index-pack --stdin <$pack &&
+	ls stdin/.git/objects/pack >actual &&
+	grep "\.rev\$" actual
+'
+
+test_expect_success 'disk sizes agree with the reverse index' '
+	test_path_is_file $rev &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect.disk-sizes actual
+'
+
+test_expect_success 'index-pack --verify checks the reverse index' '
+	git index-pack --verify $pack &&
+	chmod u+w $rev &&
+	cp $rev rev.bak &&
+	printf "\0\0\0\0" | dd of=$rev bs=1 seek=12 conv=notrunc 2>/dev/null &&
+	test_must_fail git index-pack --verify $pack &&
+	mv rev.bak $rev
+'
+
+test_expect_success 'a reverse index of the wrong size is ignored' '
+	test_when_finished "mv rev.bak $rev" &&
+	cp $rev rev.bak &&
+	chmod u+w $rev &&
+	printf "junk" >>$rev &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual 2>err &&
+	test_cmp expect.disk-sizes actual &&
+	test_i18ngrep "reverse-index file .* has wrong size" err
+'
+
+test_expect_success 'pack-objects and repack write reverse indexes' '
+	git -c pack.writeReverseIndex=true repack -adb &&
+	test_path_is_missing $rev &&
+	ls $packdir/pack-*.rev >revs &&
+	test_line_count = 1 revs &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect.disk-sizes actual
+'
+
+test_expect_success 'bitmaps use the reverse index' '
+	git rev-list --use-bitmap-index --objects --all >bitmap.out &&
+	git rev-list --objects --all >plain.out &&
+	cut -d" " -f1 bitmap.out | sort >expect &&
+	cut -d" " -f1 plain.out | sort >actual &&
+	test_cmp expect actual &&
+	git pack-objects --all --stdout </dev/null >all.pack &&
+	git index-pack --stdin <all.pack
+'
+
+test_expect_success 'repack -d removes stale reverse indexes' '
+	test_commit more &&
+	git repack -ad &&
+	ls $packdir >files &&
+	! grep "\.rev\$" files &&
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_done
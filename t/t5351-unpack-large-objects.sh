@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='git unpack-objects with large objects'
+
+. ./test-lib.sh
+
+prepare_dest () {
+	test_when_finished "rm -rf dest.git" &&
+	git init --bare dest.git &&
+	git -C dest.git config core.bigFileThreshold "$1"
+}
+
+test_expect_success 'setup' '
+	test-genrandom foo 2000000 >big-blob &&
+	echo small >small &&
+	git add big-blob small &&
+	test_tick &&
+	git commit -m one &&
+	git tag one &&
+	BIG=$(git rev-parse one:big-blob) &&
+	PACK=$(echo one | git pack-objects --revs pack) &&
+	{ cat big-blob && echo more; } >big-blob.new &&
+	mv big-blob.new big-blob &&
+	git commit -a -m two &&
+	BIG2=$(git rev-parse HEAD:big-blob) &&
+	DELTA_PACK=$(echo HEAD | git -c core.bigFileThreshold=10m \
+		pack-objects --revs pack) &&
+	git verify-pack -v pack-$DELTA_PACK.pack >list &&
+	grep "^$BIG blob .* 1 $BIG2$" list
+'
+
+test_expect_success 'unpack big blob in core below core.bigFileThreshold' '
+	prepare_dest 3m &&
+	test_must_fail env GIT_ALLOC_LIMIT=1m \
+		git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git fsck
+'
+
+test_expect_success 'unpack big blob in stream above core.bigFileThreshold' '
+	prepare_dest 200k &&
+	GIT_ALLOC_LIMIT=1m git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git fsck &&
+	git -C dest.git cat-file blob $BIG >actual &&
+	git cat-file blob $BIG >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unpack big blob in stream with --strict' '
+	prepare_dest 200k &&
+	GIT_ALLOC_LIMIT=1m git -C dest.git unpack-objects --strict \
+		<pack-$PACK.pack &&
+	git -C dest.git fsck
+'
+
+test_expect_success 'streamed blob already in the repository' '
+	prepare_dest 200k &&
+	git -C dest.git unpack-objects <pack-$PACK.pack &&
+	git -C dest.git unpack-objects <pack-$PACK.pack &&
+	find dest.git/objects -name "tmp_obj_*" >tmp &&
+	test_must_be_empty tmp &&
+	git -C dest.git fsck
+'
+
+test_expect_success 'delta against a streamed blob' '
+	prepare_dest 200k &&
+	git -C dest.git unpack-objects <pack-$DELTA_PACK.pack &&
+	git -C dest.git fsck &&
+	git -C dest.git cat-file blob $BIG >actual &&
+	git cat-file blob $BIG >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'dry-run does not write the big blob' '
+	prepare_dest 200k &&
+	git -C dest.git unpack-objects -n <pack-$PACK.pack &&
+	test_must_fail git -C dest.git cat-file -e $BIG
+'
+
+test_done
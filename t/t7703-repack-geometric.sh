@@ -0,0 +1,171 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# Create a pack holding "$1" new blobs, and print its name.
+make_pack () {
+	n=$(cat blob-count 2>/dev/null || echo 0) &&
+	for i in $(test_seq 1 $1)
+	do
+		echo "blob $(($n + $i))" | git hash-object -w --stdin || return 1
+	done >objects &&
+	echo $(($n + $1)) >blob-count &&
+	git pack-objects $packdir/pack <objects
+}
+
+count_packs () {
+	ls $packdir/pack-*.pack 2>/dev/null | wc -l
+}
+
+test_expect_success '--geometric with no packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		git repack --geometric 2 >out &&
+		test_i18ngrep "Nothing new to pack" out
+	)
+'
+
+test_expect_success '--geometric with an intact progression' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 1 &&
+		make_pack 4 &&
+		make_pack 16 &&
+		ls $packdir/pack-*.pack | sort >expect &&
+		git repack --geometric 3 -d &&
+		ls $packdir/pack-*.pack | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric rolls up the smallest packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		small1=$(make_pack 2) &&
+		small2=$(make_pack 3) &&
+		big=$(make_pack 32) &&
+		git repack --geometric 2 -d &&
+		test $(count_packs) = 2 &&
+		test_path_is_file $packdir/pack-$big.pack &&
+		test_path_is_missing $packdir/pack-$small1.pack &&
+		test_path_is_missing $packdir/pack-$small2.pack &&
+		git verify-pack -v $packdir/pack-*.idx >list &&
+		test $(grep -c " blob " list) = 37
+	)
+'
+
+test_expect_success '--geometric rolls up packs the new pack outgrows' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 5 &&
+		make_pack 6 &&
+		make_pack 12 &&
+		git repack --geometric 2 -d &&
+		test $(count_packs) = 1
+	)
+'
+
+test_expect_success '--geometric packs loose objects' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack 10 &&
+		test_commit loose &&
+		git repack --geometric 2 -d &&
+		test $(count_packs) = 2 &&
+		git count-objects -v >count &&
+		grep "^count: 0" count &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric does not duplicate objects of kept packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		kept=$(make_pack 3) &&
+		touch $packdir/pack-$kept.keep &&
+		cat objects >kept-objects &&
+		git pack-objects $packdir/pack <kept-objects &&
+		make_pack 4 &&
+		git repack --geometric 2 -d &&
+		test_path_is_file $packdir/pack-$kept.pack &&
+		test $(count_packs) = 2 &&
+		for p in $packdir/pack-*.idx
+		do
+			git show-index <$p || return 1
+		done >all &&
+		test $(wc -l <all) = 7
+	)
+'
+
+test_expect_success '--geometric is incompatible with -a' '
+	test_must_fail git repack --geometric 2 -a 2>err &&
+	test_i18ngrep "incompatible" err
+'
+
+test_expect_success 'pack-objects --stdin-packs excludes objects of ^packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		a=$(make_pack 3) &&
+		cp objects a-objects &&
+		b=$(cat a-objects | git pack-objects $packdir/pack) &&
+		c=$(make_pack 2) &&
+		cat >in <<-EOF &&
+		pack-$b.pack
+		pack-$c.pack
+		^pack-$a.pack
+		EOF
+		new=$(git pack-objects --stdin-packs $packdir/pack <in) &&
+		git show-index <$packdir/pack-$new.idx >actual &&
+		test_line_count = 2 actual &&
+		echo bogus.pack >in &&
+		test_must_fail git pack-objects --stdin-packs $packdir/pack <in
+	)
+'
+
+test_expect_success 'pack-objects --stdin-packs names objects for the delta search' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		# versions of a and b alternate in size, so that paired
+		# by size alone they would only be compared to each other
+		for i in $(test_seq 1 5)
+		do
+			{ test-genrandom a 10000 && test_seq 1 $i; } >a &&
+			{ test-genrandom b 10000 && test_seq 1 $i && echo; } >b &&
+			git add a b &&
+			test_tick &&
+			git commit -qm "commit $i" || return 1
+		done &&
+		new=$(git pack-objects --stdin-packs --unpacked --window=1 \
+			$packdir/pack </dev/null) &&
+		git verify-pack -v $packdir/pack-$new.idx >list &&
+		test $(grep -c "^$_x40 blob .* $_x40$" list) = 8 &&
+		echo pack-$new.pack >in &&
+		new=$(git pack-objects --stdin-packs --window=1 --no-reuse-delta \
+			$packdir/again <in) &&
+		git verify-pack -v $packdir/again-$new.idx >list &&
+		test $(grep -c "^$_x40 blob .* $_x40$" list) = 8
+	)
+'
+
+test_done
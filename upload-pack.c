@@ -18,6 +18,7 @@
 #include "parse-options.h"
 #include "argv-array.h"
 #include "prio-queue.h"
+#include "commit-graph.h"
 
 static const char * const upload_pack_usage[] = {
 	N_("git upload-pack [<options>] <dir>"),
@@ -37,6 +38,7 @@ static const char * const upload_pack_usage[] = {
 #define HIDDEN_REF	(1u << 19)
 
 static timestamp_t oldest_have;
+static uint32_t min_have_generation = GENERATION_NUMBER_INFINITY;
 
 static int deepen_relative;
 static int multi_ack;
@@ -287,6 +289,14 @@ static void create_pack_file(void)
 	die("git upload-pack: %s", abort_msg);
 }
 
+static void update_min_have_generation(struct commit *commit)
+{
+	uint32_t generation = commit_generation(commit);
+
+	if (generation < min_have_generation)
+		min_have_generation = generation;
+}
+
 static int got_oid(const char *hex, struct object_id *oid)
 {
 	struct object *o;
@@ -309,10 +319,13 @@ static int got_oid(const char *hex, struct object_id *oid)
 			o->flags |= THEY_HAVE;
 		if (!oldest_have || (commit->date < oldest_have))
 			oldest_have = commit->date;
+		update_min_have_generation(commit);
 		for (parents = commit->parents;
 		     parents;
-		     parents = parents->next)
+		     parents = parents->next) {
 			parents->item->object.flags |= THEY_HAVE;
+			update_min_have_generation(parents->item);
+		}
 	}
 	if (!we_knew_they_have) {
 		add_object_array(o, NULL, &have_obj);
@@ -341,6 +354,9 @@ static int reachable(struct commit *want)
 		commit->object.flags |= REACHABLE;
 		if (commit->date < oldest_have)
 			continue;
+		/* nothing below the lowest THEY_HAVE commit can reach one */
+		if (commit_generation(commit) < min_have_generation)
+			continue;
 		for (list = commit->parents; list; list = list->next) {
 			struct commit *parent = list->item;
 			if (!(parent->object.flags & REACHABLE))
@@ -1020,6 +1036,8 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 			allow_unadvertised_object_request |= ALLOW_ANY_SHA1;
 		else
 			allow_unadvertised_object_request &= ~ALLOW_ANY_SHA1;
+	} else if (!strcmp("core.commitgraph", var)) {
+		core_commit_graph = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.keepalive", var)) {
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
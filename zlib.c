@@ -3,6 +3,10 @@
  * at init time.
  */
 #include "cache.h"
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#include "thread-utils.h"
+#endif
 
 static const char *zerr_to_string(int status)
 {
@@ -146,6 +150,77 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+/*
+ * Inflate a complete zlib stream that starts at "in" into exactly
+ * "outlen" bytes at "out". "in" may extend past the end of the stream.
+ * Returns 0 on success, or -1 when the stream could not be inflated in
+ * one go (e.g. "in" does not hold all of it, or it does not inflate to
+ * "outlen" bytes). The caller should then fall back to git_inflate(),
+ * which also diagnoses corrupt data.
+ *
+ * Only available when built with USE_LIBDEFLATE: libdeflate is much
+ * faster than zlib but cannot stream, while with zlib this would be
+ * no better than git_inflate(). It may be called from several threads
+ * at once.
+ */
+#ifdef USE_LIBDEFLATE
+#ifndef NO_PTHREADS
+static pthread_key_t decompressor_key;
+static pthread_once_t decompressor_once = PTHREAD_ONCE_INIT;
+
+static void free_decompressor(void *decompressor)
+{
+	libdeflate_free_decompressor(decompressor);
+}
+
+static void init_decompressor_key(void)
+{
+	if (pthread_key_create(&decompressor_key, free_decompressor))
+		die("unable to create thread-specific decompressor");
+}
+#endif
+
+/* Each thread gets a decompressor of its own. */
+static struct libdeflate_decompressor *get_decompressor(void)
+{
+#ifndef NO_PTHREADS
+	struct libdeflate_decompressor *decompressor;
+
+	pthread_once(&decompressor_once, init_decompressor_key);
+	decompressor = pthread_getspecific(decompressor_key);
+	if (!decompressor) {
+		decompressor = libdeflate_alloc_decompressor();
+		if (!decompressor)
+			die("libdeflate: out of memory");
+		pthread_setspecific(decompressor_key, decompressor);
+	}
+	return decompressor;
+#else
+	static struct libdeflate_decompressor *decompressor;
+
+	if (!decompressor) {
+		decompressor = libdeflate_alloc_decompressor();
+		if (!decompressor)
+			die("libdeflate: out of memory");
+	}
+	return decompressor;
+#endif
+}
+
+int git_inflate_buffer(void *out, unsigned long outlen,
+		       const void *in, unsigned long inlen)
+{
+	struct libdeflate_decompressor *decompressor = get_decompressor();
+	size_t used_in, used_out;
+
+	if (libdeflate_zlib_decompress_ex(decompressor, in, inlen,
+					  out, outlen,
+					  &used_in, &used_out) != LIBDEFLATE_SUCCESS)
+		return -1;
+	return used_out == outlen ? 0 : -1;
+}
+#endif
+
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
 #endif